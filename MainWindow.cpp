@@ -260,6 +260,14 @@ void MainWindow::create3DView()
 
         ui->tree->link(_glWidget);
 
+        connect(_glWidget, &customGLWidget::pointPicked, this, [=](const QVariantMap &point)
+        {
+            QString text=QString::asprintf("%.3f, %.3f, %.3f", point["x"].toDouble(), point["y"].toDouble(), point["z"].toDouble());
+            if(point.contains("amplitude")) text+=QString::asprintf("  amp %.1f", point["amplitude"].toDouble());
+            if(point.contains("range")) text+=QString::asprintf("  range %.3f", point["range"].toDouble());
+            logMessage(0, point["entity"].toString()+": "+text);
+        });
+
         connect(_glWidget, &customGLWidget::initialized,[=]()
         {
             QStringList models;
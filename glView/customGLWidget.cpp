@@ -27,6 +27,7 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 
 #include "gl_3axis_entity.h"
 #include "gl_pcloud_entity.h"
+#include "gl_pcloud_batch.h"
 #include "rot.h"
 
 #ifdef USE_EDL
@@ -37,8 +38,8 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #endif
 
 #include <cassert>
+#include <algorithm>
 
-#include <QPainter>
 #include <QMouseEvent>
 #include <QWheelEvent>
 #include <QApplication>
@@ -52,6 +53,9 @@ static void applyViewOptions(const QVariantMap x, viewOptions &opts)
     opts.persFar= x["dsbPersFar"].toDouble();
     opts.orthNear= x["dsbOrthNear"].toDouble();
     opts.orthFar= x["dsbOrthFar"].toDouble();
+    opts.batchSmallClouds= x["cbBatchSmallClouds"].toInt();
+    opts.gpuBudget= x["sbGpuBudget"].toInt();
+    opts.cpuBudget= x["sbCpuBudget"].toInt();
 }
 
 void customGLWidget::viewOptionsTriggered(void)
@@ -62,6 +66,7 @@ void customGLWidget::viewOptionsTriggered(void)
         _viewOptionsStorage=dlg._opts;
         viewOptionsDialog::save(_viewOptionsStorage);
         applyViewOptions(_viewOptionsStorage,_viewOptions);
+        _budget.setBudget((quint64)_viewOptions.gpuBudget<<20, (quint64)_viewOptions.cpuBudget<<20);
         draftUpdate();
     }
 }
@@ -70,6 +75,7 @@ customGLWidget::customGLWidget(QWidget *parent) : QOpenGLWidget(parent)
 {
     _viewOptionsStorage=viewOptionsDialog::load();
     applyViewOptions(_viewOptionsStorage,_viewOptions);
+    _budget.setBudget((quint64)_viewOptions.gpuBudget<<20, (quint64)_viewOptions.cpuBudget<<20);
 
 #ifdef USE_EDL
     m_fbo = nullptr;
@@ -78,33 +84,23 @@ customGLWidget::customGLWidget(QWidget *parent) : QOpenGLWidget(parent)
 #endif
 
     _depthContext=nullptr;
+    _depthReadback=nullptr;
+    _altDepthRequired=0;
     _poiIndicator=nullptr;
+    _batch=nullptr;
 
     _cameraMode=CAM_PERSPECTIVE;
     _cameraControl=CAM_CTRL_LEGACY; //CAM_CTRL_POTTERSWHEEL;
 
-    {
-        _depthSearchRadius=24;
-        int x=0,y=0;
-        int step=1;
-        int sign=1;
-        _depthSearchArea<<QPoint(0,0);
-        while(_depthSearchArea.size()<(_depthSearchRadius-1)*(_depthSearchRadius-1))
-        {
-            for(int j=0;j<step;j++)
-            {
-                y+=sign;
-                _depthSearchArea<<QPoint(x,y);
-            }
-            for(int j=0;j<step;j++)
-            {
-                x+=sign;
-                _depthSearchArea<<QPoint(x,y);
-            }
-            step++;
-            sign*=-1;
-        }
-    }
+    memset(_filterApplied,0,sizeof(_filterApplied));
+
+    _depthSearchRadius=24;
+
+    _scene=std::make_shared<gl_scene_t>();
+
+    _pass=0;
+    _passes=1;
+    setUpdateBehavior(QOpenGLWidget::PartialUpdate);  //progressive passes accumulate on the previous image
 }
 
 customGLWidget::~customGLWidget()
@@ -127,6 +123,16 @@ customGLWidget::~customGLWidget()
     {
         delete _depthContext;
     }
+
+    if(_batch!=nullptr || _depthReadback!=nullptr)
+    {
+        makeCurrent();
+        delete _batch;
+        _batch=nullptr;
+        delete _depthReadback;
+        _depthReadback=nullptr;
+        doneCurrent();
+    }
 }
 
 QSize customGLWidget::sizeHint() const
@@ -176,6 +182,18 @@ void customGLWidget::initializeGL()
     {
         makeCurrent();
 
+        if(_batch!=nullptr)
+        {
+            delete _batch;
+            _batch=nullptr;
+        }
+
+        if(_depthReadback!=nullptr)
+        {
+            delete _depthReadback;
+            _depthReadback=nullptr;
+        }
+
         doneCurrent();
     });
 
@@ -187,11 +205,19 @@ void customGLWidget::initializeGL()
     _draw.pointAntiAlias=1;
 
     _draw.modelScale = 1.0f;
+    _draw.pass=0;
+    _draw.passes=1;
 
     resetCamera();
 
     _next_mode=GL_DRAW_NORMAL;
 
+    _batch=new gl_pcloud_batch;
+    _batch->initialize();
+
+    _depthReadback=new depthReadback;
+    _depthReadback->initialize();
+
 #ifdef USE_EDL
     initFBO(128,128);
     m_activeGLFilter=new ccEDLFilter;
@@ -201,8 +227,6 @@ void customGLWidget::initializeGL()
     connect(&_timer4update, SIGNAL(timeout()), this, SLOT(update()));
     connect(&_timer4pertialPrepare, SIGNAL(timeout()), this, SLOT(pertialPrepare()));
 
-    _timer4pertialPrepare.start(1000/60);
-
     load_stock();
 
     emit initialized();
@@ -218,6 +242,8 @@ void customGLWidget::resizeGL(int w, int h)
     _draw.height=h;
     _draw.aspectRatio=(double)(_draw.width) / (double)(_draw.height);
 
+    _pass=0;    //accumulated image is lost
+
     if(_depthContext!=nullptr)
     {
         delete _depthContext;
@@ -261,17 +287,25 @@ void customGLWidget::mouseReleaseEvent(QMouseEvent *event)
 
 void customGLWidget::paintGL()
 {
-    QPainter p(this);
-    p.setRenderHint(QPainter::Antialiasing);
-
     _timer4update.stop();
 
     int nextTimeout=500;
 
-    p.endNativePainting();
-
     OpenGLFunctions* glfunc=functions();
 
+    if(_next_mode!=GL_DRAW_NORMAL || _pass==0)
+    {   //new image
+        _pass=0;
+        _passes=progressivePasses();
+    }
+    _draw.pass=_pass;
+    _draw.passes=_passes;
+    if(_next_mode==GL_DRAW_TEMP && _draw.opt_pc.ignoreDraft)
+    {
+        _draw.passes=1;
+    }
+    bool lastPass= _next_mode!=GL_DRAW_NORMAL || _pass+1>=_passes;
+
 #ifdef USE_EDL
     if(_draw.eyeDomeLighting)
     {
@@ -294,29 +328,33 @@ void customGLWidget::paintGL()
         bindFBO(nullptr);
         GLuint depthTex = m_fbo->getDepthTexture();
         GLuint colorTex = m_fbo->getColorTexture();
+        GLuint screenTex = colorTex;    //m_fbo keeps the passes, shown without EDL until the last one
 
-        ccGlFilter::ViewportParameters parameters;
+        if(lastPass)
         {
-            parameters.perspectiveMode = _cameraMode==CAM_PERSPECTIVE;
-            parameters.zFar = parameters.perspectiveMode ? _viewOptions.persFar:_viewOptions.orthFar;
-            parameters.zNear = parameters.perspectiveMode ? _viewOptions.persNear:_viewOptions.orthNear;
-            parameters.zoom = parameters.perspectiveMode ? computePerspectiveZoom() : 3.0;//m_viewportParams.zoom; //TODO: doesn't work well with EDL in perspective mode!
-        }
+            ccGlFilter::ViewportParameters parameters;
+            {
+                parameters.perspectiveMode = _cameraMode==CAM_PERSPECTIVE;
+                parameters.zFar = parameters.perspectiveMode ? _viewOptions.persFar:_viewOptions.orthFar;
+                parameters.zNear = parameters.perspectiveMode ? _viewOptions.persNear:_viewOptions.orthNear;
+                parameters.zoom = parameters.perspectiveMode ? computePerspectiveZoom() : 3.0;//m_viewportParams.zoom; //TODO: doesn't work well with EDL in perspective mode!
+            }
 
-        m_activeGLFilter->shade(depthTex, colorTex, parameters);
-        bindFBO(nullptr); //in case the active filter has used a FBOs!
+            m_activeGLFilter->shade(depthTex, colorTex, parameters);
+            bindFBO(nullptr); //in case the active filter has used a FBOs!
 
-        GLuint screenTex = m_activeGLFilter->getTexture();
+            screenTex = m_activeGLFilter->getTexture();
+        }
         if(glfunc->glIsTexture(screenTex))
         {
             setStandardOrthoCorner();
-            glfunc->glPushAttrib(GL_DEPTH_BUFFER_BIT);
+            GLboolean depthTest=glfunc->glIsEnabled(GL_DEPTH_TEST);    //instead of glPushAttrib(GL_DEPTH_BUFFER_BIT)
             glfunc->glDisable(GL_DEPTH_TEST);
 
             ccGLUtils::DisplayTexture2DPosition(screenTex, 0, 0, _draw.width, _draw.height);
 
             glfunc->glBindTexture(GL_TEXTURE_2D, defaultFramebufferObject());
-            glfunc->glPopAttrib(); //GL_DEPTH_BUFFER_BIT
+            if(depthTest) glfunc->glEnable(GL_DEPTH_TEST);
         }
     }
     else
@@ -327,28 +365,65 @@ void customGLWidget::paintGL()
     doneCurrent();
 #endif
 
-    p.beginNativePainting();
+    if(lastPass)
+    {
+        _pass=0;
+    }
 
-    if(_next_mode==GL_DRAW_TEMP)
+    if(_next_mode==GL_DRAW_TEMP && !_draw.draftOnly)
     {
-        if(!_draw.draftOnly)
-        {
-            _next_mode=GL_DRAW_NORMAL;
+        _next_mode=GL_DRAW_NORMAL;
 
-            _timer4update.start(nextTimeout);
-        }
+        _timer4update.start(nextTimeout);
     }
-    else
-    {
+    else if(!lastPass)
+    {   //next slice after pending input, draftUpdate() cancels it
+        _pass++;
+        _timer4update.start(0);
+    }
+    else if(isAnimating())
+    {   //repaint continues only while something moves
+        _timer4update.start(ANIMATION_INTERVAL_MS);
+    }
+}
 
+bool customGLWidget::isAnimating(void)
+{
+    bool ret=false;
+    gl_scene_ptr s=scene();
+    foreach(auto ctx,s->entities)
+    {
+        if(ctx->show()==Qt::Checked && ctx->isAnimated())
+        {
+            ret=true;
+            break;
+        }
     }
+    return ret;
 }
 
 
 
+// number of passes to build the idle image, moving entities can't be accumulated
+int customGLWidget::progressivePasses(void)
+{
+    if(isAnimating()) return 1;
+
+    quint64 n=0;
+    gl_scene_ptr s=scene();
+    foreach(auto ctx,s->entities)
+    {
+        if(ctx->show()==Qt::Checked) n+=ctx->progressivePoints();
+    }
+
+    int passes=(int)((n+PROGRESSIVE_PASS_POINTS-1)/PROGRESSIVE_PASS_POINTS);
+    return qBound(1,passes,PROGRESSIVE_MAX_PASSES);
+}
+
 void customGLWidget::draftUpdate(void)
 {
     _next_mode=GL_DRAW_TEMP;
+    _pass=0;
     emit update();
 }
 
@@ -362,10 +437,19 @@ void customGLWidget::poiIndicatorUpdate(void)
     }
 }
 
+// progressive passes: the first one clears and draws everything but alpha blended entities,
+// following ones add slices of large clouds, the last one draws the rest.
 void customGLWidget::draw_core(int mode)
 {
+    bool firstPass= _draw.pass==0;
+    bool lastPass= mode!=GL_DRAW_NORMAL || _draw.pass+1>=_draw.passes;
+
     _draw.mode=mode;
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    _draw.frame++;
+    if(firstPass)
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
     glEnable(GL_DEPTH_TEST);
 //    glEnable(GL_CULL_FACE);
     glEnable(GL_MULTISAMPLE);
@@ -397,38 +481,52 @@ void customGLWidget::draw_core(int mode)
 
     _draw.world.setToIdentity();
 
-    lockEntities();
+    gl_scene_ptr s=scene();     //loaders may publish a new one while this frame is drawn
 
-    foreach(auto ctx,_entities.values())
-    {
-        if(!ctx->isAlphaBlend() && ctx->isPickable() && !ctx->isReference())
+    filterUpdate(*s);
+
+    if(mode!=GL_DRAW_PICK && firstPass)
+    {   //evicted entities come back when they are shown
+        _budget.nextFrame();
+        foreach(auto ctx,s->entities)
         {
-            ctx->draw_gl(_draw);
+            if(ctx->show()!=Qt::Checked) continue;
+            _budget.touch(ctx);
+            if(ctx->evicted() && ctx->restore())
+            {
+                prepareLater(ctx);
+            }
         }
     }
 
+    if(_batch!=nullptr && firstPass)
+    {
+        _batch->draw_gl(_draw);
+    }
+
+    foreach(const auto &i,s->opaquePickable)
+    {
+        if(firstPass || i.ctx->progressivePoints()) i.ctx->draw_gl(_draw);
+    }
+
+    if(!lastPass) return;
 
-    {   //read depth buffer
-        glReadPixels(0,0,_draw.width,_draw.height,GL_DEPTH_COMPONENT,GL_FLOAT,_depthContext->depth());
-        GLenum error=glGetError();
-        if(!error)
+    if(mode!=GL_DRAW_PICK)
+    {   //copy depth buffer of pickable entities, it's read later by unproj() only when needed
+        if(_depthReadback!=nullptr && _depthReadback->capture(_draw.width,_draw.height,_draw.proj * _draw.camera * _draw.world))
         {
-            _depthContext->setWhich(1);
             _altDepthRequired=0;
         }
         else
         {
             _altDepthRequired=1;
-            updateDepth();
+            _depthContext->setWhich(0);     //updateDepth() on demand
         }
     }
 
-    foreach(auto ctx,_entities.values())
+    foreach(const auto &i,s->opaqueOther)
     {
-        if(!ctx->isAlphaBlend() && !ctx->isPickable() && !ctx->isReference())
-        {
-            ctx->draw_gl(_draw);
-        }
+        i.ctx->draw_gl(_draw);
     }
 
     if(mode!=GL_DRAW_PICK)
@@ -437,12 +535,9 @@ void customGLWidget::draw_core(int mode)
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
 
-    foreach(auto ctx,_entities.values())
+    foreach(const auto &i,s->alphaBlend)
     {
-        if(ctx->isAlphaBlend() && !ctx->isReference())
-        {
-            ctx->draw_gl(_draw);
-        }
+        i.ctx->draw_gl(_draw);
     }
 
     if(mode!=GL_DRAW_PICK)
@@ -451,22 +546,46 @@ void customGLWidget::draw_core(int mode)
     }
 
     glGetIntegerv(GL_VIEWPORT, _draw.viewport);
-    unlockEntities();
+
+    if(mode!=GL_DRAW_PICK)
+    {
+        _budget.enforce(s->entities);
+    }
 
 }
 
+// give changed filter parameters to entities, compaction runs on worker threads
+// and index buffers are uploaded by pertialPrepare()
+void customGLWidget::filterUpdate(const gl_scene_t &s)
+{
+    const opt_pointcloud_t &o=_draw.opt_pc;
+    float f[6]={o.flt_amp[0],o.flt_amp[1],o.flt_rng[0],o.flt_rng[1],o.flt_hgt[0],o.flt_hgt[1]};
+    if(!memcmp(f,_filterApplied,sizeof(f))) return;
+    memcpy(_filterApplied,f,sizeof(f));
+
+    foreach(auto ctx,s.entities)
+    {
+        if(ctx->filterRequest(_draw))
+        {
+            prepareLater(ctx);
+        }
+    }
+}
+
 //--------------------------------------------------------------------------------
 // Depth buffer for Picking
 //--------------------------------------------------------------------------------
 
 void customGLWidget::updateDepth(void)
 {
-    if(_altDepthRequired)
+    if(_altDepthRequired && !_depthContext->isValid())
     {
         qDebug()<<"altDepth";
         makeCurrent();
         {
             qt_opengl_depth depth(_depthContext);     //FBO is prepared in this constructor
+            _draw.pass=0;                               //every point in one pass
+            _draw.passes=1;
             draw_core(GL_DRAW_PICK);
             depth.read();
         }
@@ -474,30 +593,94 @@ void customGLWidget::updateDepth(void)
     }
 }
 
+// nearest depth sample to the cursor within _depthSearchRadius/2 is unprojected
 int customGLWidget::unproj(int winX,int winY, QVector3D &ret)
 {
-    int x,y,valid=0;
+    int x,y,px,py,valid=0;
     GLfloat z;
     x=winX;
     y=_draw.height-winY;
 
-    int r=_depthSearchRadius/2+1;
+    int r=_depthSearchRadius/2;
+
+    QMatrix4x4 pvm=_draw.proj * _draw.camera * _draw.world;
+    int viewport[4];
+    memcpy(viewport,_draw.viewport,sizeof(viewport));
+
+    if(!_altDepthRequired && _depthReadback!=nullptr)
+    {
+        makeCurrent();
+        valid=_depthReadback->nearest(x,y,r,px,py,z,pvm,viewport);
+        doneCurrent();
+    }
+    else if(_depthContext!=nullptr)
+    {
+        updateDepth();
+        const depth_pyramid *pyramid=_depthContext->pyramid();
+        valid= pyramid!=nullptr && pyramid->nearest(x,y,r,px,py,z);
+    }
+
+    if(valid)
+    {
+        valid=qt_opengl_unproj(QVector3D(px,py,z), pvm, viewport, ret);
+    }
+    return valid;
+}
+
+// CPU picking by spatial index of entities, the nearest hit along the ray is returned
+int customGLWidget::pick(int winX, int winY, QVariantMap &result)
+{
+    if(_draw.width<=0 || _draw.height<=0) return 0;
+
+    bool invertible;
+    QMatrix4x4 m=(_draw.proj * _draw.camera * _draw.world).inverted(&invertible);
+    if(!invertible) return 0;
+
+    float x=2.0f*winX/_draw.width-1.0f;
+    float y=1.0f-2.0f*winY/_draw.height;
+    float dx=(float)_depthSearchRadius/_draw.width;    //same area as unproj()
+
+    QVector3D n0=m.map(QVector3D(x,y,-1.0f));
+    QVector3D f0=m.map(QVector3D(x,y,1.0f));
+    QVector3D n1=m.map(QVector3D(x+dx,y,-1.0f));
+    QVector3D f1=m.map(QVector3D(x+dx,y,1.0f));
 
-    if((r<x) && (x+r<_draw.width) &&
-       (r<y) && (y+r<_draw.height))
+    float len=(f0-n0).length();
+    if(len<=0.0f) return 0;
+
+    gl_pick_ray_t ray;
+    ray.org=n0;
+    ray.dir=(f0-n0)/len;
+    ray.tol0=(n1-n0).length();
+    ray.tolSlope=((f1-f0).length()-ray.tol0)/len;
+
+    int valid=0;
+    gl_scene_ptr s=scene();
+    foreach(auto ctx,s->entities)
     {
-        if(_depthContext!=nullptr)
+        if(!ctx->isPickable() || ctx->isReference()) continue;
+
+        QVariantMap r;
+        if(ctx->pick(ray,r))
+        {
+            if(!valid || r["distance"].toFloat()<result["distance"].toFloat())
+            {
+                result=r;
+                valid=1;
+            }
+        }
+    }
+
+    if(valid)
+    {   //entities without spatial index (models) may hide the point, check it by depth buffer
+        QVector3D p;
+        if(unproj(winX, winY, p))
         {
-            foreach(auto p,_depthSearchArea)
+            float t=QVector3D::dotProduct(p-ray.org, ray.dir);
+            float d=result["distance"].toFloat();
+            if(d-t > 2.0f*(ray.tol0+ray.tolSlope*d))
             {
-                if(_depthContext->get_depth(x+p.x(),y+p.y(),z))
-                {
-                    valid=qt_opengl_unproj(QVector3D(x+p.x(),y+p.y(),z), _draw.proj * _draw.camera * _draw.world, _draw.viewport, ret);
-                    if(valid)
-                    {
-                        break;
-                    }
-                }
+                valid=0;
             }
         }
     }
@@ -571,7 +754,19 @@ void customGLWidget::mouseDoubleClickEvent(QMouseEvent *event)
 {
     if(!getEntitiesCount()) return;
 
-    if( unproj( event->x(), event->y(), _poi) )
+    QVariantMap picked;
+    int valid=pick(event->x(), event->y(), picked);
+    if(valid)
+    {
+        _poi=QVector3D(picked["x"].toFloat(), picked["y"].toFloat(), picked["z"].toFloat());
+        emit pointPicked(picked);
+    }
+    else
+    {
+        valid=unproj(event->x(), event->y(), _poi);
+    }
+
+    if(valid)
     {
         QStringList poiStrLst;
         poiStrLst << QString::asprintf("%.3f",_poi.x());
@@ -771,15 +966,17 @@ void customGLWidget::update_by_poi(void)//update poc by quat, poi and range
 
 //--------------------------------------------------------------------------------
 // Entities Access Control
+//   the entity set is published as an immutable snapshot, readers take it without lock.
+//   writers copy the current one, change the copy and swap it in. containers in it are
+//   implicitly shared, so the copy duplicates only what is changed.
 //--------------------------------------------------------------------------------
 
-void customGLWidget::lockEntities(void)
-{
-    _mtxEntities.lock();
-}
-void customGLWidget::unlockEntities(void)
+void customGLWidget::modifyScene(const std::function<void(gl_scene_t &)> &f)
 {
-    _mtxEntities.unlock();
+    QMutexLocker lock(&_mtxScene);
+    auto s=std::make_shared<gl_scene_t>(*std::atomic_load(&_scene));
+    f(*s);
+    std::atomic_store(&_scene, gl_scene_ptr(s));
 }
 
 void customGLWidget::delayLoad(gl_entity_ctx *ctx, const char *path)
@@ -822,36 +1019,55 @@ void customGLWidget::pertialPrepare(void)
     bool redraw=false;
     if(_entitiesNotCompleted.size())
     {
-        lockEntities();
         makeCurrent();
         foreach(auto key,_entitiesNotCompleted.keys())
         {
-            if(!_entitiesNotCompleted[key]->pertialPrepare_gl())
+            int ret=_entitiesNotCompleted[key]->pertialPrepare_gl();
+            if(ret & ENTITY_PREPARE_REDRAW) redraw=true;    //appended vertices while it's still busy
+            if(!(ret & ~ENTITY_PREPARE_REDRAW))
             {
+                if(_entitiesNotCompleted[key]->filterRequest(_draw)) continue;  //restored entity needs its filter again
                 _entitiesNotCompleted.remove(key);
-                if(!_entitiesNotCompleted.size())
-                {//final one
-                    redraw=true;
-                }
+                redraw=true;
             }
         }
         doneCurrent();
-        unlockEntities();
+    }
+    if(!_entitiesNotCompleted.size())
+    {   //nothing to do until prepareLater()
+        _timer4pertialPrepare.stop();
     }
     if(redraw) draftUpdate();
 }
 
+// entity is given to pertialPrepare() until it's completed, the timer runs only while the list has entities
+void customGLWidget::prepareLater(gl_entity_ctx *ctx)
+{
+    _entitiesNotCompleted[ ctx->uniqueId() ]=ctx;
+    if(!_timer4pertialPrepare.isActive())
+    {
+        _timer4pertialPrepare.start(PARTIAL_PREPARE_INTERVAL_MS);
+    }
+}
+
 void customGLWidget::rebuildRequest(QUuid id)
 {
-    lockEntities();
-    if(_entities.contains(id))
+    gl_entity_ctx *ctx=scene()->entities.value(id,nullptr);
+    if(ctx!=nullptr)
     {
-        if(_entities[id]->rebuildRequest())
+        if(ctx->rebuildRequest())
+        {
+           prepareLater(ctx);
+        }
+        if(ctx->filterRequest(_draw))
         {
-           _entitiesNotCompleted[ id ]=_entities[id];
+           prepareLater(ctx);
+        }
+        if(!renderListed(*scene(), ctx))
+        {   //vertex format has changed
+            modifyScene([=](gl_scene_t &s){ renderListUpdate(s, ctx); });
         }
     }
-    unlockEntities();
 }
 
 void customGLWidget::entityLoaded(QObject *x)
@@ -864,15 +1080,26 @@ void customGLWidget::entityLoaded(QObject *x)
             qDebug() << "target:" << ctx->info[ENTITY_INFO_TARGET_FILENAME].toString();
 
             qDebug() << "prepare begin" << thread();
-            lockEntities();
             makeCurrent();
+            gl_pcloud_entity *pc=qobject_cast<gl_pcloud_entity*>(ctx);
+            if(pc!=nullptr && _viewOptions.batchSmallClouds && _batch!=nullptr && _batch->isAvailable())
+            {
+                pc->setBatch(_batch);
+            }
             if(ctx->prepare_gl())
             {
-                _entitiesNotCompleted[ ctx->uniqueId() ]=ctx;
+                prepareLater(ctx);
+            }
+            if(ctx->filterRequest(_draw))
+            {
+                prepareLater(ctx);
             }
             doneCurrent();
-            _entities[ ctx->uniqueId() ]=ctx;
-            unlockEntities();
+            modifyScene([=](gl_scene_t &s)
+            {
+                s.entities[ ctx->uniqueId() ]=ctx;
+                renderListUpdate(s, ctx);
+            });
             qDebug() << "gl_entity_ctx prepared"  << thread();
 
             if(ctx->update_draw_gl(_draw))
@@ -895,18 +1122,20 @@ void customGLWidget::entityUnload(QObject *x)
     gl_entity_ctx *ctx=dynamic_cast<gl_entity_ctx*>(x);
     if(ctx!=NULL)
     {
-        lockEntities();
-        if(_entities.contains(ctx->uniqueId()))
+        modifyScene([=](gl_scene_t &s)
         {
-            _entities.remove(ctx->uniqueId());
-        }
-        unlockEntities();
+            s.entities.remove(ctx->uniqueId());
+            renderListUpdate(s, ctx);
+        });
+        _entitiesNotCompleted.remove(ctx->uniqueId());
 
         emit entityUnloaded(x);
 
         qDebug()<<ctx->getCaption()<<"unloaded.";
 
+        makeCurrent();     //VAOs, buffers and programs are released in cleanup()
         ctx->cleanup();
+        doneCurrent();
 
         ctx->deleteLater();
 
@@ -914,11 +1143,56 @@ void customGLWidget::entityUnload(QObject *x)
     }
 }
 
-void customGLWidget::redrawEntity(void)
+void customGLWidget::redrawEntity(gl_entity_ctx *ctx)
 {
+    if(ctx!=nullptr)
+    {
+        modifyScene([=](gl_scene_t &s){ renderListUpdate(s, ctx); });
+    }
     draftUpdate();
 }
 
+// render lists hold shown entities in the order of their keys, draw_core() only walks them.
+// they are changed when an entity is loaded, unloaded, rebuilt or shown/hidden, by modifyScene().
+void customGLWidget::renderListUpdate(gl_scene_t &s, gl_entity_ctx *ctx)
+{
+    gl_render_list_t *lists[3]={&s.opaquePickable, &s.opaqueOther, &s.alphaBlend};
+    for(auto l:lists)
+    {
+        for(int i=0;i<l->size();i++)
+        {
+            if(l->at(i).ctx==ctx)
+            {
+                l->remove(i);
+                break;
+            }
+        }
+    }
+
+    if(!s.entities.contains(ctx->uniqueId()) || ctx->isReference() || ctx->show()!=Qt::Checked) return;
+
+    gl_render_list_t &l= ctx->isAlphaBlend() ? s.alphaBlend : (ctx->isPickable() ? s.opaquePickable : s.opaqueOther);
+    gl_render_item_t x;
+    x.key=ctx->renderKey();
+    x.ctx=ctx;
+    auto pos=std::upper_bound(l.begin(), l.end(), x, [](const gl_render_item_t &a, const gl_render_item_t &b){ return a.key<b.key; });
+    l.insert(pos, x);
+}
+
+// true when renderListUpdate() would leave the lists as they are
+bool customGLWidget::renderListed(const gl_scene_t &s, gl_entity_ctx *ctx)
+{
+    const gl_render_list_t *lists[3]={&s.opaquePickable, &s.opaqueOther, &s.alphaBlend};
+    for(auto l:lists)
+    {
+        for(const auto &x:*l)
+        {
+            if(x.ctx==ctx) return x.key==ctx->renderKey();
+        }
+    }
+    return !s.entities.contains(ctx->uniqueId()) || ctx->isReference() || ctx->show()!=Qt::Checked;
+}
+
 void customGLWidget::entityClicked(gl_entity_ctx *a)
 {
     if(a->setMasterOriginFromLocal(a->getCenter()))
@@ -932,10 +1206,7 @@ void customGLWidget::entityClicked(gl_entity_ctx *a)
 
 size_t customGLWidget::getEntitiesCount(void)
 {
-    lockEntities();
-    size_t count=_entities.size();
-    unlockEntities();
-    return count;
+    return scene()->entities.size();
 }
 
 
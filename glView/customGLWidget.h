@@ -17,12 +17,16 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include <QMutex>
 #include <QTimer>
 
+#include <memory>
+#include <functional>
+
 #ifdef USE_EDL
 #include <QOpenGLExtensions>
 #endif
 #include <QOpenGLFunctions_2_1>
 
 #include "gl_entity_ctx.h"
+#include "gl_budget.h"
 #include "qt_opengl_unproj.h"
 
 typedef struct
@@ -33,6 +37,9 @@ typedef struct
     double orthNear;
     double orthFar;
     int pointAntiAlias;
+    int batchSmallClouds;
+    int gpuBudget;          //[MB], 0: unlimited
+    int cpuBudget;          //[MB], 0: unlimited
 } viewOptions;
 
 #ifdef USE_EDL
@@ -40,6 +47,27 @@ class ccFrameBufferObject;
 class ccGlFilter;
 #endif
 
+class gl_pcloud_batch;
+
+typedef struct
+{
+    quint64 key;            //gl_entity_ctx::renderKey() when it's listed
+    gl_entity_ctx *ctx;
+} gl_render_item_t;
+
+typedef QVector<gl_render_item_t> gl_render_list_t;
+
+typedef struct
+{
+    gl_entities_t entities;
+    gl_render_list_t opaquePickable;    //shown entities sorted by key, drawn by draw_core()
+    gl_render_list_t opaqueOther;
+    gl_render_list_t alphaBlend;
+} gl_scene_t;
+
+// immutable once published, readers keep the snapshot they got while they use it
+typedef std::shared_ptr<const gl_scene_t> gl_scene_ptr;
+
 class customGLWidget : public QOpenGLWidget, protected QOpenGLFunctions
 {
     Q_OBJECT
@@ -51,12 +79,7 @@ public:
 
     QVector3D *get_origin(){return &_origin;}
 
-    void lockEntities(void);
-    void unlockEntities(void);
-    gl_entities_t &getEntities(void)
-    {
-        return _entities;
-    }
+    gl_scene_ptr scene(void) const {return std::atomic_load(&_scene);}   //no lock, any thread
 
     void rebuildRequest(QUuid id);
 
@@ -70,12 +93,13 @@ signals:
     void entityLoadedByWidget(QObject *x);
     void onDrawingOptionUpdated(void);
     void keyPressFromGLWidget(int key);
+    void pointPicked(QVariantMap point);
 
 
 public slots:
     void entityLoaded(QObject *x);
     void entityUnload(QObject *x);
-    void redrawEntity(void);
+    void redrawEntity(gl_entity_ctx *ctx=nullptr);    //ctx: show state is changed
     void entityClicked(gl_entity_ctx *a);
     void viewOptionsTriggered(void);
 
@@ -109,6 +133,7 @@ protected:
     void update_by_poi(void);
 
     int unproj(int winX, int winY, QVector3D &ret);
+    int pick(int winX, int winY, QVariantMap &result);
 
     void draftUpdate(void);
     void poiIndicatorUpdate(void);
@@ -124,6 +149,13 @@ private:
     size_t getEntitiesCount(void);
     void draw_core(int mode);
     void updateDepth(void);
+    void filterUpdate(const gl_scene_t &s);
+    void prepareLater(gl_entity_ctx *ctx);
+    void modifyScene(const std::function<void(gl_scene_t &)> &f);
+    static void renderListUpdate(gl_scene_t &s, gl_entity_ctx *ctx);
+    static bool renderListed(const gl_scene_t &s, gl_entity_ctx *ctx);
+    bool isAnimating(void);
+    int progressivePasses(void);
 
 #ifdef USE_EDL
     bool initFBOSafe(ccFrameBufferObject* &fbo, int w, int h);
@@ -145,6 +177,8 @@ private:
     QVector3D _origin;
 
     int _next_mode;
+    int _pass;          //next pass of progressive refinement, 0 starts a new image
+    int _passes;
     gl_draw_ctx_t _draw;
 
     double _pot[2];
@@ -153,8 +187,8 @@ private:
     QVector3D _poi;  //poi location
     QVector3D _poc;  //camera location
 
-    gl_entities_t _entities;
-    gl_entities_t _entitiesNotCompleted;
+    gl_scene_ptr _scene;                //replaced as a whole by modifyScene()
+    gl_entities_t _entitiesNotCompleted;    //GUI thread only
 
 #ifdef USE_EDL
     ccFrameBufferObject* m_activeFbo;
@@ -166,19 +200,23 @@ private:
 
     gl_entity_ctx *_poiIndicator;
 
+    gl_pcloud_batch *_batch;    //draws small point clouds together
+
+    gl_budget _budget;          //evicts entities not shown recently
+
     QTimer _timer4update;
     QTimer _timer4pertialPrepare;
 
     QPoint _mouseMoveLastPos;
     QPoint _RightPressedPos;
 
-    QMutex _mtxEntities;
+    QMutex _mtxScene;           //serializes writers of _scene, readers never take it
 
-    int _depthSearchRadius;
-    QList<QPoint> _depthSearchArea;
+    int _depthSearchRadius;     //[pixel]
 
     int _altDepthRequired;
     depthContext *_depthContext;
+    depthReadback *_depthReadback;
 
     int _cameraMode;
     int _cameraControl;
@@ -186,6 +224,8 @@ private:
     QVariantMap _viewOptionsStorage;
     viewOptions _viewOptions;
 
+    float _filterApplied[6];    //amp, range and height filter given to entities
+
 };
 
 #define CAM_PERSPECTIVE 0
@@ -194,4 +234,10 @@ private:
 #define CAM_CTRL_LEGACY 0         // trackball
 #define CAM_CTRL_POTTERSWHEEL 1   // potter's wheel
 
+#define PARTIAL_PREPARE_INTERVAL_MS (1000/60)
+#define ANIMATION_INTERVAL_MS (1000/30)
+
+#define PROGRESSIVE_PASS_POINTS (4000000)   //points of large clouds drawn by one pass
+#define PROGRESSIVE_MAX_PASSES (16)
+
 #endif // CUSTOMGLWIDGET_H
@@ -0,0 +1,240 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "depth_pyramid.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <queue>
+#include <functional>
+
+#define PYRAMID_EMPTY (1.0f)                //depth of cleared pixel
+#define PYRAMID_THREAD_PIXELS (1<<18)       //smaller level is reduced by single thread
+
+// split rows [0,h) among the thread pool
+static void for_rows(int h, int pixels, const std::function<void(int,int)> &func)
+{
+    if(pixels<PYRAMID_THREAD_PIXELS || h<2)
+    {
+        func(0,h);
+        return;
+    }
+
+    quint64 rows=parallel::chunk_size((quint64)h, (quint64)std::max(1,PYRAMID_THREAD_PIXELS/std::max(1,pixels/h)), 1);
+    parallel::for_chunks((quint64)h, rows, [&func](quint64 y0, quint64 y1){ func((int)y0,(int)y1); });
+}
+
+depth_pyramid::depth_pyramid()
+{
+    _w=0;
+    _h=0;
+    _base=0;
+}
+
+void depth_pyramid::clear(void)
+{
+    _w=0;
+    _h=0;
+    _base=0;
+    _level.clear();
+}
+
+void depth_pyramid::level_size(int w, int h, int level, int &lw, int &lh)
+{
+    lw=w;
+    lh=h;
+    for(int k=0;k<level;k++)
+    {
+        lw=(lw+1)/2;
+        lh=(lh+1)/2;
+    }
+}
+
+size_t depth_pyramid::floats(int w, int h, int base)
+{
+    size_t ret=0;
+    int lw,lh;
+    level_size(w,h,base,lw,lh);
+    while(true)
+    {
+        ret+=(size_t)lw*lh;
+        if(lw<=1 && lh<=1) break;
+        lw=(lw+1)/2;
+        lh=(lh+1)/2;
+    }
+    return ret;
+}
+
+void depth_pyramid::assign(int w, int h, int base, const float *levels)
+{
+    clear();
+    if(levels==nullptr || w<=0 || h<=0 || base<0) return;
+
+    _w=w;
+    _h=h;
+    _base=base;
+    int lw,lh;
+    level_size(w,h,base,lw,lh);
+    while(true)
+    {
+        level_t l;
+        l.w=lw;
+        l.h=lh;
+        l.z.assign(levels, levels+(size_t)lw*lh);
+        levels+=(size_t)lw*lh;
+        _level.push_back(std::move(l));
+        if(lw<=1 && lh<=1) break;
+        lw=(lw+1)/2;
+        lh=(lh+1)/2;
+    }
+}
+
+void depth_pyramid::build(const float *depth, int w, int h)
+{
+    if(depth==nullptr || w<=0 || h<=0)
+    {
+        clear();
+        return;
+    }
+
+    _w=w;
+    _h=h;
+    _base=0;
+    _level.resize(1);
+    level_t &l0=_level[0];
+    l0.w=w;
+    l0.h=h;
+    l0.z.resize((size_t)w*h);
+    for_rows(h, w*h, [&l0,depth,w](int y0, int y1)
+    {
+        for(size_t i=(size_t)y0*w;i<(size_t)y1*w;i++)
+        {
+            float z=depth[i];
+            l0.z[i]= (z>0.0f && z<PYRAMID_EMPTY) ? z : PYRAMID_EMPTY;
+        }
+    });
+
+    while(_level.back().w>1 || _level.back().h>1)
+    {
+        reduce((int)_level.size());
+    }
+}
+
+void depth_pyramid::reduce(int level)
+{
+    _level.resize(level+1);
+    const level_t &s=_level[level-1];
+    level_t &d=_level[level];
+    d.w=(s.w+1)/2;
+    d.h=(s.h+1)/2;
+    d.z.resize((size_t)d.w*d.h);
+
+    for_rows(d.h, d.w*d.h, [&s,&d](int y0, int y1)
+    {
+        for(int y=y0;y<y1;y++)
+        {
+            int sy0=2*y, sy1=std::min(2*y+1,s.h-1);
+            for(int x=0;x<d.w;x++)
+            {
+                int sx0=2*x, sx1=std::min(2*x+1,s.w-1);
+                float z=std::min(std::min(s.z[sx0+sy0*s.w],s.z[sx1+sy0*s.w]),
+                                 std::min(s.z[sx0+sy1*s.w],s.z[sx1+sy1*s.w]));
+                d.z[x+y*d.w]=z;
+            }
+        }
+    });
+}
+
+int depth_pyramid::nearest(int x, int y, int r, int &px, int &py, float &z, const fetch_t &fetch) const
+{
+    if(empty() || (_base>0 && !fetch)) return 0;
+
+    typedef struct
+    {
+        long long d2;
+        int level;
+        int ix, iy;
+        float z;
+    } node_t;
+
+    const int w=_w;
+    const int h=_h;
+    const long long r2=(long long)r*r;
+
+    // squared distance from (x,y) to the pixels covered by the node
+    auto dist2=[x,y,w,h](int level, int ix, int iy)
+    {
+        int x0=ix<<level, x1=std::min(((ix+1)<<level)-1,w-1);
+        int y0=iy<<level, y1=std::min(((iy+1)<<level)-1,h-1);
+        long long dx= x<x0 ? x0-x : (x>x1 ? x-x1 : 0);
+        long long dy= y<y0 ? y0-y : (y>y1 ? y-y1 : 0);
+        return dx*dx+dy*dy;
+    };
+    auto later=[](const node_t &a, const node_t &b){ return a.d2>b.d2; };
+    std::priority_queue<node_t, std::vector<node_t>, decltype(later)> queue(later);
+
+    int top=(int)_level.size()-1;
+    if(_level[top].z[0]>=PYRAMID_EMPTY) return 0;
+    queue.push({dist2(_base+top,0,0),_base+top,0,0,_level[top].z[0]});
+
+    std::vector<float> block;
+    while(!queue.empty())
+    {
+        node_t n=queue.top();
+        queue.pop();
+
+        if(n.level==0)
+        {   //nodes are popped in order of distance, first pixel is the nearest one
+            px=n.ix;
+            py=n.iy;
+            z=n.z;
+            return 1;
+        }
+
+        if(n.level==_base)
+        {   //pixels under the base node come from the depth buffer
+            int bx=n.ix<<_base, by=n.iy<<_base;
+            int bw=std::min(1<<_base,w-bx), bh=std::min(1<<_base,h-by);
+            block.resize((size_t)bw*bh);
+            if(!fetch(bx,by,bw,bh,block.data())) continue;
+            for(int j=0;j<bh;j++)
+            {
+                for(int i=0;i<bw;i++)
+                {
+                    float s=block[i+j*bw];
+                    if(!(s>0.0f && s<PYRAMID_EMPTY)) continue;
+                    long long d2=dist2(0,bx+i,by+j);
+                    if(d2>r2) continue;
+                    queue.push({d2,0,bx+i,by+j,s});
+                }
+            }
+            continue;
+        }
+
+        const level_t &c=_level[n.level-1-_base];
+        for(int j=0;j<2;j++)
+        {
+            int cy=2*n.iy+j;
+            if(cy>=c.h) break;
+            for(int i=0;i<2;i++)
+            {
+                int cx=2*n.ix+i;
+                if(cx>=c.w) break;
+                float s=c.z[cx+cy*c.w];
+                if(s>=PYRAMID_EMPTY) continue;
+                long long d2=dist2(n.level-1,cx,cy);
+                if(d2>r2) continue;
+                queue.push({d2,n.level-1,cx,cy,s});
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef DEPTH_PYRAMID_H
+#define DEPTH_PYRAMID_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cstddef>
+#include <vector>
+#include <functional>
+
+// min-depth mip pyramid of a depth buffer
+// a node holds the nearest depth of its 2x2 children, 1.0 (cleared) when no sample is inside.
+// the nearest valid sample to a pixel is found by descending the nodes in order of distance.
+// levels finer than 'base' may be left out, the pixels of a base node are fetched when it's reached.
+class depth_pyramid
+{
+public:
+    typedef std::function<bool(int x, int y, int w, int h, float *z)> fetch_t;    //w x h pixels at (x,y) of the depth buffer
+
+    depth_pyramid();
+
+    void clear(void);
+    void build(const float *depth, int w, int h);   //samples <=0 or >=1 are not valid
+    void assign(int w, int h, int base, const float *levels);   //levels from base to 1x1 reduced elsewhere, see floats()
+
+    static void level_size(int w, int h, int level, int &lw, int &lh);
+    static size_t floats(int w, int h, int base);   //size of levels from base to 1x1
+
+    bool empty(void) const {return _level.empty();}
+    int width(void) const {return _w;}
+    int height(void) const {return _h;}
+    int base(void) const {return _base;}
+
+    // nearest valid sample to (x,y) within radius r [pixel], fetch is required when base()>0
+    int nearest(int x, int y, int r, int &px, int &py, float &z, const fetch_t &fetch=nullptr) const;
+
+private:
+    typedef struct
+    {
+        int w,h;
+        std::vector<float> z;
+    } level_t;
+
+    void reduce(int level);
+
+private:
+    int _w,_h;                      //size of the depth buffer
+    int _base;                      //level of _level[0]
+    std::vector<level_t> _level;
+};
+
+#endif // DEPTH_PYRAMID_H
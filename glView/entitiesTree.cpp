@@ -136,7 +136,7 @@ void entitiesTree::link(customGLWidget *glWidget)
         {
             gl_entity_ctx *gle= qobject_cast<gl_entity_ctx*>( item->data(0,ROLE_CTX).value<QObject*>() );
             gle->setShow(item->checkState(0));
-            _glWidget->redrawEntity();
+            _glWidget->redrawEntity(gle);
         }
     });
 }
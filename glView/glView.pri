@@ -3,39 +3,66 @@
 # The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
 # THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
-QT += opengl
+QT += opengl concurrent
+
+# honour #pragma omp simd without the OpenMP runtime, sqrt without errno so it stays branch free
+gcc|clang: QMAKE_CXXFLAGS += -fopenmp-simd -fno-math-errno
 
 HEADERS += \
     $$PWD/customGLWidget.h \
+    $$PWD/depth_pyramid.h \
     $$PWD/entitiesTree.h \
     $$PWD/gl_3axis_entity.h \
+    $$PWD/gl_budget.h \
     $$PWD/gl_draw_params.h \
     $$PWD/gl_entity_ctx.h \
+    $$PWD/gl_instancing.h \
     $$PWD/gl_model_entity.h \
+    $$PWD/gl_pcloud_batch.h \
     $$PWD/gl_pcloud_entity.h \
     $$PWD/gl_polyline_entity.h \
     $$PWD/gl_poses_entity.h \
+    $$PWD/gl_programs.h \
     $$PWD/gl_stock_entity.h \
+    $$PWD/gl_textures.h \
+    $$PWD/kdtree.h \
+    $$PWD/mesh_simplify.h \
     $$PWD/model.h \
+    $$PWD/model_w2m.h \
+    $$PWD/parallel.h \
+    $$PWD/pc_stats.h \
     $$PWD/qt_opengl_unproj.h \
     $$PWD/rot.h \
+    $$PWD/text_scanner.h \
+    $$PWD/vertex_cache.h \
     $$PWD/viewOptionsDialog.h
 
 SOURCES += \
     $$PWD/customGLWidget.cpp \
+    $$PWD/depth_pyramid.cpp \
     $$PWD/entitiesTree.cpp \
     $$PWD/gl_3axis_entity.cpp \
+    $$PWD/gl_budget.cpp \
     $$PWD/gl_entity_ctx.cpp \
     $$PWD/gl_model_entity.cpp \
+    $$PWD/gl_pcloud_batch.cpp \
     $$PWD/gl_pcloud_entity.cpp \
     $$PWD/gl_polyline_entity.cpp \
     $$PWD/gl_poses_entity.cpp \
+    $$PWD/gl_programs.cpp \
     $$PWD/gl_stock_entity.cpp \
+    $$PWD/gl_textures.cpp \
+    $$PWD/kdtree.cpp \
+    $$PWD/mesh_simplify.cpp \
     $$PWD/model.cpp \
+    $$PWD/model_w2m.cpp \
     $$PWD/mqo.cpp \
     $$PWD/obj.cpp \
+    $$PWD/pc_stats.cpp \
     $$PWD/qt_opengl_unproj.cpp \
     $$PWD/rot.cpp \
+    $$PWD/text_scanner.cpp \
+    $$PWD/vertex_cache.cpp \
     $$PWD/viewOptionsDialog.cpp
 
 LIBS += -lstdc++fs
@@ -0,0 +1,78 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "gl_budget.h"
+
+#include <algorithm>
+
+gl_budget::gl_budget()
+{
+    _frame=1;
+    _gpuBudget=0;
+    _cpuBudget=0;
+    _gpuUsed=0;
+    _cpuUsed=0;
+}
+
+void gl_budget::setBudget(quint64 gpuBytes, quint64 cpuBytes)
+{
+    _gpuBudget=gpuBytes;
+    _cpuBudget=cpuBytes;
+}
+
+int gl_budget::enforce(const gl_entities_t &entities)
+{
+    quint64 gpu=0, cpu=0;
+    _candidates.clear();    //capacity is kept, no allocation for each frame
+    foreach(auto ctx, entities)
+    {
+        bool busy=ctx->evicting();     //previous eviction is still written out, its bytes are held until then
+        gpu+=ctx->gpuBytes();
+        cpu+=ctx->cpuBytes();
+        if(!busy && ctx->isEvictable() && ctx->lastVisible()<_frame)
+        {
+            _candidates.append(ctx);
+        }
+    }
+    _gpuUsed=gpu;
+    _cpuUsed=cpu;
+
+    bool gpuOver= _gpuBudget && gpu>_gpuBudget;
+    bool cpuOver= _cpuBudget && cpu>_cpuBudget;
+    if(!gpuOver && !cpuOver) return 0;
+
+    std::sort(_candidates.begin(), _candidates.end(), [](gl_entity_ctx *a, gl_entity_ctx *b){ return a->lastVisible()<b->lastVisible(); });
+
+    int n=0;
+    foreach(auto ctx, _candidates)
+    {
+        if(!gpuOver && !cpuOver) break;
+
+        quint64 g=ctx->gpuBytes();
+        quint64 c=ctx->cpuBytes();
+        int what= cpuOver ? ENTITY_EVICT_CPU|ENTITY_EVICT_GPU : ENTITY_EVICT_GPU;
+        if(!g && !(what & ENTITY_EVICT_CPU)) continue;
+
+        int r=ctx->evict(what);
+        if(!r) continue;
+        n++;
+
+        if(r & ENTITY_EVICT_GPU) gpu-=qMin(gpu,g);
+        if(r & ENTITY_EVICT_CPU) cpu-=qMin(cpu,c);
+
+        gpuOver= _gpuBudget && gpu>_gpuBudget;
+        cpuOver= _cpuBudget && cpu>_cpuBudget;
+    }
+
+    _gpuUsed=gpu;
+    _cpuUsed=cpu;
+    return n;
+}
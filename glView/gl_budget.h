@@ -0,0 +1,44 @@
+#ifndef GL_BUDGET_H
+#define GL_BUDGET_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "gl_entity_ctx.h"
+
+// memory used by entities is compared with the budget after every frame.
+// least recently visible entities are evicted until it fits,
+// entities shown in the current frame are never evicted,
+// nor those whose previous eviction is still running on a worker thread.
+class gl_budget
+{
+public:
+    gl_budget();
+
+    void setBudget(quint64 gpuBytes, quint64 cpuBytes);  //0: unlimited
+
+    void nextFrame(void) {_frame++;}
+    void touch(gl_entity_ctx *ctx) {ctx->setLastVisible(_frame);}
+
+    int enforce(const gl_entities_t &entities);         //context required, return number of evicted entities
+
+    quint64 gpuUsed(void) {return _gpuUsed;}
+    quint64 cpuUsed(void) {return _cpuUsed;}
+
+private:
+    quint64 _frame;
+    quint64 _gpuBudget;
+    quint64 _cpuBudget;
+    quint64 _gpuUsed;
+    quint64 _cpuUsed;
+    QVector<gl_entity_ctx*> _candidates;    //evictable entities, reused by every enforce()
+};
+
+#endif // GL_BUDGET_H
@@ -0,0 +1,32 @@
+#version 120
+
+// Copyright 2021 Wagon Wheel Robotics
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+// min-depth reduction, a pixel is the nearest valid sample of block x block source texels.
+// cleared (1.0) and empty (0.0) samples are not valid, 1.0 is written when no sample is.
+#define MAX_BLOCK 8
+
+uniform sampler2D src;
+uniform highp vec2 srcSize;
+uniform int block;
+
+void main(void)
+{
+    highp vec2 top = floor(gl_FragCoord.xy) * float(block);
+    highp float z = 1.0;
+    for(int j = 0; j < MAX_BLOCK; j++)
+    {
+        for(int i = 0; i < MAX_BLOCK; i++)
+        {
+            if(i >= block || j >= block) continue;
+            highp vec2 p = min(top + vec2(float(i), float(j)), srcSize - 1.0);
+            highp float s = texture2D(src, (p + 0.5) / srcSize).r;
+            if(s > 0.0 && s < 1.0) z = min(z, s);
+        }
+    }
+    gl_FragColor = vec4(z);
+}
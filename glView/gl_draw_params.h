@@ -28,6 +28,11 @@ typedef struct
     bool ignoreDraft;
 } opt_pointcloud_t;
 
+#define OPT_PC_FLAG_AUTO_RANGE 1       // colour ranges follow percentiles of loaded clouds
+#define OPT_PC_FLAG_RANGED_HGT 2       // height range is given by a cloud, following clouds widen it
+#define OPT_PC_FLAG_RANGED_AMP 4
+#define OPT_PC_FLAG_RANGED_RNG 8
+
 #define OPT_PC_CM_HEIGHT 0
 #define OPT_PC_CM_RANGE 1
 #define OPT_PC_CM_AMP 2
@@ -53,8 +58,19 @@ typedef struct
     bool draftOnly;
     opt_pointcloud_t opt_pc;
     float modelScale;
+    quint64 frame;      // serial number of the pass, uniforms shared by entities are set once for each pass
+    int pass;           // progressive refinement, large clouds draw every passes-th chunk starting at pass
+    int passes;
 } gl_draw_ctx_t;
 
+typedef struct
+{
+    QVector3D org;      // ray origin
+    QVector3D dir;      // normalized ray direction
+    float tol0;         // pick tolerance at the origin [m]
+    float tolSlope;     // tolerance increase along the ray [m/m]
+} gl_pick_ray_t;
+
 #define GL_DRAW_NORMAL  1
 #define GL_DRAW_PICK  2
 #define GL_DRAW_TEMP  3
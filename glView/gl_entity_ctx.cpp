@@ -19,6 +19,7 @@ gl_entity_ctx::gl_entity_ctx(QObject *parent) : QObject(parent)
     _show=1;
     _showGroup=1;
     _reference=false;
+    _lastVisible=0;
     local.setToIdentity();
 
     _unique_id=QUuid::createUuid();
@@ -14,6 +14,7 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include <QObject>
 #include <QOpenGLFunctions>
 #include <QOpenGLBuffer>
+#include <QOpenGLVertexArrayObject>
 #include <QUuid>
 
 #include "gl_draw_params.h"
@@ -45,9 +46,10 @@ public:
     QMatrix4x4 local;
 
     virtual int rebuildRequest(void){return 0;}   //rebuild VBO
+    virtual int filterRequest(gl_draw_ctx_t &draw){ Q_UNUSED(draw); return 0;}  //return 1 when pertialPrepare_gl() has to finish the filter
 
     virtual int prepare_gl(void);
-    virtual int pertialPrepare_gl(void){return 0;}
+    virtual int pertialPrepare_gl(void){return 0;}  //0 when done, ENTITY_PREPARE_REDRAW can be or'ed
 
     virtual void draw_gl(gl_draw_ctx_t &draw)=0;
     virtual int update_draw_gl(gl_draw_ctx_t &draw){ Q_UNUSED(draw); return 0;}  //return 1 when you change parameter.
@@ -64,6 +66,7 @@ public:
 
     virtual bool isAlphaBlend(void) { return false; }
     virtual bool isPickable(void) { return true; }
+    virtual int pick(const gl_pick_ray_t &ray, QVariantMap &result){ Q_UNUSED(ray); Q_UNUSED(result); return 0;}  //CPU picking, return 1 when hit
 
     int setMasterOriginFromLocal(const QVector3D &localPos);
 
@@ -80,6 +83,22 @@ public:
 
     void setReference(bool newReference);
 
+    virtual bool isAnimated(void) {return false;}      //true to be repainted continuously
+    virtual quint64 progressivePoints(void) {return 0;} //points split over progressive passes, see gl_draw_ctx_t::passes
+    virtual quint64 renderKey(void) {return 0;}         //draw order, entities with the same program and vertex format are drawn together
+
+    //memory budget, see gl_budget
+    virtual quint64 gpuBytes(void) {return 0;}
+    virtual quint64 cpuBytes(void) {return 0;}
+    virtual bool isEvictable(void) {return false;}
+    virtual int evict(int what) {Q_UNUSED(what); return 0;}    //ENTITY_EVICT_xxx, context required. return evicted resources
+    virtual int evicted(void) {return 0;}
+    virtual bool evicting(void) {return false;}                 //true while eviction runs on a worker thread
+    virtual int restore(void) {return 0;}                      //context required. return 1 when pertialPrepare_gl() has to finish it
+
+    quint64 lastVisible(void) {return _lastVisible;}
+    void setLastVisible(quint64 frame) {_lastVisible=frame;}
+
 protected:
     int valid;                          // result of load()
     virtual void term_thread(void);
@@ -100,6 +119,7 @@ private:
     int _show;
     int _showGroup;
     bool _reference;
+    quint64 _lastVisible;   //frame number
     QVector3D _bounding[3];  //0: top-left-high, 1:bottom-right-low
 
 };
@@ -110,6 +130,13 @@ typedef QMap<QUuid,gl_entity_ctx*> gl_entities_t;
 #define EXPORT_TYPE_POLYGON "polygon"
 #define EXPORT_TYPE_POLYLINE "polyline"
 
+#define RENDER_KEY(program,format) (((quint64)(program)<<32)|(quint32)(format))
+
+#define ENTITY_EVICT_GPU 1  //drop VBO and textures
+#define ENTITY_EVICT_CPU 2  //drop CPU copy as well, keep it on disk
+
+#define ENTITY_PREPARE_REDRAW 2     //pertialPrepare_gl() uploaded something drawable, it may be pending still
+
 #define ENTITY_INFO_TARGET_FILENAME "targetFileName"
 #define ENTITY_INFO_TARGET_BYTES "targetByteArray"
 
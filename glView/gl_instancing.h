@@ -0,0 +1,79 @@
+#ifndef GL_INSTANCING_H
+#define GL_INSTANCING_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+
+// hardware instancing on OpenGL 2.1 by ARB_instanced_arrays and ARB_draw_instanced
+// entry points are resolved for the current context, initialize() fails when the driver lacks them.
+class gl_instancing
+{
+public:
+    typedef void (QOPENGLF_APIENTRYP attrib_divisor_t)(GLuint index, GLuint divisor);
+    typedef void (QOPENGLF_APIENTRYP draw_arrays_instanced_t)(GLenum mode, GLint first, GLsizei count, GLsizei primcount);
+    typedef void (QOPENGLF_APIENTRYP draw_elements_instanced_t)(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei primcount);
+
+    gl_instancing() : _divisor(nullptr), _drawArrays(nullptr), _drawElements(nullptr) {}
+
+    bool initialize(void)   //context required
+    {
+        QOpenGLContext *ctx=QOpenGLContext::currentContext();
+        if(ctx==nullptr) return false;
+        if(ctx->hasExtension("GL_ARB_instanced_arrays") && ctx->hasExtension("GL_ARB_draw_instanced"))
+        {
+            _divisor=(attrib_divisor_t)ctx->getProcAddress("glVertexAttribDivisorARB");
+            _drawArrays=(draw_arrays_instanced_t)ctx->getProcAddress("glDrawArraysInstancedARB");
+            _drawElements=(draw_elements_instanced_t)ctx->getProcAddress("glDrawElementsInstancedARB");
+        }
+        return isAvailable();
+    }
+
+    bool isAvailable(void) const {return _divisor!=nullptr && _drawArrays!=nullptr && _drawElements!=nullptr;}
+
+    // mat4 per instance at loc..loc+3, first instance at 'offset' bytes of the bound buffer
+    void bindMatrices(QOpenGLFunctions *f, GLuint loc, quintptr offset) const
+    {
+        for(GLuint k=0;k<4;k++)
+        {
+            f->glEnableVertexAttribArray(loc+k);
+            f->glVertexAttribPointer(loc+k, 4, GL_FLOAT, GL_FALSE, 16*sizeof(GLfloat), reinterpret_cast<void *>(offset+k*4*sizeof(GLfloat)));
+            _divisor(loc+k, 1);
+        }
+    }
+
+    void releaseMatrices(QOpenGLFunctions *f, GLuint loc) const
+    {
+        for(GLuint k=0;k<4;k++)
+        {
+            _divisor(loc+k, 0);
+            f->glDisableVertexAttribArray(loc+k);
+        }
+    }
+
+    void drawArrays(GLenum mode, GLint first, GLsizei count, GLsizei instances) const
+    {
+        _drawArrays(mode, first, count, instances);
+    }
+
+    void drawElements(GLenum mode, GLsizei count, GLenum type, quintptr offset, GLsizei instances) const
+    {
+        _drawElements(mode, count, type, reinterpret_cast<const void *>(offset), instances);
+    }
+
+private:
+    attrib_divisor_t _divisor;
+    draw_arrays_instanced_t _drawArrays;
+    draw_elements_instanced_t _drawElements;
+};
+
+#endif // GL_INSTANCING_H
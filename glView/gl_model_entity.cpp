@@ -10,6 +10,11 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 
 
 #include "gl_model_entity.h"
+#include "gl_programs.h"
+#include "gl_textures.h"
+#include "vertex_cache.h"
+#include "mesh_simplify.h"
+#include "parallel.h"
 
 #if __GNUC__==7
 #include <experimental/filesystem>
@@ -20,31 +25,163 @@ namespace fs = std::filesystem;
 #endif
 
 #include <cmath>
+#include <cstring>
+#include <cfloat>
+#include <algorithm>
 #define d2r (M_PI/180.0)
 
 #include <QOpenGLShaderProgram>
 #include <QStandardPaths>
 #include <QFileInfo>
+#include <QFile>
 #include <QDir>
 #include <QThread>
+#include <QMutex>
+#include <QCryptographicHash>
+
+#define JOINT_DEG_PER_SEC (60.0)    //rotation speed of animated joints
+
+#define MODEL_LOD_RATIO (4)         //triangles of a level to the next level
+#define MODEL_LOD_ERROR (0.005f)    //error of the first simplified level to the object size, xMODEL_LOD_RATIO every level
+#define MODEL_LOD_PIXELS (128.0f)   //radius on the screen [pixel] drawn at full detail, /4 every level, about 1 pixel error
+
+#define MODEL_CACHE_VERSION (4)             //increment when the compiled layout is changed
+#define MODEL_CACHE_READ_BYTES (1<<20)      //block size to hash the source file
+
+static_assert(MODEL_LOD_LEVELS<=W2M_LEVELS, "levels of detail don't fit in the flat mesh");
 
 static QVector4D expand_material(const double x[4]);
-static size_t model_object_compile(object_type &object,material_list &materials,vertex_list &gv, model_elements_t &elements, vbo_source_t &src);
-static void model_load_all_texture(model_type *model, textures_t &textures);
+// vertex normals of the object being compiled, the table is as long as the vertex list and reused by objects
+typedef struct
+{
+    std::vector<vertex_type> normal;
+    std::vector<uint8_t> used;
+    std::vector<int> list;          //vertices of the object
+} model_normals_t;
 
-gl_model_entity::gl_model_entity(QObject *parent) : gl_entity_ctx(parent)
+// an object compiled by itself, indices are local to its vertices
+typedef struct
+{
+    model_elements_t elements;
+    vbo_source_t src;
+    ibo_source_t idx;
+    size_t num_vertex;
+} model_compiled_t;
+
+static size_t model_object_compile(object_type &object,material_list &materials,vertex_list &gv, model_elements_t &elements, vbo_source_t &src, ibo_source_t &idx, model_normals_t &normals);
+static void model_objects_compile(const std::vector<object_type*> &objects, material_list &materials, vertex_list &gv, std::vector<model_compiled_t> &ret);
+
+QMutex gl_model_mesh::_mtx;
+QWaitCondition gl_model_mesh::_loaded;
+QHash<QString, gl_model_mesh*> gl_model_mesh::_meshes;
+
+gl_model_mesh::gl_model_mesh(const QString &fileName, const model_import_params_t &param) : ibo(QOpenGLBuffer::IndexBuffer)
 {
     reset_model(&model);
+    sourceName=fileName;
+    this->param=param;
+    refs=1;
+    state=0;
+    vertex=nullptr;
+    index=nullptr;
+    num_vertex=0;
+    num_index=0;
+    radius=0.0f;
+    uploaded=false;
+}
+
+gl_model_mesh::~gl_model_mesh()
+{
+    for(auto e:model_elements) delete e;
+    for(const auto &k:texKeys) gl_textures::discard(k);
+    for(const auto &t:textures) gl_textures::release(t.second);
+    vbo.destroy();
+    ibo.destroy();
+}
+
+gl_model_mesh *gl_model_mesh::acquire(const QString &fileName, const model_import_params_t &param)
+{
+    QString key=QFileInfo(fileName).absoluteFilePath();
+    for(const auto &x:param)
+    {
+        key+=QString("\n%1=%2").arg(x.first.c_str()).arg(x.second.c_str());
+    }
+
+    QMutexLocker lock(&_mtx);
+    auto i=_meshes.find(key);
+    gl_model_mesh *m;
+    if(i!=_meshes.end())
+    {
+        m=*i;
+        m->refs++;
+        while(m->state==0) _loaded.wait(&_mtx);
+    }
+    else
+    {   //loaded without the lock, the other entities of the same key wait for it
+        m=new gl_model_mesh(fileName,param);
+        _meshes[key]=m;
+        lock.unlock();
+        bool ok=m->load();
+        if(ok) m->decode_textures();
+        lock.relock();
+        m->state= ok ? 1 : -1;
+        _loaded.wakeAll();
+    }
+    if(m->state>0) return m;
+
+    if(--m->refs==0)
+    {
+        _meshes.remove(key);
+        delete m;
+    }
+    return nullptr;
+}
+
+void gl_model_mesh::release(gl_model_mesh *m)
+{
+    if(m==nullptr) return;
+
+    QMutexLocker lock(&_mtx);
+    if(--m->refs>0) return;
+    for(auto i=_meshes.begin();i!=_meshes.end();i++)
+    {
+        if(*i!=m) continue;
+        _meshes.erase(i);
+        break;
+    }
+    delete m;
+}
+
+gl_model_entity::gl_model_entity(QObject *parent) : gl_entity_ctx(parent)
+{
+    mesh=nullptr;
     inc=0;
+    clock.start();
+    prg=nullptr;
+    instancingState=0;
+    instPrg=nullptr;
     setObjectName("Model");
 }
 
 gl_model_entity::~gl_model_entity()
 {
+    cleanup();
+}
 
+// the last entity of the mesh deletes its buffers and textures
+void gl_model_entity::cleanup(void)
+{
+    vao.destroy();
+    gl_programs::release(prg);
+    prg=nullptr;
+    gl_programs::release(instPrg);
+    instPrg=nullptr;
+    instancingState=0;
+    gl_model_mesh::release(mesh);
+    mesh=nullptr;
 }
 
-QString gl_model_entity::getFileName(const QString &fileName)
+QString gl_model_mesh::getFileName(const QString &fileName)
 {
     QString ret=fileName;
     if(fileName.startsWith(":/"))
@@ -68,22 +205,216 @@ QString gl_model_entity::getFileName(const QString &fileName)
     return ret;
 }
 
+// hash the file, names given by 'mtllib' lines are collected at the same time
+static bool hash_source(QCryptographicHash &h, QFile &f, bool obj, QStringList &mtllib)
+{
+    QByteArray carry;   //incomplete last line of the previous block
+    while(!f.atEnd())
+    {
+        QByteArray b=f.read(MODEL_CACHE_READ_BYTES);
+        if(b.isEmpty()) return false;
+        h.addData(b);
+        if(!obj) continue;
+
+        QByteArray t=carry+b;
+        int last=f.atEnd() ? t.size() : t.lastIndexOf('\n');
+        if(last<0)
+        {
+            carry=t;
+            continue;
+        }
+        for(int p=0;(p=t.indexOf("mtllib",p))>=0 && p<last;p+=6)
+        {
+            if(p>0 && t[p-1]!='\n' && t[p-1]!='\r') continue;
+            int e=t.indexOf('\n',p);
+            if(e<0) e=t.size();
+            QList<QByteArray> w=t.mid(p,e-p).simplified().split(' ');
+            if(w.size()>1 && w[0]=="mtllib") mtllib<<QString::fromUtf8(w[1]);   //first name only, as the importer
+        }
+        carry=t.mid(last+1);
+    }
+    return true;
+}
+
+// content hash of the model, its material library and import parameters
+QByteArray gl_model_mesh::cacheKey(const QString &fileName)
+{
+    QFileInfo fi(fileName);
+    if(!fi.exists()) return QByteArray();
+
+    QCryptographicHash h(QCryptographicHash::Sha1);
+    h.addData(QByteArray::number(MODEL_CACHE_VERSION));
+    h.addData(fi.suffix().toLower().toUtf8());
+
+    // material libraries are resolved next to the model as the obj importer does
+    QStringList mtllib;
+    QFile f(fi.absoluteFilePath());
+    if(!f.open(QIODevice::ReadOnly)) return QByteArray();
+    if(!hash_source(h, f, fi.suffix().toLower()=="obj", mtllib)) return QByteArray();
+    mtllib.removeDuplicates();
+    foreach(const auto &x,mtllib)
+    {
+        h.addData(x.toUtf8());
+        h.addData("\0",1);
+        QFile m(fi.absoluteDir().filePath(x));
+        if(m.open(QIODevice::ReadOnly) && !h.addData(&m)) return QByteArray();
+    }
+    for(const auto &x:param)
+    {
+        h.addData(x.first.c_str());
+        h.addData("\0",1);
+        h.addData(x.second.c_str());
+        h.addData("\0",1);
+    }
+    return h.result();
+}
+
+QString gl_model_mesh::cacheFileName(const QByteArray &key)
+{
+    if(key.isEmpty()) return QString();
+    QString folder=QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if(folder.isEmpty()) return QString();
+    folder+="/models";
+    if(!QDir().mkpath(folder)) return QString();
+    return folder+"/"+QString::fromLatin1(key.toHex())+".w2m";
+}
+
+// mapped as it is, vertices and indices are used in place
+bool gl_model_mesh::flat_import(const QString &fname, const QByteArray &key)
+{
+    if(!flat.open(QFile::encodeName(fname).constData())) return false;
+
+    const w2m_header_t &h=flat.header();
+    if(!key.isEmpty() && (key.size()!=(int)sizeof(h.key) || memcmp(h.key,key.constData(),sizeof(h.key))!=0))
+    {
+        flat.close();
+        return false;
+    }
+
+    flat.materials(model.mate);
+    const w2m_group_t *g=flat.group();
+    for(uint32_t i=0;i<h.groups;i++)
+    {
+        cg.push_back(QVector3D(g[i].cg[0],g[i].cg[1],g[i].cg[2]));
+        axis.push_back(QVector3D(g[i].axis[0],g[i].axis[1],g[i].axis[2]));
+    }
+    const w2m_element_t *e=flat.element();
+    for(uint32_t i=0;i<h.elements;i++)
+    {
+        model_element_t *me=new model_element_t;
+        me->shadeModel=e[i].shadeModel;
+        me->idx_material=e[i].idx_material;
+        for(int l=0;l<MODEL_LOD_LEVELS;l++)
+        {
+            int k=qMin(l,(int)h.levels-1);      //the coarsest level of the file is repeated
+            me->idx_top[l]=(size_t)e[i].idx_top[k];
+            me->num_index[l]=(size_t)e[i].num_index[k];
+        }
+        me->group_id=e[i].group_id;
+        me->group_top=e[i].group_top;
+        model_elements.push_back(me);
+    }
+    vertex=flat.vertex();
+    index=flat.index();
+    num_vertex=(size_t)h.vertices;
+    num_index=(size_t)h.indices;
+    radius=h.radius;
+    return true;
+}
+
+// written to a temporary file, then renamed, a concurrent reader never sees a partial file
+bool gl_model_mesh::flat_export(const QString &fname, const QByteArray &key)
+{
+    w2m_header_t h;
+    memset(&h,0,sizeof(h));
+    if(key.size()==(int)sizeof(h.key)) memcpy(h.key,key.constData(),sizeof(h.key));
+    h.levels=MODEL_LOD_LEVELS;
+    h.groups=(uint32_t)qMin(cg.size(),axis.size());
+    h.elements=(uint32_t)model_elements.size();
+    h.radius=radius;
+    h.vertices=num_vertex;
+    h.indices=num_index;
+
+    std::vector<w2m_group_t> g(h.groups);
+    for(uint32_t i=0;i<h.groups;i++)
+    {
+        for(int k=0;k<3;k++)
+        {
+            g[i].cg[k]=cg[i][k];
+            g[i].axis[k]=axis[i][k];
+        }
+    }
+    std::vector<w2m_element_t> e;
+    for(const auto *x:model_elements)
+    {
+        w2m_element_t y;
+        memset(&y,0,sizeof(y));
+        y.shadeModel=x->shadeModel;
+        y.idx_material=x->idx_material;
+        y.group_id=x->group_id;
+        y.group_top=x->group_top;
+        for(int l=0;l<MODEL_LOD_LEVELS;l++)
+        {
+            y.idx_top[l]=x->idx_top[l];
+            y.num_index[l]=x->num_index[l];
+        }
+        e.push_back(y);
+    }
+
+    QString temp=fname+QString(".%1.tmp").arg((quintptr)this);
+    bool ret=export_w2m(QFile::encodeName(temp).constData(),h,vertex,index,g.data(),e.data(),model.mate)!=0;
+    if(ret)
+    {
+        QFile::remove(fname);
+        ret=QFile::rename(temp,fname);
+    }
+    if(!ret) QFile::remove(temp);
+    return ret;
+}
+
+bool gl_model_mesh::convert(const QString &source, const QString &fileName, const model_import_params_t &param)
+{
+    gl_model_mesh m(source,param);
+    if(!m.load()) return false;
+    return m.flat_export(fileName,m.cacheKey(source));
+}
+
 void gl_model_entity::load(void)
 {
     thread()->setPriority(QThread::LowPriority);
 
-    model_elements.clear();
+    //same file is loaded once, this entity is an instance of it
+    mesh=gl_model_mesh::acquire(info[ENTITY_INFO_TARGET_FILENAME].toString(), param);
+    valid= mesh!=nullptr;
+
+    emit done(this);
+}
+
+bool gl_model_mesh::load(void)
+{
+    model.path=sourceName.toStdString();    //textures are found next to the source
 
-    QString fileName = getFileName(info[ENTITY_INFO_TARGET_FILENAME].toString());
+    if(QFileInfo(sourceName).suffix().toLower()=="w2m")
+    {   //flat mesh made by convert()
+        return flat_import(getFileName(sourceName),QByteArray());
+    }
 
+    //compiled model of the same content is used as it is, the source is not parsed
+    QByteArray key=cacheKey(sourceName);
+    QString cacheName=cacheFileName(key);
+    if(!cacheName.isEmpty() && flat_import(cacheName,key))
+    {
+        return true;
+    }
 
-    num_vertex=0;
-    vbo_src.clear();
-    valid= model_import(&model, fileName.toStdString(), &param);
+    QString fileName = getFileName(sourceName);
+
+    int valid= model_import(&model, fileName.toStdString(), &param);
     if(valid)
     {
-        //update obj_id (group id)
-        unsigned int h=0,a;
+        //update obj_id (group id) and sort objects by group
+        std::vector<std::vector<object_type*>> groups(1);
+        unsigned int a;
         for(object_list::iterator i=model.obj.begin();i!=model.obj.end();i++)
         {
             if(!(*i).visible) continue;
@@ -91,53 +422,120 @@ void gl_model_entity::load(void)
             if(sscanf((*i).name.c_str(),"#OBJ%d_",&a)==1)
             {
                 (*i).obj_id=a;
-                if(h<a) h=a;
             }
             else
             {
                 (*i).obj_id=0;
             }
+            if(groups.size()<=(*i).obj_id) groups.resize((*i).obj_id+1);
+            groups[(*i).obj_id].push_back(&(*i));
         }
-        //sort by object group
-        for(unsigned int j=0;j<=h;j++)
+        std::vector<object_type*> objects;
+        for(auto &g:groups)
         {
-            int k=0;
-            for(object_list::iterator i=model.obj.begin();i!=model.obj.end();i++)
+            for(size_t k=0;k<g.size();k++)
             {
-                if(!(*i).visible) continue;
-                if((*i).obj_id!=j) continue;
-                (*i).top_of_group=(k==0);
-                num_vertex += model_object_compile( (*i), model.mate, model.vtx, model_elements, vbo_src);
-                k++;
+                g[k]->top_of_group=(k==0);
+                objects.push_back(g[k]);
             }
+        }
 
+        //objects are compiled in parallel, and appended in the group order
+        std::vector<model_compiled_t> compiled;
+        model_objects_compile(objects, model.mate, model.vtx, compiled);
+        size_t floats=0,indices=0;
+        for(const auto &c:compiled)
+        {
+            floats+=c.src.size();
+            indices+=c.idx.size();
+        }
+        vbo_src.reserve(floats);
+        ibo_src.reserve(indices);
+        for(auto &c:compiled)
+        {
+            GLuint base=(GLuint)(vbo_src.size()/8);
+            for(auto e:c.elements)
             {
-                char prefix[32];
-                sprintf(prefix,"#OBJ%d_",j);
-                model_update_mask_prefix(&model,prefix,(1<<j));
-                double _cg[3];
-                model_object_get_cg(&model,(1<<j),_cg);
-                cg.push_back( QVector3D((GLfloat)_cg[0],(GLfloat)_cg[1],(GLfloat)_cg[2]) );
-                qDebug()<<"CG"<<j<<cg.back();
+                for(int l=0;l<MODEL_LOD_LEVELS;l++) e->idx_top[l]+=ibo_src.size();
+                model_elements.push_back(e);
+            }
+            for(GLuint x:c.idx) ibo_src.push_back(base+x);
+            vbo_src.insert(vbo_src.end(),c.src.begin(),c.src.end());
+            num_vertex+=c.num_vertex;
+        }
+        compiled.clear();
+        vertex=vbo_src.data();
+        index=ibo_src.data();
+        num_index=ibo_src.size();
 
+        //cg and rotation axis of every group
+        for(unsigned int j=0;j<groups.size();j++)
+        {
+            char prefix[32];
+            sprintf(prefix,"#OBJ%d_",j);
+            model_update_mask_prefix(&model,prefix,(1<<j));
+            double _cg[3];
+            model_object_get_cg(&model,(1<<j),_cg);
+            cg.push_back( QVector3D((GLfloat)_cg[0],(GLfloat)_cg[1],(GLfloat)_cg[2]) );
+            qDebug()<<"CG"<<j<<cg.back();
 
-                joint_map::iterator jm=model.joi.find(j);
-                if(jm!=model.joi.end())
-                {
-                    const joint_type &joint=jm->second;
 
-                    axis.push_back(QVector3D(joint.axis[0],joint.axis[1],joint.axis[2]));
-                }
-                else
-                {
-                    axis.push_back(QVector3D(0.0f, 0.0f, 0.0f)); //no rotation
-                }
+            joint_map::iterator jm=model.joi.find(j);
+            if(jm!=model.joi.end())
+            {
+                const joint_type &joint=jm->second;
+
+                axis.push_back(QVector3D(joint.axis[0],joint.axis[1],joint.axis[2]));
+            }
+            else
+            {
+                axis.push_back(QVector3D(0.0f, 0.0f, 0.0f)); //no rotation
             }
         }
 
+        radius=0.0f;
+        for(size_t i=0;i+8<=vbo_src.size();i+=8)
+        {
+            QVector3D v(vbo_src[i+5],vbo_src[i+6],vbo_src[i+7]);
+            radius=qMax(radius,v.length());
+        }
+
+        if(!cacheName.isEmpty() && !flat_export(cacheName,key))
+        {
+            qDebug()<<"model cache write error"<<cacheName;
+        }
     }
+    return valid!=0;
+}
 
-    emit done(this);
+// images of the materials are decoded on the thread pool, the file is tried as it is then next to the model
+void gl_model_mesh::decode_textures(void)
+{
+    fs::path ps(model.path);
+    std::string model_path=ps.remove_filename().string();
+
+    std::vector<QString> files(model.mate.size());
+    for(size_t i=0;i<model.mate.size();i++)
+    {
+        files[i]=QString(model.mate[i].tex.c_str());
+    }
+
+    for(const auto &k:texKeys) gl_textures::discard(k);
+    texKeys.assign(model.mate.size(),QByteArray());
+    parallel::for_chunks(files.size(), 1, [&](quint64 first, quint64 last)
+    {
+        for(quint64 i=first;i<last;i++)
+        {
+            if(files[i].isEmpty()) continue;
+            texKeys[i]=gl_textures::decode(files[i]);
+            if(!texKeys[i].isEmpty()) continue;
+
+            fs::path mp(model_path);
+            QString alt=QString(mp.replace_filename(model.mate[i].tex).string().c_str());
+            texKeys[i]=gl_textures::decode(alt);
+            if(texKeys[i].isEmpty()) qDebug()<< "Image file" << files[i] << "and" << alt << "load error.";
+        }
+    });
 }
 
 const char *gl_model_entity::get_vertex_shader(void) const
@@ -211,21 +609,60 @@ const char *gl_model_entity::get_fragment_shader(void) const
     return fragmentShaderSource;
 }
 
+// same lighting as get_vertex_shader(), model matrix is given by instance attributes
+// normal matrix is the rotation part of the model view matrix, scaling has to be uniform.
+const char *gl_model_entity::get_instanced_vertex_shader(void) const
+{
+    static const char *vertexShaderSource =
+        "attribute vec2 texCoord;\n"
+        "attribute vec3 normal;\n"
+        "attribute vec3 vertex;\n"
+        "attribute vec4 instance0;\n"
+        "attribute vec4 instance1;\n"
+        "attribute vec4 instance2;\n"
+        "attribute vec4 instance3;\n"
+        "varying vec4 vertColor;\n"
+        "varying vec2 vertTexCoord;\n"
+        "uniform mat4 projMatrix;\n"
+        "uniform mat4 viewMatrix;\n"
+        "uniform mat4 groupMatrix;\n"
+        "uniform highp vec3 lightPos;\n"
+        "uniform vec4 matCol;\n"
+        "uniform vec4 matAmb;\n"
+        "uniform vec4 matEmi;\n"
+        "uniform vec4 matDif;\n"
+        "uniform vec4 matSpc;\n"
+        "uniform highp int enaShading;\n"
+        "uniform highp int enaTex;\n"
+
+        "void main() {\n"
+        "   mat4 mvMatrix = viewMatrix * mat4(instance0, instance1, instance2, instance3) * groupMatrix;\n"
+        "   if(enaShading==1){\n"
+        "   vec3 P= vec3(mvMatrix * vec4(vertex, 1.0));\n"
+        "   vec3 L= normalize(vec3(lightPos)-P);\n"
+        "   vec3 N= normalize(mat3(mvMatrix[0].xyz, mvMatrix[1].xyz, mvMatrix[2].xyz)*normal);\n"
+        "   float dotLN=max(dot(L,N),0.0);\n"
+        "   vec4  diffuseP=vec4(dotLN);\n"
+        "   vec4  diffuse=diffuseP*matDif;\n"
+        "   vertColor = matAmb + diffuse;\n"
+        "   }else{\n"
+        "   vertColor = matCol;\n"
+        "   }\n"
+        "   gl_Position = projMatrix * mvMatrix * vec4(vertex, 1.0);\n"
+        "    vertTexCoord = texCoord;\n"
+        "}\n";
+
+    return vertexShaderSource;
+}
+
 int gl_model_entity::prepare_gl(void)
 {
     term_thread();
 
     qDebug() << "prepare_gl";
 
-    prg = new QOpenGLShaderProgram;
-    prg->addShaderFromSourceCode(QOpenGLShader::Vertex,  get_vertex_shader() );
-    prg->addShaderFromSourceCode(QOpenGLShader::Fragment,get_fragment_shader() );
-
-    prg->bindAttributeLocation("texCoord",0);
-    prg->bindAttributeLocation("normal", 1);
-    prg->bindAttributeLocation("vertex", 2);
-
-    prg->link();
+    prg = gl_programs::acquire(get_vertex_shader(), get_fragment_shader(), QStringList()<<"texCoord"<<"normal"<<"vertex");
+    if(prg==nullptr) return 0;
     prg->bind();
 
     projMat =prg->uniformLocation("projMatrix");
@@ -239,19 +676,110 @@ int gl_model_entity::prepare_gl(void)
     matSpc  =prg->uniformLocation("matSpc");
     enaShad =prg->uniformLocation("enaShading");
     enaTex  =prg->uniformLocation("enaTex");
+    modeLoc =prg->uniformLocation("mode");
 
     prg->setUniformValue("texture", 0);
 
-    vbo_allocate();
+    if(mesh!=nullptr)
+    {
+        mesh->upload();
+        vbo_allocate();
+    }
 
     prg->release();
-
-    model_load_all_texture(&model,textures);
     return 0;
 }
 
+void gl_model_mesh::upload(void)
+{
+    if(uploaded) return;
+    uploaded=true;
+
+    vbo.create();
+    if(!vbo.bind())
+    {
+        qDebug() << "VBO BIND ERROR";
+    }
+    else
+    {
+        qDebug()<<"VBO OBJECT ID#"<< vbo.bufferId();
+        vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        vbo.allocate(vertex, (int)(num_vertex*W2M_VERTEX_FLOATS*sizeof(GLfloat)));
+        vbo.release();
+
+        ibo.create();
+        if(ibo.bind())
+        {
+            ibo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+            ibo.allocate(index, (int)(num_index*sizeof(GLuint)));
+            ibo.release();
+        }
+    }
+
+    //buffers have their own copy
+    flat.close();
+    vbo_source_t().swap(vbo_src);
+    ibo_source_t().swap(ibo_src);
+    vertex=nullptr;
+    index=nullptr;
+
+    //same image of the materials is one texture
+    QHash<QByteArray, GLuint> images;
+    for(size_t i=0;i<model.mate.size();i++)
+    {
+        material_type &m=model.mate[i];
+        m.tex_id=0;
+        if(i>=texKeys.size() || texKeys[i].isEmpty()) continue;
+
+        auto u=images.find(texKeys[i]);
+        if(u!=images.end())
+        {
+            gl_textures::discard(texKeys[i]);
+            m.tex_id=*u;
+            continue;
+        }
+        QOpenGLTexture *t=gl_textures::acquire(texKeys[i]);
+        if(t==nullptr) continue;
+        m.tex_id=t->textureId();
+        textures[m.tex_id]=t;
+        images[texKeys[i]]=m.tex_id;
+    }
+    texKeys.clear();
+
+    materials.clear();
+    for(const auto &m:model.mate)
+    {
+        material_uniform_t u;
+        u.col=expand_material(m.col);
+        u.amb=expand_material(m.amb);
+        u.emi=expand_material(m.emi);
+        u.dif=expand_material(m.dif);
+        u.spc=expand_material(m.spc);
+        u.tex_id=m.tex_id;
+        materials.push_back(u);
+    }
+}
+
+quint64 gl_model_mesh::gpuBytes(void) const
+{
+    quint64 ret=0;
+    if(vbo.isCreated()) ret+=(quint64)num_vertex*W2M_VERTEX_FLOATS*sizeof(GLfloat);
+    if(ibo.isCreated()) ret+=(quint64)num_index*sizeof(GLuint);
+    for(const auto &t:textures)
+    {
+        if(t.second!=nullptr && t.second->isCreated()) ret+=(quint64)t.second->width()*t.second->height()*4*4/3;    //with mipmaps
+    }
+    return ret;
+}
+
+quint64 gl_model_mesh::cpuBytes(void) const
+{
+    return (quint64)vbo_src.capacity()*sizeof(GLfloat)+(quint64)ibo_src.capacity()*sizeof(GLuint)+flat.size();
+}
+
 void gl_model_entity::vbo_bind(void)
 {
+    QOpenGLBuffer &vbo=mesh->vbo;
     if(vbo.bind())
     {
         QOpenGLFunctions *fc = QOpenGLContext::currentContext()->functions();
@@ -262,6 +790,7 @@ void gl_model_entity::vbo_bind(void)
         fc->glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), 0);    //texture coord
         fc->glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), reinterpret_cast<void *>(2 * sizeof(GLfloat)));    //normal
         fc->glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(GLfloat), reinterpret_cast<void *>(5 * sizeof(GLfloat)));    //vertex
+        mesh->ibo.bind();
     }
     else
     {
@@ -269,38 +798,217 @@ void gl_model_entity::vbo_bind(void)
     }
 }
 
+// buffers are in the shared mesh, VAO of this entity records them
 void gl_model_entity::vbo_allocate(void)
 {
-    vbo.create();
-    if(!vbo.bind())
+    if(!mesh->vbo.isCreated()) return;
+
+    if(vao.create())
+    {   //attribute setup and index buffer are recorded once
+        vao.bind();
+        vbo_bind();
+        vao.release();
+        mesh->vbo.release();
+        mesh->ibo.release();
+    }
+}
+
+// instanced program is built at the first instanced draw, context required
+bool gl_model_entity::instancing_prepare(void)
+{
+    if(instancingState==0)
     {
-        qDebug() << "VBO BIND ERROR";
+        instancingState=-1;
+        if(prg!=nullptr && instancing.initialize())
+        {
+            //instance matrix at 3 to 6
+            QOpenGLShaderProgram *x=gl_programs::acquire(get_instanced_vertex_shader(), get_fragment_shader(),
+                                                         QStringList()<<"texCoord"<<"normal"<<"vertex"<<"instance0"<<"instance1"<<"instance2"<<"instance3");
+            if(x!=nullptr)
+            {
+                x->bind();
+                instUni.projMat =x->uniformLocation("projMatrix");
+                instUni.viewMat =x->uniformLocation("viewMatrix");
+                instUni.grpMat  =x->uniformLocation("groupMatrix");
+                instUni.litPos  =x->uniformLocation("lightPos");
+                instUni.matCol  =x->uniformLocation("matCol");
+                instUni.matAmb  =x->uniformLocation("matAmb");
+                instUni.matEmi  =x->uniformLocation("matEmi");
+                instUni.matDif  =x->uniformLocation("matDif");
+                instUni.matSpc  =x->uniformLocation("matSpc");
+                instUni.enaShad =x->uniformLocation("enaShading");
+                instUni.enaTex  =x->uniformLocation("enaTex");
+                instUni.mode    =x->uniformLocation("mode");
+                x->setUniformValue("texture", 0);
+                x->release();
+
+                instPrg=x;
+                instancingState=1;
+            }
+        }
+        if(instancingState<0) qDebug()<<"model instancing is not available";
+    }
+    return instancingState>0;
+}
+
+int gl_model_entity::viewMatrix(const gl_draw_ctx_t &draw, const QMatrix4x4 &base, QMatrix4x4 &ret)
+{
+    QMatrix4x4 offset;
+    if(!originOffset(offset)) return 0;
+    ret=draw.camera * draw.world * offset * base;
+    return 1;
+}
+
+int gl_model_entity::lodLevel(float pixels)
+{
+    int level=0;
+    for(float x=MODEL_LOD_PIXELS;level<MODEL_LOD_LEVELS-1 && pixels<x;x/=4.0f)
+    {
+        level++;
+    }
+    return level;
+}
+
+bool gl_model_entity::drawInstanced_gl(gl_draw_ctx_t &draw, const QMatrix4x4 &view, QOpenGLBuffer &instances, const instance_ranges_t &ranges, int level)
+{
+    if(!instancing_prepare()) return false;
+    if(!show() || ranges.empty()) return true;
+
+    int mode=0;
+
+    if(draw.mode==GL_DRAW_PICK)
+    {
+        mode=OPT_PC_CM_DEPTH;
+    }
+
+    inc=clock.elapsed()*JOINT_DEG_PER_SEC/1000.0;
+
+    QOpenGLShaderProgram *p=instPrg;
+    const instanced_uniforms_t &u=instUni;
+    QOpenGLFunctions *fc = QOpenGLContext::currentContext()->functions();
+
+    p->bind();
+    p->setUniformValue(u.projMat, draw.proj);
+    p->setUniformValue(u.viewMat, view);
+    p->setUniformValue(u.litPos,QVector3D(0, 0, 100));
+    p->setUniformValue(u.mode, (int)mode);
+    fc->glEnable(GL_CULL_FACE);
+    fc->glCullFace(GL_BACK);
+
+    if(vao.isCreated()) vao.bind();
+    else                vbo_bind();
+
+    QMatrix4x4 scale;
+    scale.setToIdentity();
+    scale.scale(draw.modelScale);
+
+    instances.bind();
+
+    int applied=-1;
+    int shading=-1;
+    for(model_elements_t::iterator i=mesh->model_elements.begin();i!=mesh->model_elements.end();i++)
+    {
+        if((*i)->group_top)
+        {
+            QMatrix4x4 x;
+            x.setToIdentity();
+            update_group_matrix((*i)->group_id, x);
+            p->setUniformValue(u.grpMat, x * scale);
+        }
+
+        const material_uniform_t& m= mesh->materials[ (*i)->idx_material ];
+        if((*i)->idx_material!=applied)
+        {
+            applied=(*i)->idx_material;
+            p->setUniformValue(u.matCol, m.col);
+            p->setUniformValue(u.matAmb, m.amb);
+            p->setUniformValue(u.matEmi, m.emi);
+            p->setUniformValue(u.matDif, m.dif);
+            p->setUniformValue(u.matSpc, m.spc);
+            p->setUniformValue(u.enaTex,(int)m.tex_id );
+        }
+        int s=((*i)->shadeModel==GL_SMOOTH);
+        if(s!=shading)
+        {
+            shading=s;
+            p->setUniformValue(u.enaShad, s);
+        }
+        if(m.tex_id>0)
+        {
+            mesh->textures[ m.tex_id ]->bind();
+        }
+
+        for(const auto &r:ranges)
+        {   //attribute offset selects the first instance, there is no base instance in OpenGL 2.1
+            instancing.bindMatrices(fc, 3, (quintptr)r.first*16*sizeof(GLfloat));
+            instancing.drawElements(GL_TRIANGLES, (GLsizei)(*i)->num_index[level], GL_UNSIGNED_INT, (quintptr)(*i)->idx_top[level]*sizeof(GLuint), (GLsizei)r.count);
+        }
+    }
+
+    instancing.releaseMatrices(fc, 3);
+    instances.release();
+
+    fc->glDisable(GL_CULL_FACE);
+    if(vao.isCreated())
+    {
+        vao.release();
     }
     else
     {
-        qDebug()<<"VBO OBJECT ID#"<< vbo.bufferId();
-        vbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
-        vbo.allocate(&vbo_src[0], (int)vbo_src.size()*sizeof(GLfloat));
-        vbo.release();
+        mesh->vbo.release();
+        mesh->ibo.release();
+        fc->glDisableVertexAttribArray(0);
+        fc->glDisableVertexAttribArray(1);
+        fc->glDisableVertexAttribArray(2);
     }
+    p->release();
+    return true;
+}
+
+// shared mesh is split among its entities, the sum over entities is the real usage
+quint64 gl_model_entity::gpuBytes(void)
+{
+    if(mesh==nullptr) return 0;
+    return mesh->gpuBytes()/qMax(1,mesh->users());
+}
+
+bool gl_model_entity::isAnimated(void)
+{
+    if(mesh==nullptr) return false;
+    for(const auto &a:mesh->axis)
+    {
+        if(!a.isNull()) return true;
+    }
+    return false;
+}
+
+quint64 gl_model_entity::renderKey(void)
+{
+    return RENDER_KEY(prg!=nullptr ? prg->programId() : 0, 8);    //texture coord, normal and vertex
+}
+
+quint64 gl_model_entity::cpuBytes(void)
+{
+    if(mesh==nullptr) return 0;
+    return mesh->cpuBytes()/qMax(1,mesh->users());
 }
 
 void gl_model_entity::update_group_matrix(int id,QMatrix4x4 &local)
 {
-    if(id<(int)axis.size())
+    if(id<(int)mesh->axis.size())
     {
-        if( axis[id].isNull() ) return;
+        if( mesh->axis[id].isNull() ) return;
     }
     QMatrix4x4 a,b,c;
-    a.setToIdentity();  a.translate(-cg[id]);
-    b.setToIdentity();  b.rotate(fmod(inc,360.0),axis[id]);
-    c.setToIdentity();  c.translate(cg[id]);
+    a.setToIdentity();  a.translate(-mesh->cg[id]);
+    b.setToIdentity();  b.rotate(fmod(inc,360.0),mesh->axis[id]);
+    c.setToIdentity();  c.translate(mesh->cg[id]);
     local=c*b*a;
 }
 
 void gl_model_entity::draw_gl(gl_draw_ctx_t &draw)
 {
-    if(!show()) return;
+    if(!show() || mesh==nullptr) return;
 
     QMatrix4x4 offset;
     if(!originOffset(offset)) return;
@@ -312,7 +1020,15 @@ void gl_model_entity::draw_gl(gl_draw_ctx_t &draw)
         mode=OPT_PC_CM_DEPTH;
     }
 
-    inc+=10.0;
+    inc=clock.elapsed()*JOINT_DEG_PER_SEC/1000.0;     //by time, not by number of frames
+
+    //radius on the screen [pixel] is r*f/w, w is clip w of the model origin
+    int level=0;
+    float w=(draw.proj * draw.camera * draw.world * offset * local)(3,3);
+    if(w>0.0f)
+    {
+        level=lodLevel(mesh->radius*draw.modelScale*draw.proj(1,1)*draw.height*0.5f/w);
+    }
 
     QOpenGLShaderProgram *p=prg;
 
@@ -327,13 +1043,19 @@ void gl_model_entity::draw_gl(gl_draw_ctx_t &draw)
         fc->glEnable(GL_CULL_FACE);
         fc->glCullFace(GL_BACK);
 
-        vbo_bind();
+        if(vao.isCreated()) vao.bind();
+        else                vbo_bind();
+
+        p->setUniformValue(modeLoc, (int)mode);
+
+        QMatrix4x4 scale;
+        scale.setToIdentity();
+        scale.scale(draw.modelScale);
 
-        for(model_elements_t::iterator i=model_elements.begin();i!=model_elements.end();i++)
+        int applied=-1;     //material in the program
+        int shading=-1;
+        for(model_elements_t::iterator i=mesh->model_elements.begin();i!=mesh->model_elements.end();i++)
         {
-            QMatrix4x4 scale;
-            scale.setToIdentity();
-            scale.scale(draw.modelScale);
             if((*i)->group_top)
             {
                 QMatrix4x4 x;
@@ -345,26 +1067,43 @@ void gl_model_entity::draw_gl(gl_draw_ctx_t &draw)
                 p->setUniformValue(norMat, modelview.normalMatrix());
             }
 
-            const material_type& m= model.mate[ (*i)->idx_material ];
-            p->setUniformValue(matCol, expand_material(m.col));
-            p->setUniformValue(matAmb, expand_material(m.amb));
-            p->setUniformValue(matEmi, expand_material(m.emi));
-            p->setUniformValue(matDif, expand_material(m.dif));
-            p->setUniformValue(matSpc, expand_material(m.spc));
-            p->setUniformValue(enaShad,((*i)->shadeModel==GL_SMOOTH) );
-            p->setUniformValue(enaTex,(int)m.tex_id );
-            p->setUniformValue("mode", (int)mode);
-            p->setUniformValue("texture", 0);
+            const material_uniform_t& m= mesh->materials[ (*i)->idx_material ];
+            if((*i)->idx_material!=applied)
+            {   //uniforms are sent only when the material changes
+                applied=(*i)->idx_material;
+                p->setUniformValue(matCol, m.col);
+                p->setUniformValue(matAmb, m.amb);
+                p->setUniformValue(matEmi, m.emi);
+                p->setUniformValue(matDif, m.dif);
+                p->setUniformValue(matSpc, m.spc);
+                p->setUniformValue(enaTex,(int)m.tex_id );
+            }
+            int s=((*i)->shadeModel==GL_SMOOTH);
+            if(s!=shading)
+            {
+                shading=s;
+                p->setUniformValue(enaShad, s);
+            }
             if(m.tex_id>0)
             {
-                textures[ m.tex_id ]->bind();
+                mesh->textures[ m.tex_id ]->bind();
             }
 
-            fc->glDrawArrays(GL_TRIANGLES, (GLint)(*i)->src_top , (GLsizei)(*i)->num_vertex);
-//          fc->glDrawArrays(GL_POINTS, (GLint)(*i)->src_top , (GLsizei)(*i)->num_vertex);
+            fc->glDrawElements(GL_TRIANGLES, (GLsizei)(*i)->num_index[level], GL_UNSIGNED_INT, reinterpret_cast<void *>((*i)->idx_top[level]*sizeof(GLuint)));
         }
         fc->glDisable(GL_CULL_FACE);
-        vbo.release();
+        if(vao.isCreated())
+        {
+            vao.release();
+        }
+        else
+        {
+            mesh->vbo.release();
+            mesh->ibo.release();
+            fc->glDisableVertexAttribArray(0);
+            fc->glDisableVertexAttribArray(1);
+            fc->glDisableVertexAttribArray(2);
+        }
         p->release();
     }
 }
@@ -440,74 +1179,6 @@ const int p_idx1[3]={0,1,2};
 const int p_idx2[3]={0,2,3};
 
 
-static void polygon(face_type &face,vertex_list &v,vertex_type *n,int tex,double cos_sm, vbo_source_t &vbo_src)
-{
-    vertex_type normal,a,b,c,face_n,*vertex_n=NULL;
-    int i,k;
-
-    a=v[ face.v[p_idx1[0]] ];
-    b=v[ face.v[p_idx1[1]] ];
-    c=v[ face.v[p_idx1[2]] ];
-    normal_2(a,b,c,&face_n);
-    for (k=0;k<3;k++)		//0-1-2
-    {
-        i=p_idx1[k];
-        if(tex)
-        {
-         // glTexCoord2d( face.uv[i*2], face.uv[i*2+1]);
-            vbo_src.push_back(face.uv[i*2]);
-            vbo_src.push_back(face.uv[i*2+1]);
-        }
-        else
-        {   //push dummy
-            vbo_src.push_back(0.0f);
-            vbo_src.push_back(0.0f);
-        }
-        if(n!=NULL)	vertex_n=&n[ face.v[i] ];
-        decide_normal(normal,face_n,vertex_n,cos_sm);
-        //glNormal3d(normal.x,normal.y,normal.z);
-        vbo_src.push_back(normal.x);
-        vbo_src.push_back(normal.y);
-        vbo_src.push_back(normal.z);
-        //glVertex3d(v[ face.v[i] ].x,v[ face.v[i] ].y,v[ face.v[i] ].z);
-        vbo_src.push_back(v[ face.v[i] ].x);
-        vbo_src.push_back(v[ face.v[i] ].y);
-        vbo_src.push_back(v[ face.v[i] ].z);
-    }
-    if(face.n==4)
-    {
-        a=v[ face.v[p_idx2[0]] ];
-        b=v[ face.v[p_idx2[1]] ];
-        c=v[ face.v[p_idx2[2]] ];
-        normal_2(a,b,c,&face_n);
-        for (k=0;k<3;k++)	//0-2-3
-        {
-            i=p_idx2[k];
-            if(tex)
-            {
-                //glTexCoord2d( face.uv[i*2], face.uv[i*2+1]);
-                vbo_src.push_back(face.uv[i*2]);
-                vbo_src.push_back(face.uv[i*2+1]);
-            }
-            else
-            {   //push dummy
-                vbo_src.push_back(0.0f);
-                vbo_src.push_back(0.0f);
-            }
-            if(n!=NULL)	vertex_n=&n[ face.v[i] ];
-            decide_normal(normal,face_n,vertex_n,cos_sm);
-            //glNormal3d(normal.x,normal.y,normal.z);
-            vbo_src.push_back(normal.x);
-            vbo_src.push_back(normal.y);
-            vbo_src.push_back(normal.z);
-            //glVertex3d(v[ face.v[i] ].x,v[ face.v[i] ].y,v[ face.v[i] ].z);
-            vbo_src.push_back(v[ face.v[i] ].x);
-            vbo_src.push_back(v[ face.v[i] ].y);
-            vbo_src.push_back(v[ face.v[i] ].z);
-        }
-    }
-}
-
 static void expand_material(double x[4],GLfloat *ret)
 {
     ret[0]=(GLfloat)x[0];
@@ -542,193 +1213,280 @@ static void normalize_vertex(vertex_type &a)
     }
 }
 
-vertex_type *get_normal(object_type &object,vertex_list &v)
+static uint32_t vertex_hash(const GLfloat x[8])
 {
-    vertex_type normal,a,b,c;
-    vertex_type *ret=NULL;
-    size_t i,n;
-
-    n=v.size();
-    ret=new vertex_type [n];
-    memset(ret,0,sizeof(vertex_type)*n);
+    uint32_t u[8];
+    memcpy(u,x,sizeof(u));
+    uint32_t h=2166136261u;
+    for(int k=0;k<8;k++)
+    {
+        h^=u[k];
+        h*=16777619u;
+    }
+    h^=h>>16;   h*=0x85ebca6bu;
+    h^=h>>13;   h*=0xc2b2ae35u;
+    h^=h>>16;
+    return h;
+}
 
-    for(face_list::iterator j=object.f.begin();j!=object.f.end();j++)
+// corners with the same texture coord, normal and position share a vertex, indices are local to the object
+class model_vertex_table
+{
+public:
+    model_vertex_table(vbo_source_t &src, size_t corners) : _src(src), _top(src.size())
     {
-        face_type &face=(*j);
+        size_t n=16;
+        while(n<corners*2) n<<=1;
+        _slot.assign(n,0);
+        _mask=n-1;
+    }
 
-        a=v[ face.v[p_idx1[0]] ];
-        b=v[ face.v[p_idx1[1]] ];
-        c=v[ face.v[p_idx1[2]] ];
-        normal_2(a,b,c,&normal);
+    GLuint add(const GLfloat x[8])
+    {
+        for(size_t i=vertex_hash(x)&_mask;;i=(i+1)&_mask)
+        {
+            uint32_t s=_slot[i];
+            if(s==0)
+            {
+                GLuint n=(GLuint)((_src.size()-_top)/8);
+                _src.insert(_src.end(),x,x+8);
+                _slot[i]=n+1;
+                return n;
+            }
+            if(memcmp(&_src[_top+(size_t)(s-1)*8],x,8*sizeof(GLfloat))==0) return s-1;
+        }
+    }
 
-        vertex_add_to(ret[face.v[p_idx1[0]]],normal);
-        vertex_add_to(ret[face.v[p_idx1[1]]],normal);
-        vertex_add_to(ret[face.v[p_idx1[2]]],normal);
+private:
+    vbo_source_t &_src;
+    size_t _top;
+    std::vector<uint32_t> _slot;    //index+1, 0 is empty
+    size_t _mask;
+};
 
-        if(face.n==4)
+// diagonal of the bounding box
+static float model_vertex_size(const GLfloat *vertex, GLuint nv)
+{
+    float bmin[3]={FLT_MAX,FLT_MAX,FLT_MAX};
+    float bmax[3]={-FLT_MAX,-FLT_MAX,-FLT_MAX};
+    for(GLuint i=0;i<nv;i++)
+    {
+        for(int k=0;k<3;k++)
         {
-            a=v[ face.v[p_idx2[0]] ];
-            b=v[ face.v[p_idx2[1]] ];
-            c=v[ face.v[p_idx2[2]] ];
-            normal_2(a,b,c,&normal);
-            vertex_add_to(ret[face.v[p_idx2[0]]],normal);
-            vertex_add_to(ret[face.v[p_idx2[1]]],normal);
-            vertex_add_to(ret[face.v[p_idx2[2]]],normal);
+            bmin[k]=std::min(bmin[k],vertex[(size_t)i*8+5+k]);
+            bmax[k]=std::max(bmax[k],vertex[(size_t)i*8+5+k]);
         }
     }
+    if(nv==0) return 0.0f;
+    return std::sqrt((bmax[0]-bmin[0])*(bmax[0]-bmin[0])+(bmax[1]-bmin[1])*(bmax[1]-bmin[1])+(bmax[2]-bmin[2])*(bmax[2]-bmin[2]));
+}
 
-    for(i=0;i<n;i++)
+// every level is simplified from the previous one to 1/MODEL_LOD_RATIO, the allowed error grows as well.
+// a level which can't be reduced much shares the triangles of the previous level.
+static void model_element_lod(model_element_t *me, ibo_source_t &idx, const GLfloat *vertex, GLuint nv, float error)
+{
+    std::vector<uint32_t> x;
+    for(int l=1;l<MODEL_LOD_LEVELS;l++)
     {
-        normalize_vertex(ret[i]);
+        size_t n=me->num_index[l-1];
+        me->idx_top[l]=me->idx_top[l-1];
+        me->num_index[l]=n;
+
+        x.assign(idx.begin()+me->idx_top[l-1], idx.begin()+me->idx_top[l-1]+n);
+        size_t m=mesh_simplify(x.data(), x.data(), n, vertex, nv, 8, 5, n/MODEL_LOD_RATIO, error);
+        error*=MODEL_LOD_RATIO;
+        if(m*4>n*3) continue;
+
+        vertex_cache_optimize(x.data(), m, nv);
+        me->idx_top[l]=idx.size();
+        me->num_index[l]=m;
+        idx.insert(idx.end(), x.begin(), x.begin()+m);
     }
-    return ret;
 }
 
-static size_t model_object_compile(object_type &object, material_list &materials, vertex_list &gv, model_elements_t &elements, vbo_source_t &src)
+// one element per material, triangles of an element are ordered for the vertex cache
+// and vertices of the object are ordered by the first use.
+static size_t model_object_compile(object_type &object, material_list &materials, vertex_list &gv, model_elements_t &elements, vbo_source_t &src, ibo_source_t &idx, model_normals_t &normals)
 {
-    int m=0;
-    size_t ret=0;
-    vertex_list *v;
-    model_element_t *me=NULL;
-
-    if(object.v.size()==0)
+    vertex_list &v= object.v.size() ? object.v : gv;
+    size_t nf=object.f.size();
+    size_t nm=materials.size();
+
+    //faces sorted by material, and the number of indices
+    std::vector<size_t> top(nm+1,0);
+    size_t corners=0;
+    for(const auto &f:object.f)
     {
-        v=&gv;
+        if((f.m<0) || (f.m>=(int)nm)) continue;
+        top[f.m+1]++;
+        corners+= f.n==4 ? 6 : 3;
     }
-    else
+    if(corners==0) return 0;
+    for(size_t m=0;m<nm;m++) top[m+1]+=top[m];
+    std::vector<uint32_t> faces(top[nm]);
     {
-        v=&object.v;
+        std::vector<size_t> fill(top.begin(),top.end()-1);
+        for(size_t j=0;j<nf;j++)
+        {
+            int m=object.f[j].m;
+            if((m<0) || (m>=(int)nm)) continue;
+            faces[fill[m]++]=(uint32_t)j;
+        }
     }
 
-    vertex_type *normals=NULL;
-    normals=get_normal(object,*v);
-
-    //qDebug() << QString::fromUtf16((const ushort*)object.name.c_str());
-
-    typedef std::map<int,vbo_source_t*> src_for_mat_t;
-    src_for_mat_t src_for_mat;
-
-    m=0;
-    for(material_list::iterator i=materials.begin();i!=materials.end();i++)
+    //normal of every triangle once, vertex normals are the sum of them
+    if(normals.normal.size()<v.size())
     {
-        src_for_mat[m]=new vbo_source_t;
-        m++;
+        normals.normal.resize(v.size());
+        normals.used.resize(v.size(),0);
     }
-
-    double facet=std::cos(object.facet*d2r);
-    for(face_list::iterator j=object.f.begin();j!=object.f.end();j++)
+    std::vector<vertex_type> fn(nf*2);
+    for(size_t j=0;j<nf;j++)
     {
-        int m=(*j).m;
-        if((m<0) || (m>=(int)materials.size())) continue;
-        polygon((*j),*v,normals, materials[m].tex!="" ,facet, *src_for_mat[m]);
+        face_type &face=object.f[j];
+        for(int t=0;t<(face.n==4 ? 2 : 1);t++)
+        {
+            const int *p= t ? p_idx2 : p_idx1;
+            vertex_type a=v[ face.v[p[0]] ];
+            vertex_type b=v[ face.v[p[1]] ];
+            vertex_type c=v[ face.v[p[2]] ];
+            normal_2(a,b,c,&fn[j*2+t]);
+            for(int k=0;k<3;k++)
+            {
+                int i=face.v[p[k]];
+                if(!normals.used[i])
+                {
+                    normals.used[i]=1;
+                    normals.list.push_back(i);
+                }
+                vertex_add_to(normals.normal[i],fn[j*2+t]);
+            }
+        }
     }
+    for(int i:normals.list) normalize_vertex(normals.normal[i]);
 
+    double facet=std::cos(object.facet*d2r);
+    size_t vtop=src.size();
+    size_t itop=idx.size();
+    size_t first=elements.size();
+    idx.reserve(itop+corners);
+    model_vertex_table table(src,corners);
 
-    m=0;
-    for(material_list::iterator i=materials.begin();i!=materials.end();i++)
+    for(size_t m=0;m<nm;m++)
     {
-
-        vbo_source_t *srcm=src_for_mat[m];
-
-        //qDebug() << QString::fromUtf16((const ushort*)(*i).name.c_str()) << srcm->size();
-
-        if(srcm->size())
+        if(top[m]==top[m+1]) continue;
+        int tex= materials[m].tex!="";
+
+        model_element_t *me=new model_element_t;
+        me->shadeModel=object.shading?GL_SMOOTH:GL_FLAT;
+        me->idx_material=(int)m;
+        me->idx_top[0]=idx.size();
+        me->group_id=object.obj_id;
+        me->group_top=object.top_of_group;
+        for(size_t k=top[m];k<top[m+1];k++)
         {
-            me=new model_element_t;
-            me->shadeModel=object.shading?GL_SMOOTH:GL_FLAT;
-            me->idx_material=m;
-            me->src_top=src.size()/8;           //top of vertex
-            me->num_vertex = srcm->size()/8;    //number of vertex
-            me->group_id=object.obj_id;
-            me->group_top=object.top_of_group;
-            for(vbo_source_t::iterator j=srcm->begin(); j!=srcm->end();j++) src.push_back( (*j) );
-            elements.push_back(me);
-            ret+=me->num_vertex;    //number of GLfloat variables
+            face_type &face=object.f[faces[k]];
+            for(int t=0;t<(face.n==4 ? 2 : 1);t++)
+            {
+                const int *p= t ? p_idx2 : p_idx1;
+                vertex_type &face_n=fn[faces[k]*2+t];
+                for(int c=0;c<3;c++)
+                {
+                    int i=p[c];
+                    vertex_type normal;
+                    decide_normal(normal,face_n,&normals.normal[face.v[i]],facet);
+
+                    const vertex_type &pos=v[ face.v[i] ];
+                    GLfloat x[8];
+                    x[0]= tex ? (GLfloat)face.uv[i*2]   : 0.0f;
+                    x[1]= tex ? (GLfloat)face.uv[i*2+1] : 0.0f;
+                    x[2]=(GLfloat)normal.x;
+                    x[3]=(GLfloat)normal.y;
+                    x[4]=(GLfloat)normal.z;
+                    x[5]=(GLfloat)pos.x;
+                    x[6]=(GLfloat)pos.y;
+                    x[7]=(GLfloat)pos.z;
+                    idx.push_back(table.add(x));
+                }
+            }
         }
-        delete srcm;
-        m++;
-
+        me->num_index[0]=idx.size()-me->idx_top[0];
+        elements.push_back(me);
     }
 
-    if(normals!=NULL) delete [] normals;
-    return ret;
-}
-
+    for(int i:normals.list)
+    {
+        normals.used[i]=0;
+        normals.normal[i].x=normals.normal[i].y=normals.normal[i].z=0.0;
+    }
+    normals.list.clear();
 
-static GLuint model_load_texture(const char *filename,const char *model_path,textures_t &textures);
+    GLuint nv=(GLuint)((src.size()-vtop)/8);
+    for(size_t e=first;e<elements.size();e++)
+    {
+        vertex_cache_optimize(&idx[elements[e]->idx_top[0]], elements[e]->num_index[0], nv);
+    }
 
-static void model_load_all_texture(model_type *model,textures_t &textures)
-{
-    fs::path ps(model->path);
-    std::string model_path=ps.remove_filename().string();
+    //simplified levels refer to the vertices of the full detail
+    size_t ltop=idx.size();
+    float size=model_vertex_size(&src[vtop], nv);
+    for(size_t e=first;e<elements.size();e++)
+    {
+        model_element_lod(elements[e], idx, &src[vtop], nv, size*MODEL_LOD_ERROR);
+    }
 
-    for(material_list::iterator i=model->mate.begin();i!=model->mate.end();i++)
+    std::vector<uint32_t> remap;
+    vertex_fetch_order(&idx[itop], ltop-itop, nv, remap);
+    vbo_source_t sorted((size_t)nv*8);
+    for(GLuint i=0;i<nv;i++)
     {
-        if((*i).tex!="")
-        {
-            (*i).tex_id=model_load_texture( (*i).tex.c_str(),model_path.c_str(),textures );
-        }
-        else
-        {
-            (*i).tex_id=0;
-        }
-        //qDebug() << QString::fromUtf16((const ushort*)(*i).name.c_str()) << (*i).tex_id;
-#if 0
-        if( (*i).tex_id==0 && (*i).tex!=L"" )
-        {
-            (*i).tex_id=model_load_texture( (*i).tex.c_str(),model_path.c_str(),textures );
-        }
-#endif
+        memcpy(&sorted[(size_t)remap[i]*8],&src[vtop+(size_t)i*8],8*sizeof(GLfloat));
     }
-}
+    std::copy(sorted.begin(),sorted.end(),src.begin()+vtop);
 
-static GLuint model_load_texture(const char *filename, const char *model_path, textures_t &textures)
-{
-    GLuint ret=0;
+    GLuint base=(GLuint)(vtop/8);
+    for(size_t i=itop;i<idx.size();i++) idx[i]=base+remap[idx[i]];
 
-    int img_ok=1;
+    return nv;
+}
 
-    fs::path mp(model_path);
-    std::string alt_filename=mp.replace_filename(filename).string();
+// one task per object, larger objects are started first.
+// normal tables are as long as the vertex list, they are reused by the tasks.
+static void model_objects_compile(const std::vector<object_type*> &objects, material_list &materials, vertex_list &gv, std::vector<model_compiled_t> &ret)
+{
+    ret.clear();
+    ret.resize(objects.size());
 
-    QString _filename=QString(filename);
-    QString _alt_filename=QString(alt_filename.c_str());
+    std::vector<size_t> order(objects.size());
+    for(size_t i=0;i<order.size();i++) order[i]=i;
+    std::stable_sort(order.begin(),order.end(),[&objects](size_t a, size_t b){ return objects[a]->f.size()>objects[b]->f.size(); });
 
-    QImage image;
-    if(!image.load(_filename))
+    QMutex lock;
+    std::vector<model_normals_t*> scratch;
+    parallel::for_chunks(order.size(), 1, [&](quint64 first, quint64 last)
     {
-        qDebug()<< "Image file" << _filename << "load error. try alternative one...\n";
-        if(!image.load(_alt_filename))
+        model_normals_t *normals;
         {
-            qDebug()<< "Alternative Image file" << _alt_filename << "load error.\n";
-            img_ok=0;
+            QMutexLocker locker(&lock);
+            if(scratch.empty())
+            {
+                normals=new model_normals_t;
+            }
+            else
+            {
+                normals=scratch.back();
+                scratch.pop_back();
+            }
         }
-        else
+        for(quint64 i=first;i<last;i++)
         {
-            qDebug()<< "Alternative Image file" << _alt_filename << "load ok.\n";
+            model_compiled_t &c=ret[order[i]];
+            c.num_vertex=model_object_compile(*objects[order[i]], materials, gv, c.elements, c.src, c.idx, *normals);
         }
-    }
-    else
-    {
-        qDebug()<< "Image file" << _filename << "load ok.\n";
-    }
-    if(!img_ok)
-    {
-        return 0;
-    }
-
-    QOpenGLTexture *texture;
-
-    texture = new QOpenGLTexture(image.mirrored());
-    texture->setMinificationFilter(QOpenGLTexture::Nearest);    // Set nearest filtering mode for texture minification
-    texture->setMagnificationFilter(QOpenGLTexture::Linear);    // Set bilinear filtering mode for texture magnification
-    texture->setWrapMode(QOpenGLTexture::Repeat);               // Wrap texture coordinates by repeating (ex. texture coordinate (1.1, 1.2) is same as (0.1, 0.2))
-
-    ret=texture->textureId();
-
-    textures[ret]=texture;
-
-    return ret;
+        QMutexLocker locker(&lock);
+        scratch.push_back(normals);
+    });
+    for(auto x:scratch) delete x;
 }
 
 
@@ -746,3 +1504,4 @@ static GLuint model_load_texture(const char *filename, const char *model_path, t
 
 
 
+
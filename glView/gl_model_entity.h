@@ -12,29 +12,141 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 */
 
 #include "gl_entity_ctx.h"
+#include "gl_instancing.h"
 #include "model.h"
+#include "model_w2m.h"
 
 #include <vector>
 #include <map>
 
 #include <QOpenGLTexture>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QHash>
 
 typedef std::map<GLuint,QOpenGLTexture*> textures_t;
 typedef std::vector<GLfloat> vbo_source_t;
+typedef std::vector<GLuint> ibo_source_t;
+
+#define MODEL_LOD_LEVELS 3         //full detail and simplified levels
 
 typedef struct
 {
     int shadeModel;    //GL_SMOOTH or GL_FLAT
     int idx_material;
-    size_t src_top;
-    size_t num_vertex;
+    size_t idx_top[MODEL_LOD_LEVELS];   //first index of the triangles of the level, 0 is full detail
+    size_t num_index[MODEL_LOD_LEVELS];
     int group_id;
     int group_top;
 } model_element_t;
 
 typedef std::vector<model_element_t*> model_elements_t;
+
+typedef struct
+{
+    QVector4D col;
+    QVector4D amb;
+    QVector4D emi;
+    QVector4D dif;
+    QVector4D spc;
+    int tex_id;
+} material_uniform_t;
+
+typedef std::vector<material_uniform_t> material_uniforms_t;
 typedef std::vector<QVector3D> vector3ds_t;
 
+typedef struct
+{
+    int first;      //instance
+    int count;
+} instance_range_t;
+
+typedef std::vector<instance_range_t> instance_ranges_t;
+
+typedef struct
+{
+    int projMat;
+    int viewMat;
+    int grpMat;
+    int litPos;
+    int matCol;
+    int matAmb;
+    int matDif;
+    int matEmi;
+    int matSpc;
+    int enaShad;
+    int enaTex;
+    int mode;
+} instanced_uniforms_t;
+
+// compiled model shared by the entities which load the same file with the same import parameters
+// the first entity loads it and the others wait for it, buffers and textures are uploaded once.
+// a flat mesh (.w2m) is mapped and its blocks are handed to the buffers as they are.
+class gl_model_mesh
+{
+    friend class gl_model_entity;
+
+public:
+    static gl_model_mesh *acquire(const QString &fileName, const model_import_params_t &param);    //nullptr when it fails
+    static void release(gl_model_mesh *m);      //the last one deletes it, context required when it's uploaded
+
+    void upload(void);                          //context required, only the first call uploads
+    quint64 gpuBytes(void) const;
+    quint64 cpuBytes(void) const;
+    int users(void) const {return refs;}
+
+    // compiled and written as a flat mesh, texture files are referred by the names in the source
+    static bool convert(const QString &source, const QString &fileName, const model_import_params_t &param);
+
+private:
+    gl_model_mesh(const QString &fileName, const model_import_params_t &param);
+    ~gl_model_mesh();
+
+    bool load(void);
+    static QString getFileName(const QString &fileName);
+
+    // compiled model cache keyed by the content hash of the source, it's a flat mesh
+    QByteArray cacheKey(const QString &fileName);
+    QString cacheFileName(const QByteArray &key);     //empty when no cache is available
+    bool flat_import(const QString &fname, const QByteArray &key);    //key is not checked when it's empty
+    bool flat_export(const QString &fname, const QByteArray &key);
+
+    void decode_textures(void);     //loader thread
+
+private:
+    QString sourceName;
+    model_import_params_t param;
+    int refs;
+    int state;                      //0: loading, 1: loaded, -1: failed
+
+    model_type model;
+    vector3ds_t cg;
+    vector3ds_t axis;
+
+    model_elements_t model_elements;
+    vbo_source_t vbo_src;           //unique vertices, empty when they're mapped
+    ibo_source_t ibo_src;           //triangles of the elements
+    w2m_file flat;                  //mapped flat mesh
+    const GLfloat *vertex;          //vbo_src or the mapped block, released once they're uploaded
+    const GLuint *index;
+    size_t num_vertex;
+    size_t num_index;
+    float radius;                   //from the model origin
+
+    QOpenGLBuffer vbo;
+    QOpenGLBuffer ibo;
+    textures_t textures;
+    std::vector<QByteArray> texKeys;    //decoded images of the materials, uploaded by upload()
+    material_uniforms_t materials;  //expanded once at upload()
+    bool uploaded;
+
+    static QMutex _mtx;
+    static QWaitCondition _loaded;
+    static QHash<QString, gl_model_mesh*> _meshes;    //path and import parameters
+};
+
+// an instance of a shared mesh with its own transform and animation
 class gl_model_entity : public gl_entity_ctx
 {
     Q_OBJECT
@@ -42,6 +154,7 @@ class gl_model_entity : public gl_entity_ctx
 public:
     explicit gl_model_entity(QObject *parent = 0);
     virtual ~gl_model_entity();
+    virtual void cleanup(void);
     virtual int prepare_gl(void);
 
 public slots:
@@ -50,34 +163,40 @@ public slots:
 protected:
     virtual const char *get_vertex_shader(void) const;
     virtual const char *get_fragment_shader(void) const;
+    virtual const char *get_instanced_vertex_shader(void) const;
 
     virtual void vbo_allocate(void);
     virtual void vbo_bind(void);
 
     virtual void update_group_matrix(int id,QMatrix4x4 &local);
 
-    virtual QString getFileName(const QString &fileName);
-
 public:
     virtual void draw_gl(gl_draw_ctx_t &draw);
 
-private:
-    QOpenGLBuffer vbo;
-    QOpenGLShaderProgram *prg;
+    virtual quint64 gpuBytes(void);
+    virtual quint64 cpuBytes(void);
 
-    model_type model;
-    vector3ds_t cg;
-    vector3ds_t axis;
+    virtual bool isAnimated(void);
+    virtual quint64 renderKey(void);
 
-    double inc;
+    // drawn at every model matrix of the instance buffer, one draw per element and range
+    int viewMatrix(const gl_draw_ctx_t &draw, const QMatrix4x4 &base, QMatrix4x4 &ret);  //camera * world * origin offset * base
+    bool drawInstanced_gl(gl_draw_ctx_t &draw, const QMatrix4x4 &view, QOpenGLBuffer &instances, const instance_ranges_t &ranges, int level=0);  //false when instancing is not supported
+    float boundingRadius(void) {return mesh!=nullptr ? mesh->radius : 0.0f;}
+    static int lodLevel(float pixels);     //level of detail for the radius on the screen
 
-    model_import_params_t param;
+private:
+    bool instancing_prepare(void);
 
-    model_elements_t model_elements;
-    vbo_source_t vbo_src;
-    size_t num_vertex;
+private:
+    gl_model_mesh *mesh;
+    QOpenGLVertexArrayObject vao;   //not created when VAO is not supported, it's not shared by contexts
+    QOpenGLShaderProgram *prg;
 
-    textures_t textures;
+    double inc;         //joint angle [deg]
+    QElapsedTimer clock;
+
+    model_import_params_t param;
 
     int projMat;
     int mvMat;
@@ -90,6 +209,12 @@ private:
     int matSpc;
     int enaShad;
     int enaTex;
+    int modeLoc;
+
+    gl_instancing instancing;
+    int instancingState;            //0: not tried, 1: available, -1: not supported
+    QOpenGLShaderProgram *instPrg;
+    instanced_uniforms_t instUni;
 };
 
 #endif // GL_MODEL_ENTITY_H
@@ -0,0 +1,452 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "gl_pcloud_batch.h"
+#include "gl_pcloud_entity.h"
+#include "gl_programs.h"
+
+#include <QOpenGLShaderProgram>
+#include <QOpenGLFunctions_2_1>
+#include <QOpenGLContext>
+#include <QDebug>
+
+#define BATCH_ARENA_POINTS (0x100000)   //points in one arena VBO
+#define BATCH_MAX_POINTS (0x40000)      //larger clouds draw themselves
+#define BATCH_UPLOAD_POINTS (0x10000)   //points repacked at once
+#define BATCH_TABLE_WIDTH (5)           //texels of a slot: model matrix and origin
+#define BATCH_TABLE_ROWS (64)           //initial number of slots
+
+gl_pcloud_batch::gl_pcloud_batch()
+{
+    _available=false;
+    _prg[0]=_prg[1]=nullptr;
+    _nSlot=0;
+    _table=nullptr;
+    _tableRows=0;
+}
+
+gl_pcloud_batch::~gl_pcloud_batch()
+{
+    detachAll();
+    for(auto &a:_arena)
+    {
+        if(a.vao!=nullptr) delete a.vao;
+        a.vbo.destroy();
+    }
+    if(_table!=nullptr) delete _table;
+    for(int i=0;i<2;i++)
+    {
+        gl_programs::release(_prg[i]);
+    }
+}
+
+bool gl_pcloud_batch::initialize(void)
+{
+    QOpenGLContext *ctx=QOpenGLContext::currentContext();
+    if(ctx==nullptr) return false;
+
+    GLint units=0;
+    ctx->functions()->glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &units);
+    if(units<1 || !ctx->hasExtension("GL_ARB_texture_float"))
+    {
+        qDebug()<<"gl_pcloud_batch is not available";
+        return false;
+    }
+
+    const char *frag[2]={":/gl/gl_pcloud_entity1.frag", ":/gl/gl_pcloud_entity2.frag"};
+    for(int i=0;i<2;i++)
+    {
+        _prg[i]=gl_programs::acquire(":/gl/gl_pcloud_batch.vert", frag[i], QStringList()<<"vertex"<<"rgb"<<"amp"<<"range"<<"flags"<<"slot");
+        QOpenGLShaderProgram *z=_prg[i];
+        if(z==nullptr) return false;
+
+        pc_batch_uniforms_t &u=_uni[i];
+        u.table     =z->uniformLocation("table");
+        u.tableRows =z->uniformLocation("tableRows");
+        u.vpMatrix  =z->uniformLocation("vpMatrix");
+        u.a_range   =z->uniformLocation("a_range");
+        u.r_range   =z->uniformLocation("r_range");
+        u.z_range   =z->uniformLocation("z_range");
+        u.mode      =z->uniformLocation("mode");
+        u.pointsize =z->uniformLocation("pointsize");
+        u.fltAEnable=z->uniformLocation("fltAEnable");
+        u.fltA      =z->uniformLocation("fltA");
+        u.fltREnable=z->uniformLocation("fltREnable");
+        u.fltR      =z->uniformLocation("fltR");
+        u.fltZEnable=z->uniformLocation("fltZEnable");
+        u.fltZ      =z->uniformLocation("fltZ");
+        u.antiAlias =z->uniformLocation("antiAlias");
+    }
+
+    _available=true;
+    return true;
+}
+
+bool gl_pcloud_batch::isBatchable(gl_pcloud_entity *pc)
+{
+    return pc->nVertex()>0 && pc->nVertex()<=BATCH_MAX_POINTS;
+}
+
+bool gl_pcloud_batch::add(gl_pcloud_entity *pc)
+{
+    if(!_available || !isBatchable(pc) || _member.contains(pc)) return false;
+
+    pc_layout_t layout;
+    layout.nElement=pc->_nElement;
+    layout.rgb=pc->_rgb;
+    layout.amp=pc->_amp;
+    layout.rng=pc->_rng;
+    layout.flg=pc->_flg;
+
+    pc_member_t m;
+    m.arena=findArena(layout, (GLsizei)pc->nVertex(), m.range);
+    if(m.arena<0) return false;
+    m.slot=allocateSlot();
+
+    _member[pc]=m;
+    upload(m, pc);
+    return true;
+}
+
+void gl_pcloud_batch::update(gl_pcloud_entity *pc)
+{
+    if(_member.contains(pc))
+    {
+        upload(_member[pc], pc);
+    }
+}
+
+void gl_pcloud_batch::remove(gl_pcloud_entity *pc)
+{
+    if(!_member.contains(pc)) return;
+
+    pc_member_t m=_member.take(pc);
+    release(_arena[m.arena], m.range);
+    _freeSlot.append(m.slot);
+}
+
+void gl_pcloud_batch::detachAll(void)
+{
+    foreach(auto pc, _member.keys())
+    {
+        pc->_batch=nullptr;
+    }
+    _member.clear();
+}
+
+quint64 gl_pcloud_batch::gpuBytes(gl_pcloud_entity *pc)
+{
+    if(!_member.contains(pc)) return 0;
+    const pc_member_t &m=_member[pc];
+    return (quint64)m.range.count*(_arena[m.arena].layout.nElement+1)*sizeof(GLfloat);
+}
+
+//--------------------------------------------------------------------------------
+// Arena
+//--------------------------------------------------------------------------------
+
+int gl_pcloud_batch::findArena(const pc_layout_t &layout, GLsizei count, pc_range_t &range)
+{
+    for(int i=0;i<_arena.size();i++)
+    {
+        if(memcmp(&_arena[i].layout, &layout, sizeof(layout))) continue;
+        if(allocate(_arena[i], count, range)) return i;
+    }
+
+    pc_arena_t a;
+    a.layout=layout;
+    a.capacity=BATCH_ARENA_POINTS;
+    a.vbo=QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    a.vbo.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    if(!a.vbo.create() || !a.vbo.bind())
+    {
+        qDebug() << "gl_pcloud_batch VBO ERROR";
+        return -1;
+    }
+    a.vbo.allocate(a.capacity*(layout.nElement+1)*sizeof(GLfloat));
+    a.vbo.release();
+
+    a.vao=new QOpenGLVertexArrayObject;
+    if(a.vao->create())
+    {   //attribute setup is recorded once
+        a.vao->bind();
+        vbo_bind(a, QOpenGLContext::currentContext()->functions());
+        a.vao->release();
+        a.vbo.release();
+    }
+    else
+    {
+        delete a.vao;
+        a.vao=nullptr;
+    }
+
+    pc_range_t all;
+    all.first=0;
+    all.count=a.capacity;
+    a.free.append(all);
+
+    allocate(a, count, range);
+    _arena.append(a);
+    return _arena.size()-1;
+}
+
+// first fit
+bool gl_pcloud_batch::allocate(pc_arena_t &a, GLsizei count, pc_range_t &range)
+{
+    for(int i=0;i<a.free.size();i++)
+    {
+        pc_range_t &f=a.free[i];
+        if(f.count<count) continue;
+
+        range.first=f.first;
+        range.count=count;
+        f.first+=count;
+        f.count-=count;
+        if(!f.count) a.free.remove(i);
+        return true;
+    }
+    return false;
+}
+
+// give the range back, neighbouring free ranges are merged
+void gl_pcloud_batch::release(pc_arena_t &a, const pc_range_t &range)
+{
+    int i=0;
+    while(i<a.free.size() && a.free[i].first<range.first) i++;
+    a.free.insert(i, range);
+
+    if(i+1<a.free.size() && a.free[i].first+a.free[i].count==a.free[i+1].first)
+    {
+        a.free[i].count+=a.free[i+1].count;
+        a.free.remove(i+1);
+    }
+    if(i>0 && a.free[i-1].first+a.free[i-1].count==a.free[i].first)
+    {
+        a.free[i-1].count+=a.free[i].count;
+        a.free.remove(i);
+    }
+}
+
+// copy vertices of the cloud into its range with the slot appended
+void gl_pcloud_batch::upload(const pc_member_t &m, gl_pcloud_entity *pc)
+{
+    pc_arena_t &a=_arena[m.arena];
+    const int nElement=a.layout.nElement;
+    const int stride=nElement+1;
+    const GLfloat slot=(GLfloat)m.slot;
+
+    QVector<GLfloat> buf;
+    buf.resize(qMin<GLsizei>(m.range.count, BATCH_UPLOAD_POINTS)*stride);
+
+    if(!a.vbo.bind()) return;
+    const GLfloat *v=pc->vertex();
+    for(GLsizei i=0;i<m.range.count;i+=BATCH_UPLOAD_POINTS)
+    {
+        GLsizei n=qMin<GLsizei>(m.range.count-i, BATCH_UPLOAD_POINTS);
+        GLfloat *w=buf.data();
+        for(GLsizei j=0;j<n;j++)
+        {
+            memcpy(w, v, nElement*sizeof(GLfloat));
+            w[nElement]=slot;
+            v+=nElement;
+            w+=stride;
+        }
+        a.vbo.write((m.range.first+i)*stride*sizeof(GLfloat), buf.constData(), n*stride*sizeof(GLfloat));
+    }
+    a.vbo.release();
+}
+
+int gl_pcloud_batch::allocateSlot(void)
+{
+    if(!_freeSlot.isEmpty())
+    {
+        return _freeSlot.takeLast();
+    }
+    return _nSlot++;
+}
+
+//--------------------------------------------------------------------------------
+// Transform table
+//--------------------------------------------------------------------------------
+
+void gl_pcloud_batch::updateTable(void)
+{
+    int rows=qMax(_tableRows, BATCH_TABLE_ROWS);
+    while(rows<_nSlot) rows*=2;
+
+    _tableData.resize(rows*BATCH_TABLE_WIDTH*4);
+
+    for(auto i=_member.begin(); i!=_member.end(); i++)
+    {
+        gl_pcloud_entity *pc=i.key();
+        QMatrix4x4 m;
+        if(!pc->modelMatrix(m)) continue;
+
+        GLfloat *row=_tableData.data()+i.value().slot*BATCH_TABLE_WIDTH*4;
+        memcpy(row, m.constData(), 16*sizeof(GLfloat));   //column major
+        row[16]=pc->localOrigin().z();
+        row[17]=row[18]=row[19]=0.0f;
+    }
+
+    if(rows!=_tableRows || _table==nullptr)
+    {
+        if(_table!=nullptr) delete _table;
+        _table=new QOpenGLTexture(QOpenGLTexture::Target2D);
+        _table->setFormat(QOpenGLTexture::RGBA32F);
+        _table->setSize(BATCH_TABLE_WIDTH, rows);
+        _table->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+        _table->setWrapMode(QOpenGLTexture::ClampToEdge);
+        _table->allocateStorage(QOpenGLTexture::RGBA, QOpenGLTexture::Float32);
+        _tableRows=rows;
+        _tableUploaded.clear();
+    }
+
+    if(_tableData!=_tableUploaded)
+    {
+        _table->setData(QOpenGLTexture::RGBA, QOpenGLTexture::Float32, _tableData.constData());
+        _tableUploaded=_tableData;
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Draw
+//--------------------------------------------------------------------------------
+
+void gl_pcloud_batch::vbo_bind(pc_arena_t &a, QOpenGLFunctions *f)
+{
+    const pc_layout_t &l=a.layout;
+    const GLsizei stride=(l.nElement+1)*sizeof(GLfloat);
+    if(a.vbo.bind())
+    {
+        f->glEnableVertexAttribArray(0);
+        if(l.rgb>0) f->glEnableVertexAttribArray(1);
+        if(l.amp>0) f->glEnableVertexAttribArray(2);
+        if(l.rng>0) f->glEnableVertexAttribArray(3);
+        if(l.flg>0) f->glEnableVertexAttribArray(4);
+        f->glEnableVertexAttribArray(5);
+        f->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+        if(l.rgb>0) f->glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void *>(l.rgb * sizeof(GLfloat)));
+        if(l.amp>0) f->glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void *>(l.amp * sizeof(GLfloat)));
+        if(l.rng>0) f->glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void *>(l.rng * sizeof(GLfloat)));
+        if(l.flg>0) f->glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void *>(l.flg * sizeof(GLfloat)));
+        f->glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void *>(l.nElement * sizeof(GLfloat)));
+    }
+    else
+    {
+        qDebug() << "VBO BIND ERROR";
+    }
+}
+
+void gl_pcloud_batch::vbo_release(pc_arena_t &a, QOpenGLFunctions *f)
+{
+    const pc_layout_t &l=a.layout;
+    a.vbo.release();
+    f->glDisableVertexAttribArray(0);
+    if(l.rgb>0) f->glDisableVertexAttribArray(1);
+    if(l.amp>0) f->glDisableVertexAttribArray(2);
+    if(l.rng>0) f->glDisableVertexAttribArray(3);
+    if(l.flg>0) f->glDisableVertexAttribArray(4);
+    f->glDisableVertexAttribArray(5);
+}
+
+void gl_pcloud_batch::draw_gl(gl_draw_ctx_t &draw)
+{
+    if(!_available || _member.isEmpty()) return;
+
+    // draw list of visible members for each arena, vectors keep their capacity over frames
+    QVector<QVector<GLint>> &first=_first;
+    QVector<QVector<GLsizei>> &count=_count;
+    first.resize(_arena.size());
+    count.resize(_arena.size());
+    for(int i=0;i<_arena.size();i++)
+    {
+        first[i].clear();
+        count[i].clear();
+    }
+    int visible=0;
+    for(auto i=_member.begin(); i!=_member.end(); i++)
+    {
+        QMatrix4x4 m;
+        if(!i.key()->show() || !i.key()->modelMatrix(m)) continue;
+        const pc_member_t &x=i.value();
+        first[x.arena].append(x.range.first);
+        count[x.arena].append(x.range.count);
+        visible++;
+    }
+    if(!visible) return;
+
+    QOpenGLContext *ctx=QOpenGLContext::currentContext();
+    QOpenGLFunctions *fc=ctx->functions();
+    QOpenGLFunctions_2_1 *f21=ctx->versionFunctions<QOpenGLFunctions_2_1>();
+    if(f21==nullptr) return;
+
+    updateTable();
+
+    int k=draw.pointAntiAlias?0:1;
+    QOpenGLShaderProgram *p=_prg[k];
+    const pc_batch_uniforms_t &u=_uni[k];
+
+    int mode=draw.opt_pc.color_mode;
+    GLfloat psz=draw.opt_pc.psz;
+    if(draw.mode==GL_DRAW_PICK)
+    {
+        mode=OPT_PC_CM_DEPTH;
+        psz=10.0f;
+    }
+
+    p->bind();
+    fc->glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+    if(draw.pointAntiAlias) fc->glEnable(GL_POINT_SPRITE);
+
+    _table->bind(0);
+    p->setUniformValue(u.table, 0);
+    p->setUniformValue(u.tableRows, (GLfloat)_tableRows);
+    p->setUniformValue(u.vpMatrix, draw.proj*draw.camera*draw.world);
+
+    // heights are compared above the master origin, not above the local origin of each cloud
+    const auto &amp = draw.opt_pc.amp;
+    const auto &rng = draw.opt_pc.rng;
+    const auto &hgt = draw.opt_pc.hgt;
+    p->setUniformValue(u.a_range, QVector3D(amp[0], amp[1], amp[1]-amp[0]));
+    p->setUniformValue(u.r_range, QVector3D(rng[0], rng[1], rng[1]-rng[0]));
+    p->setUniformValue(u.z_range, QVector3D(hgt[0], hgt[1], hgt[1]-hgt[0]));
+    p->setUniformValue(u.mode, (int)mode);
+    p->setUniformValue(u.pointsize, psz);
+
+    const auto &famp = draw.opt_pc.flt_amp;
+    const auto &frng = draw.opt_pc.flt_rng;
+    const auto &fhgt = draw.opt_pc.flt_hgt;
+    p->setUniformValue(u.fltAEnable, (int)(famp[0]<famp[1]));
+    p->setUniformValue(u.fltA, QVector2D(famp[0], famp[1]));
+    p->setUniformValue(u.fltREnable, (int)(frng[0]<frng[1]));
+    p->setUniformValue(u.fltR, QVector2D(frng[0], frng[1]));
+    p->setUniformValue(u.fltZEnable, (int)(fhgt[0]<fhgt[1]));
+    p->setUniformValue(u.fltZ, QVector2D(fhgt[0], fhgt[1]));
+
+    p->setUniformValue(u.antiAlias, (int)draw.pointAntiAlias);
+
+    for(int i=0;i<_arena.size();i++)
+    {
+        if(first[i].isEmpty()) continue;
+        pc_arena_t &a=_arena[i];
+        if(a.vao!=nullptr) a.vao->bind();
+        else               vbo_bind(a, fc);
+        f21->glMultiDrawArrays(GL_POINTS, first[i].constData(), count[i].constData(), first[i].size());
+        if(a.vao!=nullptr) a.vao->release();
+        else               vbo_release(a, fc);
+    }
+
+    _table->release(0);
+
+    if(draw.pointAntiAlias) fc->glDisable(GL_POINT_SPRITE);
+    fc->glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+    p->release();
+}
@@ -0,0 +1,131 @@
+#ifndef GL_PCLOUD_BATCH_H
+#define GL_PCLOUD_BATCH_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <QOpenGLFunctions>
+#include <QOpenGLBuffer>
+#include <QOpenGLTexture>
+#include <QOpenGLVertexArrayObject>
+#include <QVector>
+#include <QMap>
+
+#include "gl_draw_params.h"
+
+QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
+
+class gl_pcloud_entity;
+
+typedef struct
+{
+    int nElement;       //floats per vertex of the member, slot is appended in the arena
+    int rgb;
+    int amp;
+    int rng;
+    int flg;
+} pc_layout_t;
+
+typedef struct
+{
+    GLint first;
+    GLsizei count;
+} pc_range_t;
+
+typedef struct
+{
+    pc_layout_t layout;
+    QOpenGLBuffer vbo;
+    QOpenGLVertexArrayObject *vao;  //nullptr when VAO is not supported
+    GLsizei capacity;           //points
+    QVector<pc_range_t> free;   //unused ranges, sorted by first
+} pc_arena_t;
+
+typedef struct
+{
+    int arena;
+    pc_range_t range;
+    int slot;                   //row of the transform table
+} pc_member_t;
+
+typedef struct
+{
+    int table;
+    int tableRows;
+    int vpMatrix;
+    int a_range;
+    int r_range;
+    int z_range;
+    int mode;
+    int pointsize;
+    int fltAEnable;
+    int fltA;
+    int fltREnable;
+    int fltR;
+    int fltZEnable;
+    int fltZ;
+    int antiAlias;
+} pc_batch_uniforms_t;
+
+// draws many small point clouds by a few glMultiDrawArrays()
+// vertices of clouds with the same layout share a VBO (arena), every vertex has its slot.
+// model matrix and origin height of each slot are given by a float texture.
+class gl_pcloud_batch
+{
+public:
+    gl_pcloud_batch();
+    ~gl_pcloud_batch();
+
+    bool initialize(void);          //context required, false when the driver can't fetch texture in vertex shader
+    bool isAvailable(void) {return _available;}
+
+    static bool isBatchable(gl_pcloud_entity *pc);
+
+    bool add(gl_pcloud_entity *pc);     //context required
+    void update(gl_pcloud_entity *pc);  //vertex data is changed, context required
+    void remove(gl_pcloud_entity *pc);  //context is not required
+    void detachAll(void);
+
+    void draw_gl(gl_draw_ctx_t &draw);
+
+    quint64 gpuBytes(gl_pcloud_entity *pc);
+
+private:
+    int findArena(const pc_layout_t &layout, GLsizei count, pc_range_t &range);
+    bool allocate(pc_arena_t &a, GLsizei count, pc_range_t &range);
+    void release(pc_arena_t &a, const pc_range_t &range);
+    void upload(const pc_member_t &m, gl_pcloud_entity *pc);
+    int allocateSlot(void);
+    void updateTable(void);
+
+    void vbo_bind(pc_arena_t &a, QOpenGLFunctions *f);
+    void vbo_release(pc_arena_t &a, QOpenGLFunctions *f);
+
+private:
+    bool _available;
+    QOpenGLShaderProgram *_prg[2];      //0: anti-aliasing, 1: no anti-aliasing
+    pc_batch_uniforms_t _uni[2];        //locations of _prg
+
+    QVector<pc_arena_t> _arena;
+    QMap<gl_pcloud_entity*, pc_member_t> _member;
+
+    QVector<int> _freeSlot;
+    int _nSlot;
+
+    QOpenGLTexture *_table;
+    int _tableRows;
+    QVector<GLfloat> _tableData;
+    QVector<GLfloat> _tableUploaded;
+
+    QVector<QVector<GLint>> _first;     //draw lists of draw_gl()
+    QVector<QVector<GLsizei>> _count;
+};
+
+#endif // GL_PCLOUD_BATCH_H
@@ -9,19 +9,25 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 */
 
 #include "gl_pcloud_entity.h"
+#include "gl_pcloud_batch.h"
+#include "gl_programs.h"
 #include "pointcloud_packet.h"
 
 #include <QOpenGLShaderProgram>
 #include <QFileInfo>
 #include <QStandardPaths>
 #include <QThread>
+#include <QDir>
 
 
 #define DRAFT_DRAW_POINTS (1000000)
+#define VBO_CHUNK_POINTS (0x1ffff)
+#define FILTER_UPLOAD_CHUNKS (8)    //index buffers uploaded by one pertialPrepare_gl()
+#define DECODE_CHUNK_POINTS (0x10000)
+#define AUTO_RANGE_LOW (2.0f)       //percentile [%] of the colour range
+#define AUTO_RANGE_HIGH (98.0f)
 
-QMap<int, QOpenGLShaderProgram*> gl_pcloud_entity::_prg;
-std::mutex gl_pcloud_entity::_prgMutex;
-int gl_pcloud_entity::_prgCount=0;
+QMap<QOpenGLShaderProgram*, pc_uniforms_t> gl_pcloud_entity::_uni;
 
 gl_pcloud_entity::gl_pcloud_entity(QObject *parent) : gl_entity_ctx(parent)
 {
@@ -36,6 +42,19 @@ gl_pcloud_entity::gl_pcloud_entity(QObject *parent) : gl_entity_ctx(parent)
     _rng = -1;
     _flg = -1;
 
+    memset(&_filter,0,sizeof(_filter));
+    memset(&_stats,0,sizeof(_stats));
+    _statsApplied=0;
+
+    _batch=nullptr;
+    _prg[0]=_prg[1]=nullptr;
+
+    _evicted=0;
+    _restoring=0;
+    _spill=nullptr;
+    _spilling=0;
+    _spillWatcher=nullptr;
+
     setObjectName("PointCloud");
 }
 
@@ -49,7 +68,7 @@ gl_pcloud_entity::~gl_pcloud_entity()
 void gl_pcloud_entity::init_opt_pc(opt_pointcloud_t &p)
 {
     p.color_mode = OPT_PC_CM_HEIGHT;
-    p.flags = 0;
+    p.flags = OPT_PC_FLAG_AUTO_RANGE;
     p.psz=3.0f;
     p.amp[0]=0.0f;
     p.amp[1]=255.0f;
@@ -65,23 +84,57 @@ void gl_pcloud_entity::init_opt_pc(opt_pointcloud_t &p)
 
 void gl_pcloud_entity::cleanup(void)
 {
+    if(_batch!=nullptr)
+    {
+        _batch->remove(this);
+        _batch=nullptr;
+    }
+
+    cancelFilter();
+    _kdFuture.waitForFinished();
+    _kdtree.clear();
+
+    for(auto &v:_vvbo)
+    {
+        if(v.vao!=nullptr)
+        {
+            delete v.vao;
+            v.vao=nullptr;
+        }
+    }
+
+    if(_restoring && (_evicted & ENTITY_EVICT_CPU))
+    {
+        _restoreFuture.waitForFinished();
+        GLfloat *v=_restoreFuture.result();
+        if(v!=nullptr) delete [] v;
+        _restoring=0;
+    }
+
+    if(_spillWatcher!=nullptr)
+    {   //finishSpill() is not called any more
+        delete _spillWatcher;
+        _spillWatcher=nullptr;
+    }
+    _spillFuture.waitForFinished();
+    _spilling=0;
+
+    if(_spill!=nullptr)
+    {
+        delete _spill;
+        _spill=nullptr;
+    }
+
     if(_vertex!=NULL)
     {
         delete [] _vertex;
         _vertex=nullptr;
     }
 
+    for(int k=0;k<2;k++)
     {
-        std::lock_guard<std::mutex> lock(_prgMutex);
-
-        if(!--_prgCount)
-        {
-            foreach(auto &i, _prg)
-            {
-                i->deleteLater();
-            }
-            _prg.clear();
-        }
+        gl_programs::release(_prg[k]);
+        _prg[k]=nullptr;
     }
 }
 
@@ -130,21 +183,44 @@ int gl_pcloud_entity::load_mem(const uint8_t *buf, size_t length)
             _vertex = new GLfloat [_nElement*_nVertex];
 
             top+=sizeof(pc_payload_t);
-            const GLfloat *v=(const GLfloat *)top;
-            GLfloat *w=_vertex;
-            for(quint64 i=0;i<_nVertex;i++)
+            const GLfloat *src=(const GLfloat *)top;
+            GLfloat *dst=_vertex;
+            const int nElement=_nElement, amp=_amp, rng=_rng;
+
+            // decode and statistics in one pass, one range and one accumulator for each worker thread
+            quint64 chunk=parallel::chunk_size(_nVertex, DECODE_CHUNK_POINTS, 1);
+            auto ranges=parallel::ranges(_nVertex, chunk);
+            std::vector<pc_stats_accumulator> acc(qMax(1,ranges.size()), pc_stats_accumulator(amp>0, rng>0));
+            parallel::for_ranges(ranges, [&](quint64 first, quint64 last)
+            {
+                pc_stats_accumulator &s=acc[first/chunk];
+                const GLfloat *v=src+first*(nElement-1);
+                GLfloat *w=dst+first*nElement;
+                for(quint64 i=first;i<last;i++)
+                {
+                    GLfloat x = v[0];    //Right
+                    GLfloat y = v[1];    //Down
+                    GLfloat z = v[2];    //Forward
+                    w[0] =  z; //East
+                    w[1] = -x; //North
+                    w[2] = -y; //Up
+                    memcpy(w+3, v+3, sizeof(GLfloat)*(nElement-1-3));
+                    w[nElement-1]=0.0f;    //flag
+                    s.add(w, amp>0 ? w[amp] : 0.0f, rng>0 ? w[rng] : 0.0f);
+                    v+=nElement-1;
+                    w+=nElement;
+                }
+            });
+
+            for(size_t i=1;i<acc.size();i++)
+            {
+                acc[0].merge(acc[i]);
+            }
+            acc[0].result(_stats, AUTO_RANGE_LOW, AUTO_RANGE_HIGH);
+            if(_stats.count)
             {
-                GLfloat x = *v++;    //Right
-                GLfloat y = *v++;    //Down
-                GLfloat z = *v++;    //Forward
-                *w++ =  z; //East
-                *w++ = -x; //North
-                *w++ = -y; //Up
-                memcpy(w, v, sizeof(GLfloat)*(_nElement-1-3));
-                v+=_nElement-1-3;
-                w+=_nElement-1-3;
-                *w=0.0f;    //flag
-                w++;
+                setBounding(QVector3D(_stats.bmin[0],_stats.bmin[1],_stats.bmin[2]),
+                            QVector3D(_stats.bmax[0],_stats.bmax[1],_stats.bmax[2]));
             }
 
             return _nVertex;
@@ -184,6 +260,7 @@ void gl_pcloud_entity::load(void)
 
     if(r)
     {
+        buildSpatialIndex();
 
         valid=1;
     }
@@ -200,27 +277,57 @@ void gl_pcloud_entity::load(void)
 QVector3D gl_pcloud_entity::getCenter(void)
 {
     QVector3D ret(0.0f,0.0f,0.0f);
-    if(_nVertex>3)
+    if(_stats.count)
     {
-        ret.setX(_vertex[0]);
-        ret.setY(_vertex[1]);
-        ret.setZ(_vertex[2]);
+        ret=local.map(QVector3D(_stats.centroid[0],_stats.centroid[1],_stats.centroid[2]));
     }
     return ret;
 }
 
+// percentile ranges of this cloud are given once, a range already given by another cloud is widened
+static int auto_range(float *range, const pc_attr_stats_t &a, float offset, int &flags, int ranged)
+{
+    if(!a.valid || !(a.lo<a.hi)) return 0;
+    float lo=a.lo+offset;
+    float hi=a.hi+offset;
+    if(flags & ranged)
+    {
+        range[0]=qMin(range[0],lo);
+        range[1]=qMax(range[1],hi);
+    }
+    else
+    {
+        range[0]=lo;
+        range[1]=hi;
+        flags|=ranged;
+    }
+    return 1;
+}
+
 int gl_pcloud_entity::update_draw_gl(gl_draw_ctx_t &draw)
 {
     int ret=0;
+    opt_pointcloud_t &o=draw.opt_pc;
+    if(_statsApplied || !_stats.count || !(o.flags & OPT_PC_FLAG_AUTO_RANGE)) return ret;
+    _statsApplied=1;
+
+    ret|=auto_range(o.hgt, _stats.attr[PC_STATS_HGT], _localOrigin.z(), o.flags, OPT_PC_FLAG_RANGED_HGT);
+    ret|=auto_range(o.amp, _stats.attr[PC_STATS_AMP], 0.0f, o.flags, OPT_PC_FLAG_RANGED_AMP);
+    ret|=auto_range(o.rng, _stats.attr[PC_STATS_RNG], 0.0f, o.flags, OPT_PC_FLAG_RANGED_RNG);
     return ret;
 }
 
 int gl_pcloud_entity::rebuildRequest(void)   //rebuild VBO
 {
+    if(_evicted) return 0;  //VBO is made by restore()
+
     _vboCtx.mode=1;  //rebuild
     _vboCtx.counter=0;
     _vboCtx.remain=_nVertex;
     _vboCtx.curTop=&_vertex[0];
+
+    cancelFilter();
+    memset(&_filter,0,sizeof(_filter));   //compaction is requested again by the widget
     return 1;
 }
 
@@ -228,48 +335,45 @@ int gl_pcloud_entity::prepare_gl(void)
 {
     term_thread();
 
+    // programs are shared with other clouds and the batch, locations are taken again
+    // because a program released by all clouds may come back at the same address
+    const char *frag[2]={":/gl/gl_pcloud_entity1.frag", ":/gl/gl_pcloud_entity2.frag"};
+    for(int k=0;k<2;k++)
     {
-        std::lock_guard<std::mutex> lock(_prgMutex);
-        if(!_prg.size())
+        if(_prg[k]==nullptr)
         {
-            auto x=new QOpenGLShaderProgram;
-            if(x->addShaderFromSourceFile(QOpenGLShader::Vertex,":/gl/gl_pcloud_entity.vert"))
-            {
-                qDebug()<<"gl_pcloud_entity Vertex Shader OK";
-            }
-            if(x->addShaderFromSourceFile(QOpenGLShader::Fragment,":/gl/gl_pcloud_entity1.frag"))
-            {
-                qDebug()<<"gl_pcloud_entity Fragment Shader1 OK";
-            }
-
-            x->bindAttributeLocation("vertex", 0);
-            x->bindAttributeLocation("rgb", 1);
-            x->bindAttributeLocation("amp", 2);
-            x->bindAttributeLocation("range", 3);
-            x->bindAttributeLocation("flags", 4);
-            x->link();
-            _prg[0] = x;
-
-            auto y=new QOpenGLShaderProgram;
-            if(y->addShaderFromSourceFile(QOpenGLShader::Vertex,":/gl/gl_pcloud_entity.vert"))
-            {
-                qDebug()<<"gl_pcloud_entity Vertex Shader OK";
-            }
-            if(y->addShaderFromSourceFile(QOpenGLShader::Fragment,":/gl/gl_pcloud_entity2.frag"))
-            {
-                qDebug()<<"gl_pcloud_entity Fragment Shader2 OK";
-            }
-
-            y->bindAttributeLocation("vertex", 0);
-            y->bindAttributeLocation("rgb", 1);
-            y->bindAttributeLocation("amp", 2);
-            y->bindAttributeLocation("range", 3);
-            y->bindAttributeLocation("flags", 4);
-            y->link();
-            _prg[1] = y;
+            _prg[k]=gl_programs::acquire(":/gl/gl_pcloud_entity.vert", frag[k], QStringList()<<"vertex"<<"rgb"<<"amp"<<"range"<<"flags");
+        }
+        QOpenGLShaderProgram *z=_prg[k];
+        if(z==nullptr) continue;
+
+        pc_uniforms_t u;
+        u.mvpMatrix =z->uniformLocation("mvpMatrix");
+        u.a_range   =z->uniformLocation("a_range");
+        u.r_range   =z->uniformLocation("r_range");
+        u.z_range   =z->uniformLocation("z_range");
+        u.mode      =z->uniformLocation("mode");
+        u.pointsize =z->uniformLocation("pointsize");
+        u.fltAEnable=z->uniformLocation("fltAEnable");
+        u.fltA      =z->uniformLocation("fltA");
+        u.fltREnable=z->uniformLocation("fltREnable");
+        u.fltR      =z->uniformLocation("fltR");
+        u.fltZEnable=z->uniformLocation("fltZEnable");
+        u.fltZ      =z->uniformLocation("fltZ");
+        u.antiAlias =z->uniformLocation("antiAlias");
+        u.frame=0;
+        _uni[z]=u;
+    }
 
+    if(_batch!=nullptr)
+    {
+        if(_batch->add(this))
+        {   //own VBO is not necessary
+            _vboCtx.remain=0;
+            emitProgress(_vboCtx.total,_vboCtx.total,"VBO",true);
+            return 0;
         }
-        _prgCount++;
+        _batch=nullptr;
     }
 
     partialVBOallocation();
@@ -304,6 +408,23 @@ void gl_pcloud_entity::vbo_bind(QOpenGLBuffer &vbo,QOpenGLFunctions *f)
     }
 }
 
+// attribute setup of the chunk is recorded once, draw_gl() binds only the VAO
+void gl_pcloud_entity::vao_create(vbo_t &v)
+{
+    v.vao=new QOpenGLVertexArrayObject;
+    if(!v.vao->create())
+    {   //attributes are given at every draw
+        delete v.vao;
+        v.vao=nullptr;
+        return;
+    }
+    QOpenGLFunctions *fc = QOpenGLContext::currentContext()->functions();
+    v.vao->bind();
+    vbo_bind(v.vbo,fc);
+    v.vao->release();
+    v.vbo.release();
+}
+
 void gl_pcloud_entity::vbo_release(QOpenGLBuffer &vbo,QOpenGLFunctions *fc)
 {
     vbo.release();
@@ -317,18 +438,485 @@ void gl_pcloud_entity::vbo_release(QOpenGLBuffer &vbo,QOpenGLFunctions *fc)
 
 int gl_pcloud_entity::pertialPrepare_gl(void)
 {
+    if(_restoring)
+    {
+        if(!_restoreFuture.isFinished()) return 1;
+        finishRestore();
+    }
+
+    if(_batch!=nullptr)
+    {
+        if(_vboCtx.remain)
+        {   //rebuild request
+            _batch->update(this);
+            _vboCtx.remain=0;
+        }
+        return 0;
+    }
+
     partialVBOallocation();
     partialVBOallocation();
     partialVBOallocation();
     partialVBOallocation();
-    return _vboCtx.remain>0;
+    partialFilterUpload();
+    return _vboCtx.remain>0 || filterPending();
+}
+
+//--------------------------------------------------------------------------------
+// Filter compaction
+//   amplitude, range, height and polygon filters are evaluated on the CPU,
+//   the surviving points of each VBO chunk are drawn by an index buffer.
+//   the shader keeps filtering chunks until their index buffer is uploaded.
+//--------------------------------------------------------------------------------
+
+// branch-less loop, every point writes its index and only survivors advance k
+static quint64 filter_compaction(const GLfloat *v, quint64 n, int nElement, int amp, int rng, int flg, const pc_filter_t &f, GLuint *index)
+{
+    const GLfloat zero=0.0f;
+    const GLfloat *a= amp>0 ? v+amp : &zero;   //missing attribute reads 0 as the shader does
+    const GLfloat *r= rng>0 ? v+rng : &zero;
+    const GLfloat *g= flg>0 ? v+flg : &zero;
+    const quint64 sa= amp>0 ? nElement : 0;
+    const quint64 sr= rng>0 ? nElement : 0;
+    const quint64 sg= flg>0 ? nElement : 0;
+
+    const int fa=(f.enable & PC_FILTER_AMP)!=0;
+    const int fr=(f.enable & PC_FILTER_RNG)!=0;
+    const int fz=(f.enable & PC_FILTER_HGT)!=0;
+
+    quint64 k=0;
+    for(quint64 i=0;i<n;i++)
+    {
+        const GLfloat z=v[i*nElement+2];
+        const GLfloat ai=a[i*sa];
+        const GLfloat ri=r[i*sr];
+        int keep = ((int)g[i*sg] & 1)==0;           //polygon filter, bit0
+        keep &= !fa | ((ai>=f.amp[0]) & (ai<=f.amp[1]));
+        keep &= !fr | ((ri>=f.rng[0]) & (ri<=f.rng[1]));
+        keep &= !fz | ((z>=f.hgt[0]) & (z<=f.hgt[1]));
+        index[k]=(GLuint)i;
+        k+=keep;
+    }
+    return k;
+}
+
+void gl_pcloud_entity::cancelFilter(void)
+{
+    if(_fltFuture.isRunning())
+    {
+        _fltFuture.cancel();
+    }
+    _fltFuture.waitForFinished();
+}
+
+bool gl_pcloud_entity::filterPending(void)
+{
+    if(!_filter.enable) return false;
+    for(auto &i:_fltState)
+    {
+        if(i.load()!=2) return true;
+    }
+    return false;
+}
+
+int gl_pcloud_entity::filterRequest(gl_draw_ctx_t &draw)
+{
+    if(_vertex==nullptr || _evicted) return 0;
+
+    GLfloat z0 = _localOrigin.z();
+    const auto &famp = draw.opt_pc.flt_amp;
+    const auto &frng = draw.opt_pc.flt_rng;
+    const auto &fhgt = draw.opt_pc.flt_hgt;
+
+    pc_filter_t f;
+    memset(&f,0,sizeof(f));
+    if(famp[0]<famp[1]) { f.enable|=PC_FILTER_AMP; f.amp[0]=famp[0]; f.amp[1]=famp[1]; }
+    if(frng[0]<frng[1]) { f.enable|=PC_FILTER_RNG; f.rng[0]=frng[0]; f.rng[1]=frng[1]; }
+    if(fhgt[0]<fhgt[1]) { f.enable|=PC_FILTER_HGT; f.hgt[0]=fhgt[0]-z0; f.hgt[1]=fhgt[1]-z0; }
+
+    if(_batch!=nullptr)
+    {   //batch is filtered by the shader, the filter is kept for picking only
+        _filter=f;
+        return 0;
+    }
+
+    if(!memcmp(&f,&_filter,sizeof(f)))
+    {
+        return filterPending();
+    }
+
+    cancelFilter();
+    for(auto &i:_vvbo)
+    {
+        i.nIndex=-1;    //fall back to the shader until the new index is ready
+    }
+    _filter=f;
+
+    if(!f.enable)
+    {
+        for(auto &i:_vvbo)
+        {
+            if(i.ibo.isCreated()) i.ibo.destroy();
+        }
+        _fltRanges.clear();
+        _fltIndex.clear();
+        _fltState.clear();
+        return 0;
+    }
+
+    _fltRanges=parallel::ranges(_nVertex, VBO_CHUNK_POINTS);
+    _fltIndex.assign(_fltRanges.size(), std::vector<GLuint>());
+    _fltState=std::vector<std::atomic<int>>(_fltRanges.size());
+
+    const GLfloat *vertex=_vertex;
+    const int nElement=_nElement, amp=_amp, rng=_rng, flg=_flg;
+    _fltFuture=QtConcurrent::map(_fltRanges, [=](const parallel::range_t &r)
+    {
+        int c=(int)(r.first/VBO_CHUNK_POINTS);
+        auto &index=_fltIndex[c];
+        index.resize(r.second-r.first);
+        quint64 k=filter_compaction(vertex+r.first*nElement, r.second-r.first, nElement, amp, rng, flg, f, index.data());
+        index.resize(k);
+        _fltState[c]=1;
+    });
+
+    return 1;
+}
+
+void gl_pcloud_entity::partialFilterUpload(void)
+{
+    if(!_filter.enable) return;
+
+    int uploaded=0;
+    for(size_t c=0; c<_fltState.size() && c<(size_t)_vvbo.size(); c++)
+    {
+        if(_fltState[c].load()!=1) continue;
+
+        vbo_t &v=_vvbo[(int)c];
+        auto &index=_fltIndex[c];
+        if(!v.ibo.isCreated()) v.ibo.create();
+        if(v.ibo.bind())
+        {
+            v.ibo.allocate(index.data(), (int)(index.size()*sizeof(GLuint)));
+            v.ibo.release();
+            v.nIndex=(int)index.size();
+        }
+        std::vector<GLuint>().swap(index);
+        _fltState[c]=2;
+
+        if(++uploaded>=FILTER_UPLOAD_CHUNKS) break;
+    }
+}
+
+//--------------------------------------------------------------------------------
+// Spatial index
+//   k-d tree is built on a worker thread after decode.
+//   queries are answered on the CPU, they don't need the depth buffer.
+//--------------------------------------------------------------------------------
+
+bool gl_pcloud_entity::spatialIndexReady(void)
+{
+    return _vertex!=nullptr && _kdFuture.isFinished() && _kdtree.size()>0;
+}
+
+void gl_pcloud_entity::buildSpatialIndex(void)
+{
+    const GLfloat *vertex=_vertex;
+    const quint64 n=_nVertex;
+    const int nElement=_nElement;
+    _kdFuture=QtConcurrent::run([this,vertex,n,nElement](){ _kdtree.build(vertex,n,nElement); });
+}
+
+bool gl_pcloud_entity::modelMatrix(QMatrix4x4 &m)
+{
+    QMatrix4x4 offset;
+    if(!originOffset(offset)) return false;
+    m=offset*local;
+    return true;
+}
+
+// same decision as the shader, filtered points are not picked
+bool gl_pcloud_entity::filterAccept(quint64 index)
+{
+    const GLfloat *p=_vertex+index*_nElement;
+    if(_flg>0 && ((int)p[_flg] & 1)) return false;
+    if(_filter.enable & PC_FILTER_AMP)
+    {
+        GLfloat a= _amp>0 ? p[_amp] : 0.0f;
+        if(a<_filter.amp[0] || a>_filter.amp[1]) return false;
+    }
+    if(_filter.enable & PC_FILTER_RNG)
+    {
+        GLfloat r= _rng>0 ? p[_rng] : 0.0f;
+        if(r<_filter.rng[0] || r>_filter.rng[1]) return false;
+    }
+    if(_filter.enable & PC_FILTER_HGT)
+    {
+        if(p[2]<_filter.hgt[0] || p[2]>_filter.hgt[1]) return false;
+    }
+    return true;
+}
+
+int gl_pcloud_entity::pick(const gl_pick_ray_t &ray, QVariantMap &result)
+{
+    if(!show() || !spatialIndexReady()) return 0;
+
+    QMatrix4x4 m;
+    if(!modelMatrix(m)) return 0;
+
+    bool invertible;
+    QMatrix4x4 mi=m.inverted(&invertible);
+    if(!invertible) return 0;
+
+    QVector3D o=mi.map(ray.org);
+    QVector3D d=mi.mapVector(ray.dir).normalized();
+    float org[3]={o.x(),o.y(),o.z()};
+    float dir[3]={d.x(),d.y(),d.z()};
+
+    uint32_t index;
+    float t;
+    if(!_kdtree.ray(org, dir, ray.tol0, ray.tolSlope, index, t, [this](uint32_t i){ return filterAccept(i); }))
+    {
+        return 0;
+    }
+
+    result=pointInfo(index);
+    result["distance"]=t;
+    return 1;
+}
+
+int gl_pcloud_entity::nearestPoints(const QVector3D &p, int k, QVector<quint64> &index)
+{
+    index.clear();
+    QMatrix4x4 m;
+    if(!spatialIndexReady() || !modelMatrix(m)) return 0;
+
+    QVector3D q=m.inverted().map(p);
+    float x[3]={q.x(),q.y(),q.z()};
+    std::vector<uint32_t> ret;
+    _kdtree.nearest(x, k, ret, nullptr, [this](uint32_t i){ return filterAccept(i); });
+    for(auto i:ret) index.append(i);
+    return index.size();
+}
+
+int gl_pcloud_entity::radiusPoints(const QVector3D &p, float r, QVector<quint64> &index)
+{
+    index.clear();
+    QMatrix4x4 m;
+    if(!spatialIndexReady() || !modelMatrix(m)) return 0;
+
+    QVector3D q=m.inverted().map(p);
+    float x[3]={q.x(),q.y(),q.z()};
+    std::vector<uint32_t> ret;
+    _kdtree.radius(x, r, ret, [this](uint32_t i){ return filterAccept(i); });
+    for(auto i:ret) index.append(i);
+    return index.size();
+}
+
+// world coordinate and attributes of a point
+QVariantMap gl_pcloud_entity::pointInfo(quint64 index)
+{
+    QVariantMap ret;
+    QMatrix4x4 m;
+    if(_vertex==nullptr || index>=_nVertex || !modelMatrix(m)) return ret;
+
+    const GLfloat *p=_vertex+index*_nElement;
+    QVector3D w=m.map(QVector3D(p[0],p[1],p[2]));
+    ret["x"]=w.x();
+    ret["y"]=w.y();
+    ret["z"]=w.z();
+    ret["index"]=index;
+    if(_amp>0) ret["amplitude"]=p[_amp];
+    if(_rng>0) ret["range"]=p[_rng];
+    ret["entity"]=getCaption();
+    ret["id"]=uniqueId();
+    return ret;
+}
+
+//--------------------------------------------------------------------------------
+// Memory budget
+//   GPU eviction drops VBOs (or the range in the batch),
+//   CPU eviction writes the vertex to a temporary file on a worker thread,
+//   finishSpill() drops it with the spatial index on the GUI thread when the write is done.
+//   restore() reads it back on a worker thread, pertialPrepare_gl() makes VBOs again.
+//--------------------------------------------------------------------------------
+
+quint64 gl_pcloud_entity::gpuBytes(void)
+{
+    if(_evicted & ENTITY_EVICT_GPU) return 0;
+    if(_batch!=nullptr) return _batch->gpuBytes(this);
+
+    quint64 ret=0;
+    for(const auto &v:_vvbo)
+    {
+        ret+=(quint64)v.n*_nElement*sizeof(GLfloat);
+        if(v.nIndex>0) ret+=(quint64)v.nIndex*sizeof(GLuint);
+    }
+    return ret;
+}
+
+quint64 gl_pcloud_entity::cpuBytes(void)
+{
+    if(_vertex==nullptr) return 0;
+    quint64 ret=_nVertex*_nElement*sizeof(GLfloat);
+    if(_kdFuture.isFinished()) ret+=_kdtree.bytes();
+    return ret;
+}
+
+void gl_pcloud_entity::spill(void)
+{
+    if(_spill==nullptr)
+    {
+        _spill=new QTemporaryFile(QDir::tempPath()+"/calv_XXXXXX.pc");
+    }
+
+    QTemporaryFile *f=_spill;
+    const GLfloat *v=_vertex;
+    qint64 bytes=(qint64)(_nVertex*_nElement*sizeof(GLfloat));
+    QFuture<void> kd=_kdFuture;
+    _spilling=1;
+    _spillFuture=QtConcurrent::run([f,v,bytes,kd]()
+    {
+        QFuture<void>(kd).waitForFinished();   //the spatial index is dropped with the vertex
+        if(!f->isOpen() && !f->open()) return false;
+        if(!f->seek(0) || f->write((const char*)v, bytes)!=bytes) return false;
+        return f->flush();
+    });
+
+    // the entity may belong to the finished load thread, the watcher is made on this (GUI) thread
+    _spillWatcher=new QFutureWatcher<bool>;
+    QObject::connect(_spillWatcher, &QFutureWatcher<bool>::finished, _spillWatcher, [this]()
+    {
+        _spillWatcher->deleteLater();
+        _spillWatcher=nullptr;
+        finishSpill();
+    });
+    _spillWatcher->setFuture(_spillFuture);
+}
+
+void gl_pcloud_entity::finishSpill(void)
+{
+    int shown=(_spilling==2);
+    _spilling=0;
+
+    if(!_spillFuture.result())
+    {
+        qDebug()<<"gl_pcloud_entity::spill error";
+        return;
+    }
+    if(shown) return;   //restore() is using the CPU copy
+
+    _kdtree.clear();
+    delete [] _vertex;
+    _vertex=nullptr;
+    _evicted|=ENTITY_EVICT_CPU;
+}
+
+int gl_pcloud_entity::evict(int what)
+{
+    if(_restoring || _spilling) return 0;
+
+    if(what & ENTITY_EVICT_CPU) what|=ENTITY_EVICT_GPU;
+
+    int ret=0;
+    if((what & ENTITY_EVICT_GPU) && !(_evicted & ENTITY_EVICT_GPU))
+    {
+        cancelFilter();
+        memset(&_filter,0,sizeof(_filter));
+        _fltRanges.clear();
+        _fltIndex.clear();
+        _fltState.clear();
+
+        if(_batch!=nullptr)
+        {   //keep _batch to come back
+            _batch->remove(this);
+        }
+        for(auto &v:_vvbo)
+        {
+            if(v.vao!=nullptr) delete v.vao;
+            v.vbo.destroy();
+            if(v.ibo.isCreated()) v.ibo.destroy();
+        }
+        _vvbo.clear();
+        _vboCtx.remain=0;
+
+        _evicted|=ENTITY_EVICT_GPU;
+        ret|=ENTITY_EVICT_GPU;
+    }
+
+    if((what & ENTITY_EVICT_CPU) && !(_evicted & ENTITY_EVICT_CPU) && _vertex!=nullptr)
+    {
+        spill();    //CPU copy is dropped by finishSpill() after the write
+        ret|=ENTITY_EVICT_CPU;
+    }
+    return ret;
+}
+
+int gl_pcloud_entity::restore(void)
+{
+    if(!_evicted) return 0;
+    if(_restoring) return 1;
+
+    if(_spilling) _spilling=2;  //shown again while writing, the CPU copy is kept
+    _restoring=1;
+    if(_evicted & ENTITY_EVICT_CPU)
+    {
+        QTemporaryFile *f=_spill;
+        quint64 n=_nVertex*_nElement;
+        _restoreFuture=QtConcurrent::run([f,n]()
+        {
+            GLfloat *v=new GLfloat[n];
+            qint64 bytes=(qint64)(n*sizeof(GLfloat));
+            if(!f->seek(0) || f->read((char*)v, bytes)!=bytes)
+            {
+                delete [] v;
+                v=nullptr;
+            }
+            return v;
+        });
+    }
+    return 1;
+}
+
+void gl_pcloud_entity::finishRestore(void)
+{
+    _restoring=0;
+
+    if(_evicted & ENTITY_EVICT_CPU)
+    {
+        GLfloat *v=_restoreFuture.result();
+        if(v==nullptr)
+        {
+            qDebug()<<"gl_pcloud_entity::restore error";
+            return;
+        }
+        _vertex=v;
+        buildSpatialIndex();
+        _evicted&=~ENTITY_EVICT_CPU;
+    }
+
+    if(_evicted & ENTITY_EVICT_GPU)
+    {
+        _evicted&=~ENTITY_EVICT_GPU;
+        if(_batch!=nullptr)
+        {
+            if(_batch->add(this)) return;
+            _batch=nullptr;
+        }
+        _vboCtx.total=_nVertex;
+        _vboCtx.remain=_nVertex;
+        _vboCtx.vertex=&_vertex[0];
+        _vboCtx.curTop=&_vertex[0];
+        _vboCtx.mode=0;
+        _vboCtx.counter=0;
+    }
 }
 
 void gl_pcloud_entity::partialVBOallocation(void)
 {    
     if(_vboCtx.remain)
     {
-        quint64 m=0x1ffff;
+        quint64 m=VBO_CHUNK_POINTS;
         //quint64 m=MAX_VBO_SIZE;//0x1ffff;
         quint64 remain=_vboCtx.remain;
         GLfloat *p=_vboCtx.curTop;
@@ -339,6 +927,9 @@ void gl_pcloud_entity::partialVBOallocation(void)
         {   //create
             vbo=new vbo_t;
             vbo->vbo.create();
+            vbo->vao=nullptr;
+            vbo->ibo=QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+            vbo->nIndex=-1;
         }
         else
         {   //update
@@ -368,12 +959,18 @@ void gl_pcloud_entity::partialVBOallocation(void)
         p+=n*_nElement;
         vbo->n=n;
 
+        if(_vboCtx.mode==0)
+        {
+            vao_create(*vbo);
+        }
+
         _vboCtx.remain=remain;
         _vboCtx.curTop=p;
 
         if(_vboCtx.mode==0)
         {
             _vvbo.push_back(*vbo);
+            delete vbo;
         }
 
         if(remain)
@@ -394,12 +991,15 @@ void gl_pcloud_entity::partialVBOallocation(void)
 void gl_pcloud_entity::draw_gl(gl_draw_ctx_t &draw)
 {
     if(!show()) return;
+    if(_batch!=nullptr) return;     //drawn by gl_pcloud_batch
 
     QMatrix4x4 offset;
     if(!originOffset(offset)) return;
 
 
-    QOpenGLShaderProgram *p=draw.pointAntiAlias?_prg[0]:_prg[1];
+    int k=draw.pointAntiAlias?0:1;
+    QOpenGLShaderProgram *p=_prg[k];
+    pc_uniforms_t &u=_uni[p];
     GLfloat psz;
     quint64 n=_nVertex,m;
     int mode;
@@ -435,41 +1035,66 @@ void gl_pcloud_entity::draw_gl(gl_draw_ctx_t &draw)
 
         if(draw.pointAntiAlias) fc->glEnable(GL_POINT_SPRITE);
 
-        p->setUniformValue("mvpMatrix", modelViewProj);
+        p->setUniformValue(u.mvpMatrix, modelViewProj);
 
-        const auto &amp = draw.opt_pc.amp;
-        const auto &rng = draw.opt_pc.rng;
         const auto &hgt = draw.opt_pc.hgt;
-        p->setUniformValue("a_range", QVector3D(amp[0], amp[1], amp[1]-amp[0]));
-        p->setUniformValue("r_range", QVector3D(rng[0], rng[1], rng[1]-rng[0]));
-        p->setUniformValue("z_range", QVector3D(hgt[0]-z0, hgt[1]-z0, hgt[1]-hgt[0]));
-        p->setUniformValue("mode", (int)mode);
-        p->setUniformValue("pointsize", psz);
-
-        const auto &famp = draw.opt_pc.flt_amp;
-        const auto &frng = draw.opt_pc.flt_rng;
         const auto &fhgt = draw.opt_pc.flt_hgt;
+        p->setUniformValue(u.z_range, QVector3D(hgt[0]-z0, hgt[1]-z0, hgt[1]-hgt[0]));
+        p->setUniformValue(u.fltZ, QVector2D(fhgt[0]-z0, fhgt[1]-z0));
 
-        p->setUniformValue("fltAEnable", (int)(famp[0]<famp[1]));
-        p->setUniformValue("fltA", QVector2D(famp[0], famp[1]));
+        if(u.frame!=draw.frame)
+        {   //same for all clouds in this pass, program keeps them
+            u.frame=draw.frame;
 
-        p->setUniformValue("fltREnable", (int)(frng[0]<frng[1]));
-        p->setUniformValue("fltR", QVector2D(frng[0], frng[1]));
+            const auto &amp = draw.opt_pc.amp;
+            const auto &rng = draw.opt_pc.rng;
+            p->setUniformValue(u.a_range, QVector3D(amp[0], amp[1], amp[1]-amp[0]));
+            p->setUniformValue(u.r_range, QVector3D(rng[0], rng[1], rng[1]-rng[0]));
+            p->setUniformValue(u.mode, (int)mode);
+            p->setUniformValue(u.pointsize, psz);
 
-        p->setUniformValue("fltZEnable", (int)(fhgt[0]<fhgt[1]));
-        p->setUniformValue("fltZ",QVector2D(fhgt[0]-z0, fhgt[1]-z0));
+            const auto &famp = draw.opt_pc.flt_amp;
+            const auto &frng = draw.opt_pc.flt_rng;
 
-        p->setUniformValue("antiAlias", (int)draw.pointAntiAlias);
+            p->setUniformValue(u.fltAEnable, (int)(famp[0]<famp[1]));
+            p->setUniformValue(u.fltA, QVector2D(famp[0], famp[1]));
 
-        for(vvbo_t::iterator i=_vvbo.begin(); i!=_vvbo.end(); i++)
+            p->setUniformValue(u.fltREnable, (int)(frng[0]<frng[1]));
+            p->setUniformValue(u.fltR, QVector2D(frng[0], frng[1]));
+
+            p->setUniformValue(u.fltZEnable, (int)(fhgt[0]<fhgt[1]));
+
+            p->setUniformValue(u.antiAlias, (int)draw.pointAntiAlias);
+        }
+
+        bool sliced = draw.passes>1 && draw.mode!=GL_DRAW_PICK;
+        int c=0;
+        for(vvbo_t::iterator i=_vvbo.begin(); i!=_vvbo.end(); i++, c++)
         {
             m=n;
             if(i->n<m) m=i->n;
 
-            vbo_bind(i->vbo,fc);
-            fc->glDrawArrays(GL_POINTS, 0,m);
+            if(sliced && (c % draw.passes)!=draw.pass)
+            {   //drawn by another pass
+                n=n-m;
+                continue;
+            }
+
+            if(i->vao!=nullptr) i->vao->bind();
+            else                vbo_bind(i->vbo,fc);
+            if(i->nIndex>=0)
+            {   //filtered on CPU
+                i->ibo.bind();
+                fc->glDrawElements(GL_POINTS, (GLsizei)qMin((quint64)i->nIndex,m), GL_UNSIGNED_INT, 0);
+                i->ibo.release();
+            }
+            else
+            {
+                fc->glDrawArrays(GL_POINTS, 0,m);
+            }
             //qDebug()<< "glDrawArrays "<<i->n<<m;
-            vbo_release(i->vbo,fc);
+            if(i->vao!=nullptr) i->vao->release();
+            else                vbo_release(i->vbo,fc);
 
             n=n-m;
         }
@@ -482,3 +1107,18 @@ void gl_pcloud_entity::draw_gl(gl_draw_ctx_t &draw)
     }
 
 }
+
+// own VBOs are drawn chunk by chunk over the passes, the batch draws everything at once
+quint64 gl_pcloud_entity::progressivePoints(void)
+{
+    if(_batch!=nullptr || _evicted) return 0;
+    return _nVertex;
+}
+
+// programs are shared by all clouds, vertex format is given by the attributes in the VBO
+quint64 gl_pcloud_entity::renderKey(void)
+{
+    QOpenGLShaderProgram *p=_prg[0];
+    quint32 format=(_nElement<<4)|((_rgb>0)<<3)|((_amp>0)<<2)|((_rng>0)<<1)|(_flg>0);
+    return RENDER_KEY(p!=nullptr ? p->programId() : 0, format);
+}
@@ -12,18 +12,41 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 */
 
 #include "gl_entity_ctx.h"
+#include "parallel.h"
+#include "kdtree.h"
+#include "pc_stats.h"
 
 #include <mutex>
+#include <atomic>
+#include <vector>
 
 #include <QVector>
 #include <QMap>
+#include <QFuture>
+#include <QFutureWatcher>
+#include <QTemporaryFile>
 
 typedef struct
 {
     QOpenGLBuffer vbo;
+    QOpenGLVertexArrayObject *vao;  //attributes of vbo, nullptr when VAO is not supported
     int n;
+    QOpenGLBuffer ibo;  //index of the points which survive the filter
+    int nIndex;         //-1: no index buffer, draw all points
 } vbo_t;
 
+typedef struct
+{
+    int enable;         //PC_FILTER_xxx
+    float amp[2];
+    float rng[2];
+    float hgt[2];       //local coordinate
+} pc_filter_t;
+
+#define PC_FILTER_AMP 1
+#define PC_FILTER_RNG 2
+#define PC_FILTER_HGT 4
+
 typedef struct
 {
     quint64 total;
@@ -38,9 +61,30 @@ typedef struct
 
 typedef QVector<vbo_t> vvbo_t;
 
+typedef struct
+{
+    int mvpMatrix;
+    int a_range;
+    int r_range;
+    int z_range;
+    int mode;
+    int pointsize;
+    int fltAEnable;
+    int fltA;
+    int fltREnable;
+    int fltR;
+    int fltZEnable;
+    int fltZ;
+    int antiAlias;
+    quint64 frame;      //uniforms common to all clouds are set in this pass
+} pc_uniforms_t;
+
+class gl_pcloud_batch;
+
 class gl_pcloud_entity : public gl_entity_ctx
 {
     Q_OBJECT
+    friend class gl_pcloud_batch;
 public:
 
     explicit gl_pcloud_entity(QObject *parent = 0);
@@ -57,9 +101,29 @@ public:
     virtual void draw_gl(gl_draw_ctx_t &draw);
     virtual int update_draw_gl(gl_draw_ctx_t &draw);
     virtual int rebuildRequest(void);   //rebuild VBO
+    virtual int filterRequest(gl_draw_ctx_t &draw);
 
     virtual QVector3D getCenter(void);
 
+    virtual int pick(const gl_pick_ray_t &ray, QVariantMap &result);
+    int nearestPoints(const QVector3D &p, int k, QVector<quint64> &index);    //world coordinate
+    int radiusPoints(const QVector3D &p, float r, QVector<quint64> &index);   //world coordinate
+    QVariantMap pointInfo(quint64 index);
+    const pc_stats_t &statistics(void) {return _stats;}
+
+    void setBatch(gl_pcloud_batch *batch) {_batch=batch;}   //give it before prepare_gl()
+    bool isBatched(void) {return _batch!=nullptr;}
+
+    virtual quint64 progressivePoints(void);
+    virtual quint64 renderKey(void);
+    virtual quint64 gpuBytes(void);
+    virtual quint64 cpuBytes(void);
+    virtual bool isEvictable(void) {return true;}
+    virtual int evict(int what);
+    virtual int evicted(void) {return _evicted;}
+    virtual bool evicting(void) {return _spilling!=0;}
+    virtual int restore(void);
+
     virtual int prepare_gl(void);  //called by opengl gui thread
     virtual int pertialPrepare_gl(void);
     virtual bool isUnloadable(void) {return true;}
@@ -76,11 +140,21 @@ protected:
 
 private:
     void partialVBOallocation(void);
+    void vao_create(vbo_t &v);
+    void partialFilterUpload(void);
+    void cancelFilter(void);
+    bool filterPending(void);
+    bool filterAccept(quint64 index);
+    bool modelMatrix(QMatrix4x4 &m);
+    bool spatialIndexReady(void);
+    void buildSpatialIndex(void);
+    void spill(void);
+    void finishSpill(void);
+    void finishRestore(void);
 
 private:
-    static std::mutex _prgMutex;
-    static int _prgCount;
-    static QMap<int, QOpenGLShaderProgram*> _prg;
+    QOpenGLShaderProgram *_prg[2];              //0: anti-aliasing, 1: no anti-aliasing, shared by gl_programs
+    static QMap<QOpenGLShaderProgram*, pc_uniforms_t> _uni;    //locations for each program
 
     vvbo_t _vvbo;
     vbo_ctx_t _vboCtx;
@@ -95,6 +169,27 @@ private:
     int _rng;
     int _flg;
 
+    pc_filter_t _filter;                        //filter of the index buffers, also used by picking
+    QFuture<void> _fltFuture;                   //compaction pass on worker threads
+    QVector<parallel::range_t> _fltRanges;      //one range for each VBO chunk
+    std::vector<std::vector<GLuint>> _fltIndex; //compaction result for each chunk
+    std::vector<std::atomic<int>> _fltState;    //0: running, 1: ready, 2: uploaded
+
+    kdtree _kdtree;                             //spatial index for picking and neighbour search
+    QFuture<void> _kdFuture;                    //built on worker thread after decode
+
+    pc_stats_t _stats;                          //computed while decoding
+
+    gl_pcloud_batch *_batch;                    //drawn by the batch instead of own VBO
+
+    int _evicted;                               //ENTITY_EVICT_xxx
+    int _restoring;
+    QTemporaryFile *_spill;                     //vertex while CPU copy is evicted
+    int _spilling;                              //1: _spill is written by worker thread, 2: shown again while writing
+    QFuture<bool> _spillFuture;                 //vertex written to _spill
+    QFutureWatcher<bool> *_spillWatcher;        //finishes the spill on the GUI thread
+    QFuture<GLfloat*> _restoreFuture;           //vertex read back from _spill
+    int _statsApplied;                          //ranges are given to gl_draw_ctx_t
 };
 
 #endif // GL_PCLOUD_ENTITY_H
@@ -9,49 +9,71 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 */
 
 #include "gl_polyline_entity.h"
+#include "gl_programs.h"
 
 #include <cmath>
+#include <cstring>
+#include <vector>
 
 #include <QOpenGLShaderProgram>
+#include <QOpenGLFunctions_2_1>
+#include <QtConcurrent>
 #include <QFileInfo>
 #include <QThread>
 
+#define PL_BLOCK_VERTICES (1<<16)       //vertices of a VBO block, a run never crosses blocks
+#define PL_SEGMENT_VERTICES (1024)      //vertices of a segment
+#define PL_LOD_ERROR (1.0f/256.0f)      //tolerance of the first simplified level to the segment radius, x4 every level
+#define PL_LOD_PIXELS (256.0f)          //radius on the screen [pixel] drawn at full detail, /4 every level, about 1 pixel error
 
 gl_polyline_entity::gl_polyline_entity(QObject *parent):gl_entity_ctx(parent)
 {
     setObjectName("polyline");
     _prg=nullptr;
+    _written=0;
+    _open=false;
+    _nVertex=0;
     valid=0;
 }
 
 gl_polyline_entity::~gl_polyline_entity()
 {
-
+    cleanup();
 }
 
-
-int gl_polyline_entity::load_mem(const uint8_t *buf, size_t length)
+void gl_polyline_entity::cleanup(void)
 {
-    //
-    // Example code, have to re-implement for each application
-    //
-
-    int ret=0;
-
-    double r=20.0;
-    for(int i=0;i<360;i++)
+    _lodFuture.waitForFinished();
+    for(auto &b:_blocks)
     {
-        double x = r*std::sin(i * M_PI/180.0);
-        double y = r*std::cos(i * M_PI/180.0);
-        double z = 1.0*std::sin(10.0*i * M_PI/180.0);
-        QVector3D v(x,y,z);
-        _vertices.append(v);
-        ret++;
+        if(b.vao!=nullptr) delete b.vao;
+        b.vbo.destroy();
     }
-    _chunks.append(ret/2);
-    _chunks.append(ret/2);
+    _blocks.clear();
+    gl_programs::release(_prg);
+    _prg=nullptr;
+}
 
-    return ret;
+void gl_polyline_entity::append(const QVector3D *v, int n)
+{
+    QMutexLocker lock(&_mtx);
+    for(int i=0;i<n;i++) _pending.append(v[i]);
+}
+
+void gl_polyline_entity::endStrip(void)
+{
+    const QVector3D x(NAN,NAN,NAN);
+    append(&x,1);
+}
+
+// packed float x,y,z per vertex, a NaN vertex ends the strip. re-implement for other formats
+int gl_polyline_entity::load_mem(const uint8_t *buf, size_t length)
+{
+    size_t n=length/(3*sizeof(float));
+    QVector<QVector3D> v((int)n);
+    memcpy((void*)v.data(),buf,n*3*sizeof(float));
+    append(v.constData(),v.size());
+    return (int)n;
 }
 
 void gl_polyline_entity::load(void)
@@ -83,15 +105,11 @@ void gl_polyline_entity::load(void)
         qDebug()<<"gl_polyline_entity::load error";
     }
 
-    if(r)
-    {
-        valid= _chunks.size()>0;
-    }
+    valid= r>0;
 
     emit done(this);
 }
 
-
 static const char *get_vertex_shader(void)
 {
     static const char *vertexShaderSource =
@@ -127,30 +145,301 @@ static const char *get_fragment_shader(void)
 
 int gl_polyline_entity::prepare_gl(void)
 {
-    //term_thread();
+    if(_prg==nullptr)
+    {
+        _prg = gl_programs::acquire(get_vertex_shader(), get_fragment_shader(), QStringList()<<"pos");
+        if(_prg==nullptr) return 0;
+        _prg->bind();
 
-    _prg = new QOpenGLShaderProgram;
+        _mvpLoc =_prg->uniformLocation("mvpMatrix");
+        _modeLoc=_prg->uniformLocation("mode");
 
-    _prg->addShaderFromSourceCode(QOpenGLShader::Vertex,  get_vertex_shader() );
-    _prg->addShaderFromSourceCode(QOpenGLShader::Fragment,get_fragment_shader() );
+        _prg->release();
+    }
 
-    _prg->bindAttributeLocation("pos", 0);
+    return pertialPrepare_gl();
+}
 
-    _prg->link();
-    _prg->bind();
+int gl_polyline_entity::rebuildRequest(void)
+{
+    QMutexLocker lock(&_mtx);
+    return _pending.isEmpty() ? 0 : 1;
+}
+
+// Douglas-Peucker by the distance to the chord, both ends are kept
+static void douglas_peucker(const QVector3D *v, int n, float eps, std::vector<uint8_t> &keep)
+{
+    keep.assign(n,0);
+    if(n<=0) return;
+    keep[0]=keep[n-1]=1;
+
+    const float eps2=eps*eps;
+    std::vector<std::pair<int,int>> stack;
+    stack.push_back(std::make_pair(0,n-1));
+    while(!stack.empty())
+    {
+        int a=stack.back().first;
+        int b=stack.back().second;
+        stack.pop_back();
+        if(b-a<2) continue;
+
+        QVector3D d=v[b]-v[a];
+        float len2=QVector3D::dotProduct(d,d);
+        float dmax=eps2;
+        int k=-1;
+        for(int i=a+1;i<b;i++)
+        {
+            QVector3D x=v[i]-v[a];
+            if(len2>0.0f) x-=d*qBound(0.0f,QVector3D::dotProduct(x,d)/len2,1.0f);    //track may turn back
+            float dist2=x.lengthSquared();
+            if(dist2>dmax)
+            {
+                dmax=dist2;
+                k=i;
+            }
+        }
+        if(k<0) continue;
+        keep[k]=1;
+        stack.push_back(std::make_pair(a,k));
+        stack.push_back(std::make_pair(k,b));
+    }
+}
 
-    _prg->release();
+// levels are appended after the full detail, a level which removes nothing is left empty
+static void polyline_simplify(pl_simplify_t &x)
+{
+    const int n=x.count[0];
+    QVector3D bmin=x.vertices[0];
+    QVector3D bmax=x.vertices[0];
+    for(int i=1;i<n;i++)
+    {
+        const QVector3D &p=x.vertices[i];
+        bmin=QVector3D(qMin(bmin.x(),p.x()),qMin(bmin.y(),p.y()),qMin(bmin.z(),p.z()));
+        bmax=QVector3D(qMax(bmax.x(),p.x()),qMax(bmax.y(),p.y()),qMax(bmax.z(),p.z()));
+    }
+    float eps=(bmax-bmin).length()*0.5f*PL_LOD_ERROR;
 
-    if(_vbo.create())
+    std::vector<uint8_t> keep;
+    int last=n;
+    for(int l=1;l<PL_LEVELS;l++,eps*=4.0f)
     {
-        if(_vbo.bind())
+        x.count[l]=0;
+        douglas_peucker(x.vertices.constData(),n,eps,keep);
+        int kept=0;
+        for(int i=0;i<n;i++) kept+=keep[i];
+        if(kept>=last) continue;
+
+        x.vertices.reserve(x.vertices.size()+kept);
+        for(int i=0;i<n;i++)
         {
-            _vbo.allocate((const void *)_vertices.constData(), _vertices.size()*sizeof(GLfloat)*3);
-            _vbo.release();
+            if(!keep[i]) continue;
+            QVector3D p=x.vertices[i];
+            x.vertices.append(p);
         }
+        x.count[l]=kept;
+        last=kept;
+    }
+}
+
+// pending vertices and built levels are uploaded, 1 while the worker has segments
+// ENTITY_PREPARE_REDRAW is added when they're uploaded so the new tail is drawn while it's busy
+int gl_polyline_entity::pertialPrepare_gl(void)
+{
+    if(_prg==nullptr) return 0;
+
+    bool busy=!_lodFuture.isFinished();     //results of a finished job are in _simplified
+    bool uploaded=upload_pending();
+    uploaded|=upload_levels();
+    if(!busy && !_complete.isEmpty())
+    {
+        QVector<pl_simplify_t> x;
+        x.swap(_complete);
+        _lodFuture=QtConcurrent::run([this,x]() mutable
+        {
+            for(auto &s:x) polyline_simplify(s);
+            QMutexLocker lock(&_mtx);
+            _simplified+=x;
+        });
+        busy=true;
+    }
+    return (busy ? 1 : 0) | (uploaded ? ENTITY_PREPARE_REDRAW : 0);
+}
+
+bool gl_polyline_entity::upload_pending(void)
+{
+    QVector<QVector3D> v;
+    {
+        QMutexLocker lock(&_mtx);
+        v.swap(_pending);
     }
+    if(v.isEmpty()) return false;
+
+    for(const auto &p:v)
+    {
+        if(std::isnan(p.x()))
+        {
+            segment_end();
+            continue;
+        }
+        if(!_open)
+        {
+            segment_begin();
+        }
+        else if(_tail.size()==PL_SEGMENT_VERTICES)
+        {   //next segment starts at the end of this one
+            QVector3D last=_tail.last();
+            segment_end();
+            segment_begin();
+            _tail.append(last);
+        }
+        _tail.append(p);
 
-    return 0;
+        if(_nVertex++==0)
+        {
+            _bmin=p;
+            _bmax=p;
+        }
+        _bmin=QVector3D(qMin(_bmin.x(),p.x()),qMin(_bmin.y(),p.y()),qMin(_bmin.z(),p.z()));
+        _bmax=QVector3D(qMax(_bmax.x(),p.x()),qMax(_bmax.y(),p.y()),qMax(_bmax.z(),p.z()));
+    }
+    segment_flush();
+    setBounding(_bmin,_bmax);
+    return true;
+}
+
+bool gl_polyline_entity::upload_levels(void)
+{
+    QVector<pl_simplify_t> x;
+    {
+        QMutexLocker lock(&_mtx);
+        x.swap(_simplified);
+    }
+    for(const auto &s:x)
+    {
+        int top=s.count[0];
+        for(int l=1;l<PL_LEVELS;l++)
+        {
+            if(s.count[l]==0) continue;
+            pl_run_t r=allocate(s.count[l]);
+            write(r,0,s.vertices.constData()+top,s.count[l]);
+            _segments[s.segment].run[l]=r;
+            top+=s.count[l];
+        }
+    }
+    return !x.isEmpty();
+}
+
+// room of a full segment is taken, the end of the strip gives back the rest when it's still the last run
+void gl_polyline_entity::segment_begin(void)
+{
+    pl_segment_t s;
+    for(int l=0;l<PL_LEVELS;l++)
+    {
+        s.run[l].block=0;
+        s.run[l].first=0;
+        s.run[l].count=0;
+    }
+    s.run[0]=allocate(PL_SEGMENT_VERTICES);
+    s.run[0].count=0;
+    s.radius=0.0f;
+    _segments.append(s);
+
+    _tail.clear();
+    _written=0;
+    _open=true;
+}
+
+// vertices after _written are written to the VBO
+void gl_polyline_entity::segment_flush(void)
+{
+    if(!_open || _written==_tail.size()) return;
+
+    pl_segment_t &s=_segments.last();
+    write(s.run[0],_written,_tail.constData()+_written,_tail.size()-_written);
+    _written=_tail.size();
+    s.run[0].count=_written;
+
+    QVector3D bmin=_tail[0];
+    QVector3D bmax=_tail[0];
+    for(const auto &p:_tail)
+    {
+        bmin=QVector3D(qMin(bmin.x(),p.x()),qMin(bmin.y(),p.y()),qMin(bmin.z(),p.z()));
+        bmax=QVector3D(qMax(bmax.x(),p.x()),qMax(bmax.y(),p.y()),qMax(bmax.z(),p.z()));
+    }
+    s.center=(bmin+bmax)*0.5f;
+    s.radius=(bmax-bmin).length()*0.5f;
+}
+
+// full detail is given to the worker, only the open segment is kept on the CPU
+void gl_polyline_entity::segment_end(void)
+{
+    if(!_open) return;
+    segment_flush();
+
+    pl_segment_t &s=_segments.last();
+    pl_block_t &b=_blocks[s.run[0].block];
+    if(b.used==s.run[0].first+PL_SEGMENT_VERTICES) b.used=s.run[0].first+s.run[0].count;
+
+    if(_tail.size()>2)
+    {
+        pl_simplify_t x;
+        x.segment=_segments.size()-1;
+        x.vertices=_tail;
+        x.count[0]=_tail.size();
+        for(int l=1;l<PL_LEVELS;l++) x.count[l]=0;
+        _complete.append(x);
+    }
+    _tail.clear();
+    _written=0;
+    _open=false;
+}
+
+// blocks are only added, a written run is never uploaded again
+pl_run_t gl_polyline_entity::allocate(GLsizei count)
+{
+    if(_blocks.isEmpty() || _blocks.last().used+count>PL_BLOCK_VERTICES)
+    {
+        pl_block_t b;
+        b.vbo=QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+        b.vao=nullptr;
+        b.used=0;
+        if(b.vbo.create() && b.vbo.bind())
+        {
+            b.vbo.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+            b.vbo.allocate(PL_BLOCK_VERTICES*3*sizeof(GLfloat));
+            b.vbo.release();
+
+            b.vao=new QOpenGLVertexArrayObject;
+            if(b.vao->create())
+            {   //attribute setup is recorded once
+                b.vao->bind();
+                vbo_bind(b.vbo,QOpenGLContext::currentContext()->functions());
+                b.vao->release();
+                b.vbo.release();
+            }
+            else
+            {
+                delete b.vao;
+                b.vao=nullptr;
+            }
+        }
+        _blocks.append(b);
+    }
+
+    pl_run_t r;
+    r.block=_blocks.size()-1;
+    r.first=_blocks.last().used;
+    r.count=count;
+    _blocks.last().used+=count;
+    return r;
+}
+
+void gl_polyline_entity::write(const pl_run_t &run, GLsizei offset, const QVector3D *v, GLsizei n)
+{
+    QOpenGLBuffer &vbo=_blocks[run.block].vbo;
+    if(n<=0 || !vbo.bind()) return;
+    vbo.write((int)((run.first+offset)*3*sizeof(GLfloat)), v, (int)(n*3*sizeof(GLfloat)));
+    vbo.release();
 }
 
 void gl_polyline_entity::vbo_bind(QOpenGLBuffer &vbo,QOpenGLFunctions *fc)
@@ -172,6 +461,16 @@ void gl_polyline_entity::vbo_release(QOpenGLBuffer &vbo,QOpenGLFunctions *fc)
     fc->glDisableVertexAttribArray(0);
 }
 
+int gl_polyline_entity::lodLevel(float pixels)
+{
+    int level=0;
+    for(float x=PL_LOD_PIXELS;level<PL_LEVELS-1 && pixels<x;x/=4.0f)
+    {
+        level++;
+    }
+    return level;
+}
+
 void gl_polyline_entity::draw_gl(gl_draw_ctx_t &draw)
 {
     if(!show()) return;
@@ -179,7 +478,6 @@ void gl_polyline_entity::draw_gl(gl_draw_ctx_t &draw)
     QMatrix4x4 offset;
     if(!originOffset(offset)) return;
 
-    quint64 n=_vertices.size();
     int mode=0;
 
     if(draw.mode==GL_DRAW_TEMP)
@@ -192,30 +490,77 @@ void gl_polyline_entity::draw_gl(gl_draw_ctx_t &draw)
     }
 
     QOpenGLShaderProgram *p=_prg;
+    if(p==nullptr || _segments.isEmpty()) return;
+
+    QMatrix4x4 modelviewProj=draw.proj * draw.camera * draw.world * offset * local;
 
-    if(p)
+    // draw list of each block, a segment is drawn at the level of its radius on the screen
+    _first.resize(_blocks.size());
+    _count.resize(_blocks.size());
+    for(int i=0;i<_blocks.size();i++)
     {
-        QOpenGLFunctions *fc = QOpenGLContext::currentContext()->functions();
+        _first[i].clear();
+        _count[i].clear();
+    }
+    const float f=draw.proj(1,1)*draw.height*0.5f;     //radius on the screen [pixel] is r*f/w
+    for(const auto &s:_segments)
+    {
+        int level=0;
+        float w=(modelviewProj*QVector4D(s.center,1.0f)).w();
+        if(w>s.radius) level=lodLevel(s.radius*f/w);    //camera in the segment draws it at full detail
+        while(level>0 && s.run[level].count==0) level--;
+
+        const pl_run_t &r=s.run[level];
+        if(r.count<2) continue;
+        _first[r.block].append(r.first);
+        _count[r.block].append(r.count);
+    }
 
-//        if(draw.mode!=GL_DRAW_NORMAL) fc->glDisable(GL_DEPTH_TEST);
+    QOpenGLContext *ctx=QOpenGLContext::currentContext();
+    QOpenGLFunctions *fc=ctx->functions();
+    QOpenGLFunctions_2_1 *f21=ctx->versionFunctions<QOpenGLFunctions_2_1>();
 
-        QMatrix4x4 modelviewProj=draw.proj * draw.camera * draw.world * offset * local;
-        p->bind();
-        vbo_bind(_vbo,fc);
-        p->setUniformValue("mvpMatrix", modelviewProj);
-        p->setUniformValue("mode", mode);
-        fc->glLineWidth(1.0f);
+    p->bind();
+    p->setUniformValue(_mvpLoc, modelviewProj);
+    p->setUniformValue(_modeLoc, mode);
+    fc->glLineWidth(1.0f);
 
-        int m=0;
-        foreach(int c,_chunks)
+    for(int i=0;i<_blocks.size();i++)
+    {
+        if(_first[i].isEmpty()) continue;
+        pl_block_t &b=_blocks[i];
+        if(b.vao!=nullptr) b.vao->bind();
+        else               vbo_bind(b.vbo,fc);
+        if(f21!=nullptr)
+        {
+            f21->glMultiDrawArrays(GL_LINE_STRIP, _first[i].constData(), _count[i].constData(), _first[i].size());
+        }
+        else
         {
-            fc->glDrawArrays(GL_LINE_STRIP, m, c);
-            m+=c;
+            for(int k=0;k<_first[i].size();k++) fc->glDrawArrays(GL_LINE_STRIP, _first[i][k], _count[i][k]);
         }
+        if(b.vao!=nullptr) b.vao->release();
+        else               vbo_release(b.vbo,fc);
+    }
 
-        vbo_release(_vbo,fc);
-        p->release();
+    p->release();
+}
 
-//        if(draw.mode!=GL_DRAW_NORMAL) fc->glEnable(GL_DEPTH_TEST);
-    }
+quint64 gl_polyline_entity::gpuBytes(void)
+{
+    return (quint64)_blocks.size()*PL_BLOCK_VERTICES*3*sizeof(GLfloat);
+}
+
+quint64 gl_polyline_entity::cpuBytes(void)
+{
+    quint64 ret=(quint64)_tail.capacity()*sizeof(QVector3D);
+    for(const auto &x:_complete) ret+=(quint64)x.vertices.capacity()*sizeof(QVector3D);
+    QMutexLocker lock(&_mtx);
+    ret+=(quint64)_pending.capacity()*sizeof(QVector3D);
+    return ret;
+}
+
+quint64 gl_polyline_entity::renderKey(void)
+{
+    return RENDER_KEY(_prg!=nullptr ? _prg->programId() : 0, 3);  //vertex only
 }
@@ -3,6 +3,44 @@
 
 #include "gl_entity_ctx.h"
 
+#include <QVector>
+#include <QMutex>
+#include <QFuture>
+
+#define PL_LEVELS (4)              //full detail and simplified levels
+
+typedef struct
+{
+    QOpenGLBuffer vbo;
+    QOpenGLVertexArrayObject *vao;  //nullptr when VAO is not supported
+    GLsizei used;                   //vertices
+} pl_block_t;
+
+typedef struct
+{
+    int block;
+    GLint first;
+    GLsizei count;
+} pl_run_t;
+
+// part of a strip drawn by itself, the neighbors share the end vertex
+typedef struct
+{
+    pl_run_t run[PL_LEVELS];        //count is 0 until the level is built
+    QVector3D center;               //bounding sphere
+    float radius;
+} pl_segment_t;
+
+typedef struct
+{
+    int segment;
+    QVector<QVector3D> vertices;    //full detail, then the simplified levels
+    int count[PL_LEVELS];
+} pl_simplify_t;
+
+// growing line strips, the stream appends vertices without uploading the others again
+// vertices are written into fixed VBO blocks as segments. a complete segment is simplified by Douglas-Peucker
+// on a worker thread, and each segment is drawn at the level of its radius on the screen.
 class gl_polyline_entity : public gl_entity_ctx
 {
     Q_OBJECT
@@ -10,11 +48,25 @@ class gl_polyline_entity : public gl_entity_ctx
 public:
     gl_polyline_entity(QObject *parent=0);
     virtual ~gl_polyline_entity();
+
+    virtual void cleanup(void);
     virtual int prepare_gl(void);
+    virtual int pertialPrepare_gl(void);
+    virtual int rebuildRequest(void);
     virtual void draw_gl(gl_draw_ctx_t &draw);
+    virtual quint64 renderKey(void);
 
     virtual bool isUnloadable(void) {return true;}
 
+    virtual quint64 gpuBytes(void);
+    virtual quint64 cpuBytes(void);
+
+    // any thread, NaN vertex ends the strip. customGLWidget::rebuildRequest() uploads them
+    void append(const QVector3D *v, int n);
+    void endStrip(void);
+
+    static int lodLevel(float pixels);     //level of detail for the radius on the screen
+
 public slots:
     void load(void);
 
@@ -24,11 +76,37 @@ protected:
 
     virtual int load_mem(const uint8_t *buf, size_t length);
 
+private:
+    bool upload_pending(void);
+    bool upload_levels(void);
+    void segment_begin(void);
+    void segment_flush(void);
+    void segment_end(void);
+    pl_run_t allocate(GLsizei count);
+    void write(const pl_run_t &run, GLsizei offset, const QVector3D *v, GLsizei n);
+
 private:
     QOpenGLShaderProgram *_prg;
-    QOpenGLBuffer _vbo;
-    QVector<QVector3D> _vertices;
-    QVector<int> _chunks;
+    int _mvpLoc;
+    int _modeLoc;
+
+    QMutex _mtx;                    //_pending and _simplified are filled by other threads
+    QVector<QVector3D> _pending;    //appended, not uploaded yet
+    QVector<pl_simplify_t> _simplified;
+
+    QVector<pl_block_t> _blocks;
+    QVector<pl_segment_t> _segments;
+    QVector<QVector3D> _tail;       //vertices of the last segment while the strip is open
+    GLsizei _written;               //vertices of _tail in the VBO
+    bool _open;
+    QVector<pl_simplify_t> _complete;   //segments waiting for the worker
+    QFuture<void> _lodFuture;
+    QVector3D _bmin;
+    QVector3D _bmax;
+    quint64 _nVertex;
+
+    QVector<QVector<GLint>> _first;     //draw lists of draw_gl()
+    QVector<QVector<GLsizei>> _count;
 };
 
 #endif // GL_TRAJECTORY_ENTITY_H
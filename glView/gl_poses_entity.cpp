@@ -9,9 +9,11 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 */
 
 #include "gl_poses_entity.h"
+#include "gl_programs.h"
 
 #include "pose_packet.h"
 #include "rot.h"
+#include "parallel.h"
 
 #include <mutex>
 
@@ -19,11 +21,58 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include <QThread>
 #include <QFileInfo>
 #include <QFile>
+#include <QOpenGLShaderProgram>
+
+#define POSE_MODEL_SCALE (2.0f)
+#define POSE_GLYPH_PIXELS (6.0f)    //poses smaller than this on the screen are drawn by axes
+#define POSE_BATCH (1024)           //poses converted at once by a task
+
+static const char *glyphVertexShaderSource =
+    "attribute vec3 vertex;\n"
+    "attribute vec3 color;\n"
+    "attribute vec4 instance0;\n"
+    "attribute vec4 instance1;\n"
+    "attribute vec4 instance2;\n"
+    "attribute vec4 instance3;\n"
+    "varying lowp vec3 col;\n"
+    "uniform mat4 mvpMatrix;\n"
+    "uniform float glyphScale;\n"
+    "void main() {\n"
+    "   col  = color;\n"
+    "   gl_Position = mvpMatrix * mat4(instance0, instance1, instance2, instance3) * vec4(vertex*glyphScale, 1.0);\n"
+    "}\n";
+
+static const char *glyphFragmentShaderSource =
+    "varying lowp vec3 col;\n"
+    "uniform highp int mode;\n"
+    "void main() {\n"
+    "   if(mode==4){\n"
+    "    highp int depth,r,g,b;\n"
+    "    depth=int(gl_FragCoord.z*16777216.0);\n"
+    "    r=depth/16777216; depth=depth -r*16777216;\n"
+    "    g=depth/65536;    depth=depth -g*65536;\n"
+    "    b=depth/256;      depth=depth -b*256;\n"
+    "    gl_FragColor = vec4(float(depth),float(b),float(g),float(r))/255.0;\n"
+    "   }else{\n"
+    "    gl_FragColor = vec4(col, 1.0);\n"
+    "   }\n"
+    "}\n";
+
+static const GLfloat glyphVertex[]=
+{   //x, y, z, r, g, b
+    0.0f, 0.0f, 0.0f,   1.0f, 0.0f, 0.0f,
+    1.0f, 0.0f, 0.0f,   1.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 0.0f,   0.0f, 1.0f, 0.0f,
+    0.0f, 1.0f, 0.0f,   0.0f, 1.0f, 0.0f,
+    0.0f, 0.0f, 0.0f,   0.0f, 0.0f, 1.0f,
+    0.0f, 0.0f, 1.0f,   0.0f, 0.0f, 1.0f,
+};
 
 gl_poses_entity::gl_poses_entity(gl_entity_ctx * model, QObject *parent)
     : gl_entity_ctx{parent}
 {
     _model = model;
+    _glyphPrg = nullptr;
 }
 
 gl_poses_entity::~gl_poses_entity()
@@ -60,29 +109,36 @@ int gl_poses_entity::load_mem(const uint8_t *buf, size_t length)
                 top += txt->length;
             }
 
-            //required block
+            //required block, converted by batches on the thread pool
             const pose_payload_t* p = (const pose_payload_t*)top;
-            for(uint32_t i=0;i<header->numPose;i++)
-            {
-                pose_t pose;
-
-                GLfloat rx = p[i].rvec[0];    //Right
-                GLfloat ry = p[i].rvec[1];    //Down
-                GLfloat rz = p[i].rvec[2];    //Forward
-
-                QMatrix3x3 R;
-                QVector3D rvec(rz, -rx, -ry);   // convert to E-N-U (Forward-Left-Up)
-                rot::dcm_from_rodrigues(R,rvec);
-                rot::dcm_to_quat(pose.q,R);
-
-                GLfloat x = p[i].tvec[0];    //Right
-                GLfloat y = p[i].tvec[1];    //Down
-                GLfloat z = p[i].tvec[2];    //Forward
-                pose.p=QVector3D(z, -x, -y);  // convert to E-N-U (Forward-Left-Up)
+            const int n = (int)header->numPose;
+            for(auto &x:_poses.q) x.resize(n);
+            for(auto &x:_poses.p) x.resize(n);
+            GLfloat *q[4] = {_poses.q[0].data(), _poses.q[1].data(), _poses.q[2].data(), _poses.q[3].data()};
+            GLfloat *t[3] = {_poses.p[0].data(), _poses.p[1].data(), _poses.p[2].data()};
 
-                _poses.append(pose);
-                ret++;
-            }
+            parallel::for_chunks(n, POSE_BATCH, [&](quint64 first, quint64 last)
+            {
+                GLfloat r[3][POSE_BATCH];   //rodrigues vector
+                for(quint64 i=first;i<last;i++)
+                {
+                    GLfloat rx = p[i].rvec[0];    //Right
+                    GLfloat ry = p[i].rvec[1];    //Down
+                    GLfloat rz = p[i].rvec[2];    //Forward
+                    r[0][i-first] = rz;   // convert to E-N-U (Forward-Left-Up)
+                    r[1][i-first] = -rx;
+                    r[2][i-first] = -ry;
+
+                    GLfloat x = p[i].tvec[0];    //Right
+                    GLfloat y = p[i].tvec[1];    //Down
+                    GLfloat z = p[i].tvec[2];    //Forward
+                    t[0][i] = z;    // convert to E-N-U (Forward-Left-Up)
+                    t[1][i] = -x;
+                    t[2][i] = -y;
+                }
+                rot::quat_from_rodrigues(q[0]+first, q[1]+first, q[2]+first, q[3]+first, r[0], r[1], r[2], (size_t)(last-first));
+            });
+            ret = n;
         }
     }
 
@@ -121,27 +177,187 @@ void gl_poses_entity::load()
 
     if(r)
     {
-        valid= _poses.size()>0;
+        valid= poseCount()>0;
     }
 
+    //model matrix of each pose, the origin is given by the view matrix
+    _instances.resize(poseCount()*16);
+    GLfloat *dst=_instances.data();
+    const poses_t &x=_poses;
+    parallel::for_chunks(poseCount(), POSE_BATCH, [&](quint64 first, quint64 last)
+    {
+        rot::matrix_from_quat(dst+first*16,
+                              x.q[0].constData()+first, x.q[1].constData()+first, x.q[2].constData()+first, x.q[3].constData()+first,
+                              x.p[0].constData()+first, x.p[1].constData()+first, x.p[2].constData()+first,
+                              POSE_MODEL_SCALE, (size_t)(last-first));
+    });
+
     emit done(this);
 }
 
+int gl_poses_entity::prepare_gl(void)
+{
+    gl_entity_ctx::prepare_gl();
+
+    if(!_instancing.initialize())
+    {   //draw_gl() uses _poses
+        qDebug()<<"gl_poses_entity instancing is not available";
+        _instances.clear();
+        _instances.squeeze();
+        return 0;
+    }
+
+    _instanceBuffer.create();
+    if(_instanceBuffer.bind())
+    {
+        _instanceBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        _instanceBuffer.allocate(_instances.constData(), _instances.size()*(int)sizeof(GLfloat));
+        _instanceBuffer.release();
+    }
+
+    _glyphVbo.create();
+    if(_glyphVbo.bind())
+    {
+        _glyphVbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+        _glyphVbo.allocate(glyphVertex, sizeof(glyphVertex));
+        _glyphVbo.release();
+    }
+
+    //instance matrix at 2 to 5, every pose is drawn by the model when it fails
+    auto x=gl_programs::acquire(glyphVertexShaderSource, glyphFragmentShaderSource,
+                                QStringList()<<"vertex"<<"color"<<"instance0"<<"instance1"<<"instance2"<<"instance3");
+    if(x!=nullptr)
+    {
+        _glyphMvp  =x->uniformLocation("mvpMatrix");
+        _glyphScale=x->uniformLocation("glyphScale");
+        _glyphMode =x->uniformLocation("mode");
+        _glyphPrg=x;
+    }
+
+    //matrices are in the buffer
+    _instances.clear();
+    _instances.squeeze();
+
+    return 0;
+}
+
+void gl_poses_entity::cleanup(void)
+{
+    _instanceBuffer.destroy();
+    _glyphVbo.destroy();
+    gl_programs::release(_glyphPrg);
+    _glyphPrg=nullptr;
+}
+
+// near poses are drawn by the model, far ones by axes, both instanced from the same buffer
+// poses of a trajectory are in time order, so each set is a few runs of consecutive instances.
+bool gl_poses_entity::drawInstanced(gl_draw_ctx_t &draw, gl_model_entity *model)
+{
+    QMatrix4x4 base;
+    base.setToIdentity();
+    base.translate(localOrigin());
+
+    QMatrix4x4 view;
+    if(!model->viewMatrix(draw, base, view)) return true;   //origin is too far, model isn't drawn either
+
+    //radius on the screen [pixel] is r*f/w, w is clip w of the pose
+    float r=model->boundingRadius()*POSE_MODEL_SCALE*draw.modelScale;
+    float f=draw.proj(1,1)*draw.height*0.5f;
+    QVector4D row=(draw.proj*view).row(3);
+    bool glyph= _glyphPrg!=nullptr;
+
+    for(auto &x:_near) x.clear();
+    _far.clear();
+    const GLfloat *px=_poses.p[0].constData();
+    const GLfloat *py=_poses.p[1].constData();
+    const GLfloat *pz=_poses.p[2].constData();
+    for(int i=0;i<poseCount();i++)
+    {
+        float w=row.x()*px[i]+row.y()*py[i]+row.z()*pz[i]+row.w();
+        bool near= !glyph || (w>0.0f && r*f>=POSE_GLYPH_PIXELS*w);
+        int level= w>0.0f ? gl_model_entity::lodLevel(r*f/w) : 0;
+
+        instance_ranges_t &x= near ? _near[level] : _far;
+        if(!x.empty() && x.back().first+x.back().count==i)
+        {
+            x.back().count++;
+        }
+        else
+        {
+            instance_range_t n;
+            n.first=i;
+            n.count=1;
+            x.push_back(n);
+        }
+    }
+
+    for(int l=0;l<MODEL_LOD_LEVELS;l++)
+    {
+        if(!model->drawInstanced_gl(draw, view, _instanceBuffer, _near[l], l)) return false;
+    }
+
+    if(!_far.empty())
+    {
+        drawGlyphs(draw, view, model->boundingRadius()*draw.modelScale);
+    }
+    return true;
+}
+
+void gl_poses_entity::drawGlyphs(gl_draw_ctx_t &draw, const QMatrix4x4 &view, float scale)
+{
+    QOpenGLFunctions *fc = QOpenGLContext::currentContext()->functions();
+    QOpenGLShaderProgram *p=_glyphPrg;
+
+    p->bind();
+    p->setUniformValue(_glyphMvp, draw.proj * view);
+    p->setUniformValue(_glyphScale, scale);
+    p->setUniformValue(_glyphMode, (int)(draw.mode==GL_DRAW_PICK ? OPT_PC_CM_DEPTH : 0));
+
+    if(_glyphVbo.bind())
+    {
+        fc->glEnableVertexAttribArray(0);
+        fc->glEnableVertexAttribArray(1);
+        fc->glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), 0);    //vertex
+        fc->glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), reinterpret_cast<void *>(3 * sizeof(GLfloat)));    //color
+        _glyphVbo.release();
+
+        _instanceBuffer.bind();
+        for(const auto &r:_far)
+        {
+            _instancing.bindMatrices(fc, 2, (quintptr)r.first*16*sizeof(GLfloat));
+            _instancing.drawArrays(GL_LINES, 0, 6, (GLsizei)r.count);
+        }
+        _instancing.releaseMatrices(fc, 2);
+        _instanceBuffer.release();
+
+        fc->glDisableVertexAttribArray(0);
+        fc->glDisableVertexAttribArray(1);
+    }
+
+    p->release();
+}
+
 void gl_poses_entity::draw_gl(gl_draw_ctx_t &draw)
 {
     if(_model==nullptr) return;
     if(!show()) return;
 
+    auto model=qobject_cast<gl_model_entity*>(_model);
+    if(model!=nullptr && _instanceBuffer.isCreated())
+    {
+        if(drawInstanced(draw, model)) return;
+    }
 
+    //one by one when instancing is not supported
     QMatrix4x4 s;
     s.setToIdentity();
-    s.scale(2.0f);
+    s.scale(POSE_MODEL_SCALE);
 
     QVector3D origin =  localOrigin();
-    foreach(auto &i,_poses)
+    for(int i=0;i<poseCount();i++)
     {
         QMatrix3x3 dcm;
-        rot::dcm_from_quat(dcm,i.q);
+        rot::dcm_from_quat(dcm,QVector4D(_poses.q[0][i],_poses.q[1][i],_poses.q[2][i],_poses.q[3][i]));
 
         QMatrix4x4 R;
         rot::dcm4x4(R, dcm);
@@ -150,7 +366,7 @@ void gl_poses_entity::draw_gl(gl_draw_ctx_t &draw)
         t.setToIdentity();
 
         t.translate(origin);
-        t.translate(i.p);
+        t.translate(position(i));
 
         _model->local = t * R * s;
 
@@ -160,5 +376,5 @@ void gl_poses_entity::draw_gl(gl_draw_ctx_t &draw)
 
 QVector3D gl_poses_entity::getCenter()
 {
-    return _poses.front().p;
+    return position(0);
 }
@@ -12,14 +12,17 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 */
 
 #include "gl_entity_ctx.h"
+#include "gl_model_entity.h"
+#include "gl_instancing.h"
 
 #include <QMatrix4x4>
 
+// poses as structure of arrays, converted in batches by rot
 typedef struct
 {
-    QVector4D q;    //quaternion body to nav
-    QVector3D p;    //position (X,Y,Z) East-North-Up
-} pose_t;
+    QVector<GLfloat> q[4];      //quaternion body to nav
+    QVector<GLfloat> p[3];      //position (X,Y,Z) East-North-Up
+} poses_t;
 
 class gl_poses_entity : public gl_entity_ctx
 {
@@ -28,7 +31,11 @@ public:
     explicit gl_poses_entity(gl_entity_ctx *model, QObject *parent = nullptr);
     virtual ~gl_poses_entity();
 
+    virtual void cleanup(void);
+
+    virtual int prepare_gl(void);
     virtual void draw_gl(gl_draw_ctx_t &draw);
+    virtual quint64 renderKey(void) {return _model!=nullptr ? _model->renderKey() : 0;}
 
     virtual bool isUnloadable(void) {return true;}
 
@@ -40,9 +47,28 @@ public slots:
 protected:
     virtual int load_mem(const uint8_t *buf, size_t length);
 
-    QVector<pose_t> _poses;
+    bool drawInstanced(gl_draw_ctx_t &draw, gl_model_entity *model);
+    void drawGlyphs(gl_draw_ctx_t &draw, const QMatrix4x4 &view, float scale);
+
+    int poseCount(void) const {return _poses.p[0].size();}
+    QVector3D position(int i) const {return QVector3D(_poses.p[0][i],_poses.p[1][i],_poses.p[2][i]);}
+
+    poses_t _poses;
 
     gl_entity_ctx *_model;
+
+    QVector<GLfloat> _instances;        //model matrix of every pose, built by load()
+    QOpenGLBuffer _instanceBuffer;
+
+    gl_instancing _instancing;
+    QOpenGLBuffer _glyphVbo;            //3 axes, drawn instead of the model for far poses
+    QOpenGLShaderProgram *_glyphPrg;
+    int _glyphMvp;
+    int _glyphScale;
+    int _glyphMode;
+
+    instance_ranges_t _near[MODEL_LOD_LEVELS];  //runs of consecutive poses by level of detail, trajectory keeps them few
+    instance_ranges_t _far;
 };
 
 #endif // GL_POSES_ENTITY_H
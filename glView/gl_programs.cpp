@@ -0,0 +1,104 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "gl_programs.h"
+
+#include <QOpenGLContext>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QDebug>
+
+QMutex gl_programs::_mtx;
+QHash<QByteArray, gl_programs::entry_t> gl_programs::_programs;
+QHash<QOpenGLShaderProgram*, QByteArray> gl_programs::_keys;
+
+QByteArray gl_programs::source(const QString &x)
+{
+    if(!x.startsWith(":/")) return x.toUtf8();
+
+    QFile f(x);
+    if(!f.open(QIODevice::ReadOnly))
+    {
+        qDebug()<<"gl_programs can't read"<<x;
+        return QByteArray();
+    }
+    return f.readAll();
+}
+
+QOpenGLShaderProgram *gl_programs::acquire(const QString &vertex, const QString &fragment, const QStringList &attributes)
+{
+    QOpenGLContext *ctx=QOpenGLContext::currentContext();
+    if(ctx==nullptr) return nullptr;
+
+    QByteArray vs=source(vertex);
+    QByteArray fs=source(fragment);
+
+    QCryptographicHash h(QCryptographicHash::Sha1);
+    h.addData(vs);
+    h.addData("\0",1);
+    h.addData(fs);
+    h.addData("\0",1);
+    h.addData(attributes.join(',').toUtf8());
+    QByteArray key=h.result();
+    quintptr group=(quintptr)ctx->shareGroup();     //programs live in the share group
+    key.append((const char*)&group, sizeof(group));
+
+    QMutexLocker lock(&_mtx);
+    auto i=_programs.find(key);
+    if(i!=_programs.end())
+    {
+        i->refs++;
+        return i->program;
+    }
+
+    auto x=new QOpenGLShaderProgram;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 9, 0)
+    x->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex, vs);     //binary is loaded from the cache when it's there
+    x->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, fs);
+#else
+    x->addShaderFromSourceCode(QOpenGLShader::Vertex, vs);
+    x->addShaderFromSourceCode(QOpenGLShader::Fragment, fs);
+#endif
+    for(int k=0;k<attributes.size();k++)
+    {
+        x->bindAttributeLocation(attributes[k], k);
+    }
+    if(!x->link())
+    {
+        qDebug()<<"gl_programs link error"<<x->log();
+        delete x;
+        return nullptr;
+    }
+
+    entry_t e;
+    e.program=x;
+    e.refs=1;
+    _programs[key]=e;
+    _keys[x]=key;
+    return x;
+}
+
+void gl_programs::release(QOpenGLShaderProgram *p)
+{
+    if(p==nullptr) return;
+
+    QMutexLocker lock(&_mtx);
+    auto k=_keys.find(p);
+    if(k==_keys.end()) return;
+
+    auto i=_programs.find(*k);
+    if(--i->refs>0) return;
+
+    _programs.erase(i);
+    _keys.erase(k);
+    delete p;
+}
@@ -0,0 +1,43 @@
+#ifndef GL_PROGRAMS_H
+#define GL_PROGRAMS_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <QOpenGLShaderProgram>
+#include <QStringList>
+#include <QMutex>
+#include <QHash>
+
+// shader programs shared by entities, keyed by sources, attribute locations and context share group
+// linked binaries are kept in the disk cache of Qt, so a known program is not compiled again.
+class gl_programs
+{
+public:
+    // source is the code itself, or a file when it starts with ":/"
+    // attributes are bound to locations in the order of the list. context required, nullptr when it fails
+    static QOpenGLShaderProgram *acquire(const QString &vertex, const QString &fragment, const QStringList &attributes);
+    static void release(QOpenGLShaderProgram *p);   //the last one deletes it, context required
+
+private:
+    typedef struct
+    {
+        QOpenGLShaderProgram *program;
+        int refs;
+    } entry_t;
+
+    static QByteArray source(const QString &x);
+
+    static QMutex _mtx;
+    static QHash<QByteArray, entry_t> _programs;
+    static QHash<QOpenGLShaderProgram*, QByteArray> _keys;
+};
+
+#endif // GL_PROGRAMS_H
@@ -11,6 +11,8 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 
 #include "gl_stock_entity.h"
 
+#include "gl_programs.h"
+
 #include <QOpenGLShaderProgram>
 
 gl_stock_entity::gl_stock_entity(QObject *parent):gl_entity_ctx(parent)
@@ -22,10 +24,17 @@ gl_stock_entity::gl_stock_entity(QObject *parent):gl_entity_ctx(parent)
 
 gl_stock_entity::~gl_stock_entity()
 {
+    cleanup();
     if(vertex!=NULL) delete [] vertex;
+}
+
+void gl_stock_entity::cleanup(void)
+{
+    vao.destroy();
+    vbo.destroy();
     if(prg!=NULL)
     {
-        delete prg;
+        gl_programs::release(prg);
         prg=NULL;
     }
 }
@@ -40,18 +49,14 @@ int gl_stock_entity::prepare_gl(void)
 {
     qDebug() << "gl_stock_entity::prepare_gl";
 
-    prg = new QOpenGLShaderProgram;
-    prg->addShaderFromSourceCode(QOpenGLShader::Vertex,  get_vertex_shader() );
-    prg->addShaderFromSourceCode(QOpenGLShader::Fragment,get_fragment_shader() );
-
-    prg->bindAttributeLocation("vertex", 0);
-    prg->bindAttributeLocation("color", 1);
-
-    prg->link();
+    prg = gl_programs::acquire(get_vertex_shader(), get_fragment_shader(), QStringList()<<"vertex"<<"color");
+    if(prg==NULL) return 0;
     prg->bind();
 
     projMat =prg->uniformLocation("projMatrix");
     mvMat   =prg->uniformLocation("mvMatrix");
+    modeLoc =prg->uniformLocation("mode");
+    pszLoc  =prg->uniformLocation("pointsize");
 
     vbo_allocate();
 
@@ -102,6 +107,14 @@ void gl_stock_entity::vbo_allocate(void)
     {
         vbo.allocate(&vertex[0], n);
         vbo.release();
+
+        if(vao.create())
+        {   //attribute setup is recorded once
+            vao.bind();
+            vbo_bind();
+            vao.release();
+            vbo.release();
+        }
     }
 }
 
@@ -137,18 +150,26 @@ void gl_stock_entity::draw_gl(gl_draw_ctx_t &draw)
 
         QMatrix4x4 modelview=draw.camera * draw.world * local;
         p->bind();
-        vbo_bind();
+        if(vao.isCreated()) vao.bind();
+        else                vbo_bind();
         fc->glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
         fc->glLineWidth(get_LineWidth());
         p->setUniformValue(projMat, draw.proj);
         p->setUniformValue(mvMat, modelview);
-        p->setUniformValue("mode", mode);
-        p->setUniformValue("pointsize", psz);
+        p->setUniformValue(modeLoc, mode);
+        p->setUniformValue(pszLoc, psz);
         fc->glDrawArrays(GL_LINES, 0, n);
         fc->glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
-        vbo.release();
-        fc->glDisableVertexAttribArray(0);
-        fc->glDisableVertexAttribArray(1);
+        if(vao.isCreated())
+        {
+            vao.release();
+        }
+        else
+        {
+            vbo.release();
+            fc->glDisableVertexAttribArray(0);
+            fc->glDisableVertexAttribArray(1);
+        }
         p->release();
 
 //        if(draw.mode!=GL_DRAW_NORMAL) fc->glEnable(GL_DEPTH_TEST);
@@ -203,3 +224,8 @@ const char *gl_stock_entity::get_fragment_shader(void) const
 
     return fragmentShaderSource;
 }
+
+quint64 gl_stock_entity::renderKey(void)
+{
+    return RENDER_KEY(prg!=NULL ? prg->programId() : 0, n_element);
+}
@@ -20,6 +20,8 @@ public:
     explicit gl_stock_entity(QObject *parent = 0);
     virtual ~gl_stock_entity();
 
+    virtual void cleanup(void);
+
 public slots:
     void load(void);
 
@@ -29,7 +31,10 @@ protected:
     int n_element;
     int projMat;
     int mvMat;
+    int modeLoc;
+    int pszLoc;
     QOpenGLBuffer vbo;
+    QOpenGLVertexArrayObject vao;   //not created when VAO is not supported
     QOpenGLShaderProgram *prg;
     virtual const char *get_vertex_shader(void) const;
     virtual const char *get_fragment_shader(void) const;
@@ -41,6 +46,7 @@ protected:
 public:
     virtual int prepare_gl(void);
     virtual void draw_gl(gl_draw_ctx_t &draw);
+    virtual quint64 renderKey(void);
 };
 
 
@@ -0,0 +1,164 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+
+#include "gl_textures.h"
+
+#include <QOpenGLContext>
+#include <QCryptographicHash>
+#include <QFileInfo>
+#include <QFile>
+#include <QDebug>
+
+QMutex gl_textures::_mtx;
+QHash<QByteArray, gl_textures::image_t> gl_textures::_images;
+QHash<QByteArray, gl_textures::entry_t> gl_textures::_textures;
+QHash<QOpenGLTexture*, QByteArray> gl_textures::_keys;
+
+// RGBA8888 flipped to OpenGL rows, so the upload doesn't convert it again
+QImage gl_textures::load(const QByteArray &data)
+{
+    QImage image;
+    if(!image.loadFromData(data)) return QImage();
+    image=image.convertToFormat(QImage::Format_RGBA8888);
+    return std::move(image).mirrored();     //in place
+}
+
+QByteArray gl_textures::decode(const QString &fileName)
+{
+    QFile f(fileName);
+    if(!f.open(QIODevice::ReadOnly)) return QByteArray();
+    QByteArray data=f.readAll();
+    f.close();
+
+    QByteArray key=QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    key.append(QFileInfo(fileName).absoluteFilePath().toUtf8());
+
+    {
+        QMutexLocker lock(&_mtx);
+        auto i=_images.find(key);
+        if(i!=_images.end())
+        {
+            i->pending++;
+            return key;
+        }
+    }
+
+    QImage image=load(data);
+    if(image.isNull())
+    {
+        qDebug()<<"gl_textures can't decode"<<fileName;
+        return QByteArray();
+    }
+
+    QMutexLocker lock(&_mtx);
+    auto i=_images.find(key);
+    if(i==_images.end())
+    {   //the other thread may have decoded it meanwhile
+        image_t x;
+        x.fileName=fileName;
+        x.image=image;
+        x.pending=0;
+        x.textures=0;
+        i=_images.insert(key, x);
+    }
+    i->pending++;
+    return key;
+}
+
+void gl_textures::drop(QHash<QByteArray, image_t>::iterator i)
+{
+    if(i->pending>0 || i->textures>0) return;
+    _images.erase(i);
+}
+
+void gl_textures::discard(const QByteArray &key)
+{
+    if(key.isEmpty()) return;
+
+    QMutexLocker lock(&_mtx);
+    auto i=_images.find(key);
+    if(i==_images.end()) return;
+    i->pending--;
+    drop(i);
+}
+
+QOpenGLTexture *gl_textures::acquire(const QByteArray &key)
+{
+    QOpenGLContext *ctx=QOpenGLContext::currentContext();
+    if(ctx==nullptr || key.isEmpty()) return nullptr;
+
+    QByteArray tkey=key;
+    quintptr group=(quintptr)ctx->shareGroup();     //textures live in the share group
+    tkey.append((const char*)&group, sizeof(group));
+
+    QMutexLocker lock(&_mtx);
+    auto i=_images.find(key);
+    if(i==_images.end()) return nullptr;
+    i->pending--;
+
+    auto t=_textures.find(tkey);
+    if(t!=_textures.end())
+    {
+        t->refs++;
+        drop(i);
+        return t->texture;
+    }
+
+    QImage image=i->image;
+    if(image.isNull())
+    {   //uploaded to the other share group, and released
+        QFile f(i->fileName);
+        if(f.open(QIODevice::ReadOnly)) image=load(f.readAll());
+    }
+    i->image=QImage();
+    if(image.isNull())
+    {
+        drop(i);
+        return nullptr;
+    }
+
+    auto x=new QOpenGLTexture(QOpenGLTexture::Target2D);
+    x->setData(image, QOpenGLTexture::GenerateMipMaps);
+    x->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+    x->setMagnificationFilter(QOpenGLTexture::Linear);
+    x->setWrapMode(QOpenGLTexture::Repeat);     //texture coordinate (1.1, 1.2) is same as (0.1, 0.2)
+
+    i->textures++;
+    entry_t e;
+    e.texture=x;
+    e.refs=1;
+    _textures[tkey]=e;
+    _keys[x]=tkey;
+    return x;
+}
+
+void gl_textures::release(QOpenGLTexture *t)
+{
+    if(t==nullptr) return;
+
+    QMutexLocker lock(&_mtx);
+    auto k=_keys.find(t);
+    if(k==_keys.end()) return;
+
+    auto e=_textures.find(*k);
+    if(--e->refs>0) return;
+
+    QByteArray key=k->left(k->size()-(int)sizeof(quintptr));
+    _textures.erase(e);
+    _keys.erase(k);
+    delete t;
+
+    auto i=_images.find(key);
+    if(i==_images.end()) return;
+    i->textures--;
+    drop(i);
+}
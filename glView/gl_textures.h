@@ -0,0 +1,57 @@
+#ifndef GL_TEXTURES_H
+#define GL_TEXTURES_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <QOpenGLTexture>
+#include <QImage>
+#include <QMutex>
+#include <QHash>
+
+// textures shared by entities, keyed by the path and the content hash of the image file
+// images are decoded by the loader thread, only the upload is done with the context.
+class gl_textures
+{
+public:
+    // decode the image, it is kept until acquire() or discard(). empty key when it fails
+    // the file is not decoded again when the same content is decoded or uploaded already
+    static QByteArray decode(const QString &fileName);
+    static void discard(const QByteArray &key);     //decoded image is not going to be acquired
+
+    // texture of a decoded image with mipmaps, shared by the context share group. context required
+    static QOpenGLTexture *acquire(const QByteArray &key);
+    static void release(QOpenGLTexture *t);         //the last one deletes it, context required
+
+private:
+    typedef struct
+    {
+        QString fileName;
+        QImage image;       //RGBA8888 bottom-up, null when it's uploaded
+        int pending;        //decode() not yet acquired
+        int textures;       //share groups it's uploaded to
+    } image_t;
+
+    typedef struct
+    {
+        QOpenGLTexture *texture;
+        int refs;
+    } entry_t;
+
+    static QImage load(const QByteArray &data);
+    static void drop(QHash<QByteArray, image_t>::iterator i);       //removed when nothing refers to it
+
+    static QMutex _mtx;
+    static QHash<QByteArray, image_t> _images;
+    static QHash<QByteArray, entry_t> _textures;     //key and share group
+    static QHash<QOpenGLTexture*, QByteArray> _keys;
+};
+
+#endif // GL_TEXTURES_H
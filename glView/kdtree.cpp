@@ -0,0 +1,339 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "kdtree.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+#define KD_LEAF_SIZE (32)       //maximum number of points in a leaf
+#define KD_THREAD_DEPTH (3)     //subtrees below this depth are built as separate tasks on the thread pool
+#define KD_STACK_SIZE (128)
+
+kdtree::kdtree()
+{
+    _vertex=nullptr;
+    _stride=0;
+    _levels=0;
+    _firstLeaf=0;
+}
+
+void kdtree::clear(void)
+{
+    _vertex=nullptr;
+    _stride=0;
+    _levels=0;
+    _firstLeaf=0;
+    std::vector<node_t>().swap(_node);
+    std::vector<uint32_t>().swap(_index);
+}
+
+void kdtree::build(const float *vertex, uint64_t n, int stride)
+{
+    clear();
+    if(vertex==nullptr || n==0 || n>UINT32_MAX || stride<3) return;
+
+    _vertex=vertex;
+    _stride=stride;
+
+    _levels=0;
+    while((n>>_levels)>KD_LEAF_SIZE) _levels++;
+    _firstLeaf=(1u<<_levels)-1;
+
+    _node.resize(((size_t)1<<(_levels+1))-1);
+    _index.resize(n);
+    for(uint32_t i=0;i<(uint32_t)n;i++)
+    {
+        _index[i]=i;
+    }
+
+    // split the top levels here, then build the subtrees on the thread pool
+    std::vector<uint32_t> roots;
+    split_node(0,0,(uint32_t)n,0,roots);
+    parallel::for_chunks(roots.size(), 1, [&](quint64 first, quint64 last)
+    {
+        for(quint64 i=first;i<last;i++)
+        {
+            const node_t &x=_node[roots[i]];
+            build_node(roots[i], x.begin, x.end);
+        }
+    });
+}
+
+void kdtree::split_node(uint32_t node, uint32_t begin, uint32_t end, int depth, std::vector<uint32_t> &roots)
+{
+    if(depth>=KD_THREAD_DEPTH || is_leaf(node))
+    {
+        _node[node].begin=begin;
+        _node[node].end=end;
+        roots.push_back(node);
+        return;
+    }
+
+    uint32_t mid=partition(node, begin, end);
+    split_node(2*node+1, begin, mid, depth+1, roots);
+    split_node(2*node+2, mid, end, depth+1, roots);
+}
+
+void kdtree::build_node(uint32_t node, uint32_t begin, uint32_t end)
+{
+    if(is_leaf(node))
+    {
+        bound(node, begin, end);
+        return;
+    }
+
+    uint32_t mid=partition(node, begin, end);
+    build_node(2*node+1, begin, mid);
+    build_node(2*node+2, mid, end);
+}
+
+// bounding box of the points in [begin,end)
+void kdtree::bound(uint32_t node, uint32_t begin, uint32_t end)
+{
+    node_t &x=_node[node];
+    x.begin=begin;
+    x.end=end;
+
+    float bmin[3]={FLT_MAX,FLT_MAX,FLT_MAX};
+    float bmax[3]={-FLT_MAX,-FLT_MAX,-FLT_MAX};
+    for(uint32_t i=begin;i<end;i++)
+    {
+        const float *p=point(_index[i]);
+        for(int k=0;k<3;k++)
+        {
+            bmin[k]=std::min(bmin[k],p[k]);
+            bmax[k]=std::max(bmax[k],p[k]);
+        }
+    }
+    memcpy(x.bmin,bmin,sizeof(bmin));
+    memcpy(x.bmax,bmax,sizeof(bmax));
+}
+
+// bound the node and split its points at the median of the longest axis
+uint32_t kdtree::partition(uint32_t node, uint32_t begin, uint32_t end)
+{
+    bound(node, begin, end);
+
+    const node_t &x=_node[node];
+    int axis=0;
+    for(int k=1;k<3;k++)
+    {
+        if(x.bmax[k]-x.bmin[k] > x.bmax[axis]-x.bmin[axis]) axis=k;
+    }
+
+    uint32_t mid=begin+(end-begin)/2;
+    std::nth_element(_index.begin()+begin, _index.begin()+mid, _index.begin()+end,
+                     [this,axis](uint32_t a, uint32_t b){ return point(a)[axis]<point(b)[axis]; });
+    return mid;
+}
+
+// entry of the ray into the box expanded by the tolerance at the far side of the box
+static bool ray_box(const float bmin[3], const float bmax[3], const float org[3], const float dir[3], float tol0, float slope, float &tn)
+{
+    float far=0.0f;
+    for(int k=0;k<3;k++)
+    {
+        far+=(dir[k]>0.0f ? bmax[k]-org[k] : bmin[k]-org[k])*dir[k];
+    }
+    float e=tol0+slope*std::max(far,0.0f);
+
+    float t0=0.0f, t1=FLT_MAX;
+    for(int k=0;k<3;k++)
+    {
+        float lo=bmin[k]-e-org[k];
+        float hi=bmax[k]+e-org[k];
+        if(dir[k]==0.0f)
+        {
+            if(lo>0.0f || hi<0.0f) return false;
+            continue;
+        }
+        float a=lo/dir[k];
+        float b=hi/dir[k];
+        if(a>b) std::swap(a,b);
+        t0=std::max(t0,a);
+        t1=std::min(t1,b);
+        if(t0>t1) return false;
+    }
+    tn=t0;
+    return true;
+}
+
+static float box_dist2(const float bmin[3], const float bmax[3], const float q[3])
+{
+    float d2=0.0f;
+    for(int k=0;k<3;k++)
+    {
+        float d=std::max(std::max(bmin[k]-q[k], q[k]-bmax[k]), 0.0f);
+        d2+=d*d;
+    }
+    return d2;
+}
+
+static float dist2(const float *p, const float q[3])
+{
+    float x=p[0]-q[0], y=p[1]-q[1], z=p[2]-q[2];
+    return x*x+y*y+z*z;
+}
+
+int kdtree::ray(const float org[3], const float dir[3], float tol0, float slope, uint32_t &index, float &t, const accept_t &accept) const
+{
+    if(_node.empty()) return 0;
+
+    int found=0;
+    float best=FLT_MAX;
+
+    uint32_t stack[KD_STACK_SIZE];
+    int sp=0;
+    stack[sp++]=0;
+    while(sp)
+    {
+        uint32_t node=stack[--sp];
+        const node_t &x=_node[node];
+        float tn;
+        if(!ray_box(x.bmin, x.bmax, org, dir, tol0, slope, tn)) continue;
+        if(tn>best) continue;
+
+        if(is_leaf(node))
+        {
+            for(uint32_t i=x.begin;i<x.end;i++)
+            {
+                uint32_t id=_index[i];
+                const float *p=point(id);
+                float v[3]={p[0]-org[0], p[1]-org[1], p[2]-org[2]};
+                float s=v[0]*dir[0]+v[1]*dir[1]+v[2]*dir[2];
+                if(s<0.0f || s>=best) continue;
+                float d2=v[0]*v[0]+v[1]*v[1]+v[2]*v[2]-s*s;
+                float tol=tol0+slope*s;
+                if(d2>tol*tol) continue;
+                if(accept && !accept(id)) continue;
+                best=s;
+                index=id;
+                found=1;
+            }
+        }
+        else
+        {   //visit the nearer child first
+            uint32_t c[2]={2*node+1, 2*node+2};
+            float tc[2];
+            bool hit[2];
+            for(int k=0;k<2;k++)
+            {
+                hit[k]=ray_box(_node[c[k]].bmin, _node[c[k]].bmax, org, dir, tol0, slope, tc[k]) && tc[k]<=best;
+            }
+            int nearer= (hit[0] && hit[1]) ? (tc[1]<tc[0]) : hit[1];
+            if(hit[1-nearer]) stack[sp++]=c[1-nearer];
+            if(hit[nearer]) stack[sp++]=c[nearer];
+        }
+    }
+
+    if(found) t=best;
+    return found;
+}
+
+int kdtree::nearest(const float q[3], int k, std::vector<uint32_t> &index, std::vector<float> *d2, const accept_t &accept) const
+{
+    index.clear();
+    if(d2) d2->clear();
+    if(_node.empty() || k<=0) return 0;
+
+    typedef std::pair<float,uint32_t> item_t;  //max heap by distance
+    std::vector<item_t> heap;
+    heap.reserve(k+1);
+
+    uint32_t stack[KD_STACK_SIZE];
+    int sp=0;
+    stack[sp++]=0;
+    while(sp)
+    {
+        uint32_t node=stack[--sp];
+        const node_t &x=_node[node];
+        if((int)heap.size()==k && box_dist2(x.bmin,x.bmax,q)>=heap.front().first) continue;
+
+        if(is_leaf(node))
+        {
+            for(uint32_t i=x.begin;i<x.end;i++)
+            {
+                uint32_t id=_index[i];
+                float d=dist2(point(id),q);
+                if((int)heap.size()==k && d>=heap.front().first) continue;
+                if(accept && !accept(id)) continue;
+                if((int)heap.size()==k)
+                {
+                    std::pop_heap(heap.begin(),heap.end());
+                    heap.pop_back();
+                }
+                heap.push_back(item_t(d,id));
+                std::push_heap(heap.begin(),heap.end());
+            }
+        }
+        else
+        {
+            uint32_t l=2*node+1, r=2*node+2;
+            float dl=box_dist2(_node[l].bmin,_node[l].bmax,q);
+            float dr=box_dist2(_node[r].bmin,_node[r].bmax,q);
+            if(dl<dr)
+            {
+                stack[sp++]=r;
+                stack[sp++]=l;
+            }
+            else
+            {
+                stack[sp++]=l;
+                stack[sp++]=r;
+            }
+        }
+    }
+
+    std::sort_heap(heap.begin(),heap.end());
+    for(const auto &i:heap)
+    {
+        index.push_back(i.second);
+        if(d2) d2->push_back(i.first);
+    }
+    return (int)index.size();
+}
+
+int kdtree::radius(const float q[3], float r, std::vector<uint32_t> &index, const accept_t &accept) const
+{
+    index.clear();
+    if(_node.empty() || r<0.0f) return 0;
+
+    float r2=r*r;
+    uint32_t stack[KD_STACK_SIZE];
+    int sp=0;
+    stack[sp++]=0;
+    while(sp)
+    {
+        uint32_t node=stack[--sp];
+        const node_t &x=_node[node];
+        if(box_dist2(x.bmin,x.bmax,q)>r2) continue;
+
+        if(is_leaf(node))
+        {
+            for(uint32_t i=x.begin;i<x.end;i++)
+            {
+                uint32_t id=_index[i];
+                if(dist2(point(id),q)>r2) continue;
+                if(accept && !accept(id)) continue;
+                index.push_back(id);
+            }
+        }
+        else
+        {
+            stack[sp++]=2*node+1;
+            stack[sp++]=2*node+2;
+        }
+    }
+    return (int)index.size();
+}
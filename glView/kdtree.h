@@ -0,0 +1,69 @@
+#ifndef KDTREE_H
+#define KDTREE_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+// k-d tree over an interleaved vertex array (x,y,z at the top of every vertex)
+// the tree is balanced by median split, node i has children 2i+1 and 2i+2.
+// vertex array is not copied, it has to live longer than the tree.
+class kdtree
+{
+public:
+    typedef std::function<bool(uint32_t)> accept_t;  //return false to ignore the point
+
+    kdtree();
+
+    void clear(void);
+    void build(const float *vertex, uint64_t n, int stride);   //stride: number of floats per vertex
+
+    uint64_t size(void) const {return _index.size();}
+    uint64_t bytes(void) const {return _node.size()*sizeof(node_t)+_index.size()*sizeof(uint32_t);}
+
+    // nearest point along the ray within tolerance tol0+slope*t, dir has to be normalized
+    int ray(const float org[3], const float dir[3], float tol0, float slope, uint32_t &index, float &t, const accept_t &accept=nullptr) const;
+
+    // k nearest points sorted by distance
+    int nearest(const float q[3], int k, std::vector<uint32_t> &index, std::vector<float> *d2=nullptr, const accept_t &accept=nullptr) const;
+
+    // all points within radius r
+    int radius(const float q[3], float r, std::vector<uint32_t> &index, const accept_t &accept=nullptr) const;
+
+private:
+    typedef struct
+    {
+        float bmin[3];
+        float bmax[3];
+        uint32_t begin;
+        uint32_t end;
+    } node_t;
+
+    void split_node(uint32_t node, uint32_t begin, uint32_t end, int depth, std::vector<uint32_t> &roots);
+    void build_node(uint32_t node, uint32_t begin, uint32_t end);
+    void bound(uint32_t node, uint32_t begin, uint32_t end);
+    uint32_t partition(uint32_t node, uint32_t begin, uint32_t end);
+
+    const float *point(uint32_t i) const {return _vertex+(uint64_t)i*_stride;}
+    bool is_leaf(uint32_t node) const {return node>=_firstLeaf;}
+
+private:
+    const float *_vertex;
+    int _stride;
+    int _levels;
+    uint32_t _firstLeaf;
+    std::vector<node_t> _node;
+    std::vector<uint32_t> _index;
+};
+
+#endif // KDTREE_H
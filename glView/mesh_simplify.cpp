@@ -0,0 +1,424 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "vertex_cache.h"
+#include "mesh_simplify.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+#define BORDER_WEIGHT 10.0      //quadric of the plane along a border edge, relative to the face area
+#define FLIP_LIMIT 0.2          //cosine of the face normal before and after a collapse
+
+#define KIND_INTERIOR 0
+#define KIND_BORDER 1
+#define KIND_LOCKED 2           //non-manifold edge, never collapsed
+
+// symmetric 4x4 matrix of the squared distance to planes, weighted by the area
+typedef struct
+{
+    double a2,ab,ac,ad,b2,bc,bd,c2,cd,d2;
+    double w;
+} quadric_t;
+
+typedef struct
+{
+    double cost;
+    uint32_t from;
+    uint32_t to;
+    uint32_t stamp_from;    //quadric and neighborhood when it's evaluated
+    uint32_t stamp_to;
+} collapse_t;
+
+struct collapse_order
+{
+    bool operator()(const collapse_t &a, const collapse_t &b) const {return a.cost>b.cost;}
+};
+
+static void quadric_add_plane(quadric_t &q, const double n[3], double d, double w)
+{
+    q.a2+=w*n[0]*n[0];  q.ab+=w*n[0]*n[1];  q.ac+=w*n[0]*n[2];  q.ad+=w*n[0]*d;
+    q.b2+=w*n[1]*n[1];  q.bc+=w*n[1]*n[2];  q.bd+=w*n[1]*d;
+    q.c2+=w*n[2]*n[2];  q.cd+=w*n[2]*d;
+    q.d2+=w*d*d;
+    q.w+=w;
+}
+
+static void quadric_add(quadric_t &q, const quadric_t &x)
+{
+    q.a2+=x.a2; q.ab+=x.ab; q.ac+=x.ac; q.ad+=x.ad;
+    q.b2+=x.b2; q.bc+=x.bc; q.bd+=x.bd;
+    q.c2+=x.c2; q.cd+=x.cd;
+    q.d2+=x.d2;
+    q.w+=x.w;
+}
+
+// mean squared distance of p to the planes of q and r
+static double quadric_error(const quadric_t &q, const quadric_t &r, const double p[3])
+{
+    double x=p[0],y=p[1],z=p[2];
+    double e=(q.a2+r.a2)*x*x + 2*(q.ab+r.ab)*x*y + 2*(q.ac+r.ac)*x*z + 2*(q.ad+r.ad)*x
+            +(q.b2+r.b2)*y*y + 2*(q.bc+r.bc)*y*z + 2*(q.bd+r.bd)*y
+            +(q.c2+r.c2)*z*z + 2*(q.cd+r.cd)*z
+            +(q.d2+r.d2);
+    double w=q.w+r.w;
+    return w>0.0 ? std::fabs(e)/w : 0.0;
+}
+
+static void normal_of(const double *a, const double *b, const double *c, double n[3])
+{
+    double u[3]={b[0]-a[0],b[1]-a[1],b[2]-a[2]};
+    double v[3]={c[0]-a[0],c[1]-a[1],c[2]-a[2]};
+    n[0]=u[1]*v[2]-u[2]*v[1];
+    n[1]=u[2]*v[0]-u[0]*v[2];
+    n[2]=u[0]*v[1]-u[1]*v[0];
+}
+
+static uint64_t edge_key(uint32_t a, uint32_t b)
+{
+    return a<b ? ((uint64_t)a<<32)|b : ((uint64_t)b<<32)|a;
+}
+
+// triangles are collapsed on the welded positions, corners keep their vertices to pick the attributes at the end
+class simplifier
+{
+public:
+    simplifier(const uint32_t *index, size_t n_index, const float *vertex, uint32_t n_vertex, int stride, int pos)
+        : _vertex(vertex), _stride(stride), _pos(pos)
+    {
+        //vertices used by the list
+        std::vector<uint32_t> local(n_vertex, UINT32_MAX);
+        for(size_t i=0;i<n_index;i++)
+        {
+            if(local[index[i]]!=UINT32_MAX) continue;
+            local[index[i]]=(uint32_t)_verts.size();
+            _verts.push_back(index[i]);
+        }
+
+        //vertices of the same position are welded
+        uint32_t nv=(uint32_t)_verts.size();
+        std::vector<uint32_t> order(nv);
+        for(uint32_t i=0;i<nv;i++) order[i]=i;
+        std::sort(order.begin(),order.end(),[this](uint32_t a, uint32_t b){ return memcmp(position(a),position(b),3*sizeof(float))<0; });
+        _posOf.resize(nv);
+        _posTop.push_back(0);
+        for(uint32_t i=0;i<nv;i++)
+        {
+            if(i>0 && memcmp(position(order[i-1]),position(order[i]),3*sizeof(float))!=0) _posTop.push_back(i);
+            _posOf[order[i]]=(uint32_t)_posTop.size()-1;
+        }
+        _posTop.push_back(nv);
+        _posVerts.swap(order);
+
+        uint32_t np=(uint32_t)_posTop.size()-1;
+        _xyz.resize((size_t)np*3);
+        for(uint32_t p=0;p<np;p++)
+        {
+            const float *x=position(_posVerts[_posTop[p]]);
+            for(int k=0;k<3;k++) _xyz[(size_t)p*3+k]=x[k];
+        }
+
+        //triangles, degenerated ones are not drawn anyway
+        for(size_t i=0;i+3<=n_index;i+=3)
+        {
+            uint32_t v[3],p[3];
+            for(int c=0;c<3;c++)
+            {
+                v[c]=local[index[i+c]];
+                p[c]=_posOf[v[c]];
+            }
+            if(p[0]==p[1] || p[1]==p[2] || p[2]==p[0]) continue;
+            _triVert.insert(_triVert.end(),v,v+3);
+            _triPos.insert(_triPos.end(),p,p+3);
+        }
+        _live=_triPos.size()/3;
+        _alive.assign(_live,1);
+
+        _tris.resize(np);
+        _quadric.resize(np);
+        memset(_quadric.data(),0,_quadric.size()*sizeof(quadric_t));
+        _kind.assign(np,KIND_INTERIOR);
+        _stamp.assign(np,0);
+        _collapsed.assign(np,0);
+
+        //edges sorted by the vertices, a border edge has one triangle
+        _edges.reserve(_live*3);
+        for(size_t t=0;t<_live;t++)
+        {
+            for(int c=0;c<3;c++)
+            {
+                _tris[_triPos[t*3+c]].push_back((uint32_t)t);
+                _edges.push_back(edge_t(edge_key(_triPos[t*3+c],_triPos[t*3+(c+1)%3]),(uint32_t)(t*3+c)));
+            }
+        }
+        std::sort(_edges.begin(),_edges.end());
+
+        for(size_t t=0;t<_live;t++)
+        {
+            const uint32_t *p=&_triPos[t*3];
+            double n[3];
+            if(!plane(p,n)) continue;
+            double d=-(n[0]*xyz(p[0])[0]+n[1]*xyz(p[0])[1]+n[2]*xyz(p[0])[2]);
+            for(int c=0;c<3;c++) quadric_add_plane(_quadric[p[c]],n,d,_area);
+        }
+
+        for(size_t i=0,j;i<_edges.size();i=j)
+        {
+            for(j=i+1;j<_edges.size() && _edges[j].first==_edges[i].first;j++);
+            uint32_t a=(uint32_t)(_edges[i].first>>32), b=(uint32_t)_edges[i].first;
+            int kind= j-i==1 ? KIND_BORDER : j-i>2 ? KIND_LOCKED : KIND_INTERIOR;
+            _kind[a]=std::max(_kind[a],kind);
+            _kind[b]=std::max(_kind[b],kind);
+            if(kind!=KIND_BORDER) continue;
+
+            //plane along the border edge keeps the outline
+            double n[3];
+            if(!plane(&_triPos[_edges[i].second/3*3],n)) continue;
+            const double *x=xyz(a), *y=xyz(b);
+            double e[3]={y[0]-x[0],y[1]-x[1],y[2]-x[2]};
+            double m[3]={e[1]*n[2]-e[2]*n[1], e[2]*n[0]-e[0]*n[2], e[0]*n[1]-e[1]*n[0]};
+            double ml=std::sqrt(m[0]*m[0]+m[1]*m[1]+m[2]*m[2]);
+            if(ml<=0.0) continue;
+            for(int k=0;k<3;k++) m[k]/=ml;
+            double md=-(m[0]*x[0]+m[1]*x[1]+m[2]*x[2]);
+            double w=BORDER_WEIGHT*(e[0]*e[0]+e[1]*e[1]+e[2]*e[2]);
+            quadric_add_plane(_quadric[a],m,md,w);
+            quadric_add_plane(_quadric[b],m,md,w);
+        }
+    }
+
+    void run(size_t target_index, float max_error)
+    {
+        _limit=(double)max_error*max_error;
+        for(size_t i=0;i<_edges.size();i++)
+        {
+            if(i>0 && _edges[i].first==_edges[i-1].first) continue;
+            uint32_t a=(uint32_t)(_edges[i].first>>32), b=(uint32_t)_edges[i].first;
+            push(a,b);
+            push(b,a);
+        }
+        std::vector<edge_t>().swap(_edges);
+
+        while(_live*3>target_index && !_queue.empty())
+        {
+            collapse_t x=_queue.top();
+            _queue.pop();
+            if(_collapsed[x.from] || _collapsed[x.to]) continue;
+            if(_stamp[x.from]!=x.stamp_from || _stamp[x.to]!=x.stamp_to) continue;
+            if(!allowed(x.from,x.to)) continue;
+            collapse(x.from,x.to);
+        }
+    }
+
+    size_t result(uint32_t *dst) const
+    {
+        size_t n=0;
+        for(size_t t=0;t<_alive.size();t++)
+        {
+            if(!_alive[t]) continue;
+            for(int c=0;c<3;c++)
+            {
+                uint32_t v=_triVert[t*3+c];
+                uint32_t p=_triPos[t*3+c];
+                if(_posOf[v]!=p) v=nearest(v,p);
+                dst[n++]=_verts[v];
+            }
+        }
+        return n;
+    }
+
+private:
+    const float *position(uint32_t v) const {return _vertex+(size_t)_verts[v]*_stride+_pos;}
+    const double *xyz(uint32_t p) const {return &_xyz[(size_t)p*3];}
+
+    // unit normal of the triangle, and its area in _area
+    bool plane(const uint32_t *p, double n[3])
+    {
+        normal_of(xyz(p[0]),xyz(p[1]),xyz(p[2]),n);
+        double l=std::sqrt(n[0]*n[0]+n[1]*n[1]+n[2]*n[2]);
+        if(l<=0.0) return false;
+        for(int k=0;k<3;k++) n[k]/=l;
+        _area=l*0.5;
+        return true;
+    }
+
+    void push(uint32_t from, uint32_t to)
+    {
+        if(_kind[from]==KIND_LOCKED) return;
+        collapse_t x;
+        x.cost=quadric_error(_quadric[from],_quadric[to],xyz(to));
+        if(x.cost>_limit) return;
+        x.from=from;
+        x.to=to;
+        x.stamp_from=_stamp[from];
+        x.stamp_to=_stamp[to];
+        _queue.push(x);
+    }
+
+    // vertices sharing a triangle with p, and the number of triangles with the edge p-q
+    int neighbors(uint32_t p, uint32_t q, std::vector<uint32_t> &ret) const
+    {
+        int shared=0;
+        ret.clear();
+        for(uint32_t t:_tris[p])
+        {
+            if(!_alive[t]) continue;
+            const uint32_t *x=&_triPos[(size_t)t*3];
+            if(x[0]==q || x[1]==q || x[2]==q) shared++;
+            for(int c=0;c<3;c++)
+            {
+                if(x[c]!=p) ret.push_back(x[c]);
+            }
+        }
+        std::sort(ret.begin(),ret.end());
+        ret.erase(std::unique(ret.begin(),ret.end()),ret.end());
+        return shared;
+    }
+
+    // the border stays on itself, the surface keeps its topology and no face is flipped
+    bool allowed(uint32_t from, uint32_t to)
+    {
+        int shared=neighbors(from,to,_nFrom);
+        if(shared==0) return false;
+        if(_kind[from]==KIND_BORDER && shared!=1) return false;
+        neighbors(to,from,_nTo);
+        size_t common=0;
+        for(size_t i=0,j=0;i<_nFrom.size() && j<_nTo.size();)
+        {
+            if(_nFrom[i]<_nTo[j]) i++;
+            else if(_nFrom[i]>_nTo[j]) j++;
+            else {common++; i++; j++;}
+        }
+        if(common!=(size_t)shared) return false;
+
+        for(uint32_t t:_tris[from])
+        {
+            if(!_alive[t]) continue;
+            const uint32_t *x=&_triPos[(size_t)t*3];
+            if(x[0]==to || x[1]==to || x[2]==to) continue;
+            const double *p[3], *q[3];
+            for(int c=0;c<3;c++)
+            {
+                p[c]=xyz(x[c]);
+                q[c]= x[c]==from ? xyz(to) : p[c];
+            }
+            double a[3],b[3];
+            normal_of(p[0],p[1],p[2],a);
+            normal_of(q[0],q[1],q[2],b);
+            double la=std::sqrt(a[0]*a[0]+a[1]*a[1]+a[2]*a[2]);
+            double lb=std::sqrt(b[0]*b[0]+b[1]*b[1]+b[2]*b[2]);
+            if(lb<=0.0) return false;
+            if(a[0]*b[0]+a[1]*b[1]+a[2]*b[2] < FLIP_LIMIT*la*lb) return false;
+        }
+        return true;
+    }
+
+    void collapse(uint32_t from, uint32_t to)
+    {
+        quadric_add(_quadric[to],_quadric[from]);
+        _collapsed[from]=1;
+        _stamp[to]++;
+
+        std::vector<uint32_t> &tt=_tris[to];
+        for(uint32_t t:_tris[from])
+        {
+            if(!_alive[t]) continue;
+            uint32_t *x=&_triPos[(size_t)t*3];
+            if(x[0]==to || x[1]==to || x[2]==to)
+            {
+                _alive[t]=0;
+                _live--;
+                continue;
+            }
+            for(int c=0;c<3;c++)
+            {
+                if(x[c]==from) x[c]=to;
+            }
+            tt.push_back(t);
+        }
+        std::vector<uint32_t>().swap(_tris[from]);
+        tt.erase(std::remove_if(tt.begin(),tt.end(),[this](uint32_t t){ return !_alive[t]; }),tt.end());
+
+        neighbors(to,to,_nTo);
+        for(uint32_t x:_nTo)
+        {
+            push(to,x);
+            push(x,to);
+        }
+    }
+
+    // vertex at position p whose attributes are the nearest to v
+    uint32_t nearest(uint32_t v, uint32_t p) const
+    {
+        const float *a=_vertex+(size_t)_verts[v]*_stride;
+        uint32_t ret=_posVerts[_posTop[p]];
+        float best=-1.0f;
+        for(uint32_t i=_posTop[p];i<_posTop[p+1];i++)
+        {
+            const float *b=_vertex+(size_t)_verts[_posVerts[i]]*_stride;
+            float d=0.0f;
+            for(int k=0;k<_stride;k++)
+            {
+                if(k>=_pos && k<_pos+3) continue;
+                d+=(a[k]-b[k])*(a[k]-b[k]);
+            }
+            if(best<0.0f || d<best)
+            {
+                best=d;
+                ret=_posVerts[i];
+            }
+        }
+        return ret;
+    }
+
+private:
+    const float *_vertex;
+    int _stride;
+    int _pos;
+
+    std::vector<uint32_t> _verts;       //vertex of the list
+    std::vector<uint32_t> _posOf;       //position of the vertex
+    std::vector<uint32_t> _posTop;      //vertices of a position are _posVerts[_posTop[p]] to [_posTop[p+1]-1]
+    std::vector<uint32_t> _posVerts;
+    std::vector<double> _xyz;
+
+    std::vector<uint32_t> _triVert;     //corners as vertices, they are not changed
+    std::vector<uint32_t> _triPos;      //corners as positions, collapsed ones are replaced
+    std::vector<uint8_t> _alive;
+    size_t _live;
+
+    typedef std::pair<uint64_t,uint32_t> edge_t;   //vertices and the corner
+    std::vector<edge_t> _edges;
+    double _area;
+
+    std::vector<std::vector<uint32_t>> _tris;  //triangles of a position
+    std::vector<quadric_t> _quadric;
+    std::vector<int> _kind;
+    std::vector<uint32_t> _stamp;
+    std::vector<uint8_t> _collapsed;
+
+    std::priority_queue<collapse_t, std::vector<collapse_t>, collapse_order> _queue;   //only collapses within the limit
+    double _limit;
+    std::vector<uint32_t> _nFrom;
+    std::vector<uint32_t> _nTo;
+};
+
+size_t mesh_simplify(uint32_t *dst, const uint32_t *index, size_t n_index, const float *vertex, uint32_t n_vertex, int stride, int pos,
+                     size_t target_index, float max_error)
+{
+    if(n_index<3) return 0;
+    simplifier s(index,n_index,vertex,n_vertex,stride,pos);
+    s.run(target_index,max_error);
+    return s.result(dst);
+}
@@ -0,0 +1,26 @@
+#ifndef MESH_SIMPLIFY_H
+#define MESH_SIMPLIFY_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cstdint>
+#include <cstddef>
+
+// quadric error edge collapse of an indexed triangle list (Garland-Heckbert), for coarser levels of detail
+// a vertex is collapsed into one of its neighbors, so the result refers to the same vertices and no vertex is made.
+// vertices are 'stride' floats, the position is at 'pos'. the other floats are attributes, corners of a collapsed
+// vertex take the vertex of the same position whose attributes are the nearest.
+// collapse stops at target_index or when the error exceeds max_error (distance). dst may be the index list itself.
+// border of the list is collapsed only along itself. returns the number of indices written to dst.
+size_t mesh_simplify(uint32_t *dst, const uint32_t *index, size_t n_index, const float *vertex, uint32_t n_vertex, int stride, int pos,
+                     size_t target_index, float max_error);
+
+#endif // MESH_SIMPLIFY_H
@@ -0,0 +1,192 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "model_w2m.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <string>
+
+static bool little_endian(void)
+{
+    const uint32_t x=1;
+    return *(const uint8_t*)&x==1;
+}
+
+static uint64_t aligned(uint64_t x)
+{
+    return (x+W2M_ALIGN-1)/W2M_ALIGN*W2M_ALIGN;
+}
+
+// block of n items of s bytes at offset is inside the file
+static bool in_file(uint64_t offset, uint64_t n, uint64_t s, uint64_t size)
+{
+    if(offset%W2M_ALIGN!=0 || offset>size) return false;
+    return n<=(size-offset)/s;
+}
+
+w2m_file::w2m_file()
+{
+    _h=nullptr;
+}
+
+bool w2m_file::open(const char *fname)
+{
+    close();
+    if(!little_endian() || !_file.open(fname)) return false;
+
+    const char *top=_file.begin();
+    uint64_t size=_file.size();
+    const w2m_header_t *h=(const w2m_header_t*)top;
+    bool ok= ((uintptr_t)top%sizeof(uint64_t))==0 &&
+             size>=sizeof(w2m_header_t) &&
+             h->magic==W2M_MAGIC && h->version==W2M_VERSION &&
+             h->levels>=1 && h->levels<=W2M_LEVELS &&
+             in_file(h->vertex_offset,h->vertices,W2M_VERTEX_FLOATS*sizeof(float),size) &&
+             in_file(h->index_offset,h->indices,sizeof(uint32_t),size) &&
+             in_file(h->group_offset,h->groups,sizeof(w2m_group_t),size) &&
+             in_file(h->element_offset,h->elements,sizeof(w2m_element_t),size) &&
+             in_file(h->material_offset,h->materials,sizeof(w2m_material_t),size) &&
+             in_file(h->string_offset,h->string_bytes,1,size) &&
+             h->string_bytes>0 && top[h->string_offset+h->string_bytes-1]=='\0';
+    if(ok)
+    {
+        _h=h;
+        const w2m_element_t *e=element();
+        for(uint32_t i=0;ok && i<h->elements;i++)
+        {
+            ok= e[i].idx_material>=0 && (uint32_t)e[i].idx_material<h->materials;
+            if(ok && e[i].group_top)
+            {   //the top element of a group gives its rotation
+                ok= e[i].group_id>=0 && (uint32_t)e[i].group_id<h->groups;
+            }
+            for(uint32_t l=0;ok && l<h->levels;l++)
+            {
+                ok= e[i].idx_top[l]<=h->indices && e[i].num_index[l]<=h->indices-e[i].idx_top[l];
+            }
+        }
+        const w2m_material_t *m=(const w2m_material_t*)(top+h->material_offset);
+        for(uint32_t i=0;ok && i<h->materials;i++)
+        {
+            ok= m[i].name<h->string_bytes && m[i].tex<h->string_bytes;
+        }
+        const uint32_t *x=index();
+        for(uint64_t i=0;ok && i<h->indices;i++)
+        {
+            ok= x[i]<h->vertices;   //the index buffer never refers outside of the vertex buffer
+        }
+    }
+    if(!ok) close();
+    return ok;
+}
+
+void w2m_file::close(void)
+{
+    _h=nullptr;
+    _file.close();
+}
+
+void w2m_file::materials(material_list &ret) const
+{
+    ret.clear();
+    if(_h==nullptr) return;
+
+    const w2m_material_t *x=(const w2m_material_t*)(_file.begin()+_h->material_offset);
+    const char *str=_file.begin()+_h->string_offset;
+    for(uint32_t i=0;i<_h->materials;i++)
+    {
+        material_type m;
+        reset_material(&m);
+        for(int k=0;k<4;k++)
+        {
+            m.col[k]=x[i].col[k];
+            m.dif[k]=x[i].dif[k];
+            m.amb[k]=x[i].amb[k];
+            m.emi[k]=x[i].emi[k];
+            m.spc[k]=x[i].spc[k];
+        }
+        m.pwr=x[i].pwr;
+        m.name=str+x[i].name;
+        m.tex=str+x[i].tex;
+        ret.push_back(m);
+    }
+}
+
+// strings are appended after the empty one at 0
+static uint32_t add_string(std::string &table, const std::string &s)
+{
+    if(s.empty()) return 0;
+    uint32_t ret=(uint32_t)table.size();
+    table.append(s.c_str(),s.size()+1);
+    return ret;
+}
+
+// padded up to offset, pos is the end of the previous block
+static bool write_block(FILE *fp, uint64_t &pos, uint64_t offset, const void *data, uint64_t bytes)
+{
+    static const char zero[W2M_ALIGN]={0};
+    if(pos>offset || offset-pos>W2M_ALIGN) return false;
+    if(fwrite(zero,1,(size_t)(offset-pos),fp)!=(size_t)(offset-pos)) return false;
+    pos=offset+bytes;
+    return bytes==0 || fwrite(data,1,(size_t)bytes,fp)==(size_t)bytes;
+}
+
+int export_w2m(const char *fname, const w2m_header_t &h, const float *vertex, const uint32_t *index,
+               const w2m_group_t *group, const w2m_element_t *element, const material_list &materials)
+{
+    if(!little_endian() || h.levels<1 || h.levels>W2M_LEVELS) return 0;
+
+    std::string str(1,'\0');
+    std::vector<w2m_material_t> mate;
+    for(const auto &m:materials)
+    {
+        w2m_material_t y;
+        memset(&y,0,sizeof(y));
+        for(int k=0;k<4;k++)
+        {
+            y.col[k]=(float)m.col[k];
+            y.dif[k]=(float)m.dif[k];
+            y.amb[k]=(float)m.amb[k];
+            y.emi[k]=(float)m.emi[k];
+            y.spc[k]=(float)m.spc[k];
+        }
+        y.pwr=(float)m.pwr;
+        y.name=add_string(str,m.name);
+        y.tex=add_string(str,m.tex);
+        mate.push_back(y);
+    }
+
+    w2m_header_t x=h;
+    x.magic=W2M_MAGIC;
+    x.version=W2M_VERSION;
+    x.materials=(uint32_t)mate.size();
+    x.vertex_offset=aligned(sizeof(w2m_header_t));
+    x.index_offset=aligned(x.vertex_offset+x.vertices*W2M_VERTEX_FLOATS*sizeof(float));
+    x.group_offset=aligned(x.index_offset+x.indices*sizeof(uint32_t));
+    x.element_offset=aligned(x.group_offset+x.groups*sizeof(w2m_group_t));
+    x.material_offset=aligned(x.element_offset+x.elements*sizeof(w2m_element_t));
+    x.string_offset=aligned(x.material_offset+x.materials*sizeof(w2m_material_t));
+    x.string_bytes=str.size();
+
+    FILE *fp=fopen(fname,"wb");
+    if(fp==NULL) return 0;
+    uint64_t pos=0;
+    bool ok= write_block(fp,pos,0,&x,sizeof(x)) &&
+             write_block(fp,pos,x.vertex_offset,vertex,x.vertices*W2M_VERTEX_FLOATS*sizeof(float)) &&
+             write_block(fp,pos,x.index_offset,index,x.indices*sizeof(uint32_t)) &&
+             write_block(fp,pos,x.group_offset,group,x.groups*sizeof(w2m_group_t)) &&
+             write_block(fp,pos,x.element_offset,element,x.elements*sizeof(w2m_element_t)) &&
+             write_block(fp,pos,x.material_offset,mate.data(),x.materials*sizeof(w2m_material_t)) &&
+             write_block(fp,pos,x.string_offset,str.data(),x.string_bytes);
+    ok= (fclose(fp)==0) && ok;
+    return ok ? 1 : 0;
+}
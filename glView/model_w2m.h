@@ -0,0 +1,106 @@
+#ifndef MODEL_W2M_H
+#define MODEL_W2M_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "model.h"
+#include "text_scanner.h"
+
+#include <cstdint>
+#include <cstddef>
+
+// flat mesh, the compiled model as it is drawn. little-endian, every block is aligned to W2M_ALIGN from the top.
+// header, vertex block (W2M_VERTEX_FLOATS per vertex), index block (uint32), groups, elements, materials and
+// the string table (names and texture files of the materials, NUL terminated, offset 0 is the empty string).
+#define W2M_MAGIC   (0x4d325757u)   //"WW2M"
+#define W2M_VERSION (1)
+#define W2M_ALIGN   (16)
+#define W2M_LEVELS  (4)             //room for levels of detail of an element
+#define W2M_VERTEX_FLOATS (8)       //texture coord, normal, position
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint8_t key[20];        //SHA1 of the source, zero when it's unknown
+    uint32_t levels;        //levels of detail in use
+    uint32_t groups;
+    uint32_t elements;
+    uint32_t materials;
+    float radius;           //from the model origin
+    uint64_t vertices;
+    uint64_t indices;
+    uint64_t vertex_offset; //from the top of the file
+    uint64_t index_offset;
+    uint64_t group_offset;
+    uint64_t element_offset;
+    uint64_t material_offset;
+    uint64_t string_offset;
+    uint64_t string_bytes;
+} w2m_header_t;
+
+typedef struct
+{
+    float cg[3];
+    float axis[3];          //zero when the group doesn't rotate
+} w2m_group_t;
+
+typedef struct
+{
+    int32_t shadeModel;
+    int32_t idx_material;
+    int32_t group_id;
+    int32_t group_top;
+    uint64_t idx_top[W2M_LEVELS];
+    uint64_t num_index[W2M_LEVELS];
+} w2m_element_t;
+
+typedef struct
+{
+    float col[4];
+    float dif[4];
+    float amb[4];
+    float emi[4];
+    float spc[4];
+    float pwr;
+    uint32_t name;          //offset in the string table
+    uint32_t tex;
+    uint32_t reserved;
+} w2m_material_t;
+
+// mapped flat mesh, blocks are used in place and valid until close()
+// open() checks the header, the block bounds and that every index refers to a vertex.
+class w2m_file
+{
+public:
+    w2m_file();
+
+    bool open(const char *fname);
+    void close(void);
+
+    const w2m_header_t &header(void) const {return *_h;}
+    const float *vertex(void) const {return (const float*)(_file.begin()+_h->vertex_offset);}
+    const uint32_t *index(void) const {return (const uint32_t*)(_file.begin()+_h->index_offset);}
+    const w2m_group_t *group(void) const {return (const w2m_group_t*)(_file.begin()+_h->group_offset);}
+    const w2m_element_t *element(void) const {return (const w2m_element_t*)(_file.begin()+_h->element_offset);}
+    void materials(material_list &ret) const;
+    size_t size(void) const {return _file.size();}
+
+private:
+    text_file _file;
+    const w2m_header_t *_h;          //nullptr when it's not open
+};
+
+// counts and key of h are used, offsets are made. materials are the material table, returns 0 when it fails
+int export_w2m(const char *fname, const w2m_header_t &h, const float *vertex, const uint32_t *index,
+               const w2m_group_t *group, const w2m_element_t *element, const material_list &materials);
+
+#endif // MODEL_W2M_H
@@ -9,22 +9,23 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 */
 
 #include "model.h"
+#include "text_scanner.h"
+#include "parallel.h"
 #include <stdio.h>
 #include <cstring>
+#include <atomic>
+
+#define MQO_PARALLEL_LINES 65536    //vertex and face blocks longer than this are parsed by threads
 
 class mqoImport
 {
-#define LINE_BUF_SIZE 1024
-    std::string line_;
-    std::string temp_;
-    char *line;
-    char *temp;
-    FILE *fp;
+    std::string temp;
+    text_scanner *sc;
 
 	int get_line(void);
 	int parse_material(int n,material_list *mate);
     int parse_w2r(int n,model_type *data);
-    int parse_object(char *name,object_list *obj);
+    int parse_object(const std::string &name,object_list *obj);
 	int parse_vertex(int n,vertex_list *vertex);
 	int parse_face(int n,face_list *face);
 
@@ -41,11 +42,7 @@ public:
 
 mqoImport::mqoImport()
 {
-    line_.resize(LINE_BUF_SIZE);
-    temp_.resize(LINE_BUF_SIZE);
-    line=&line_[0];
-    temp=&temp_[0];
-	fp=NULL;
+    sc=NULL;
 }
 
 mqoImport::~mqoImport()
@@ -54,7 +51,18 @@ mqoImport::~mqoImport()
 
 int mqoImport::get_line(void)
 {
-    return fgets(line,LINE_BUF_SIZE,fp)!=NULL;
+    return sc->next_line();
+}
+
+// lines of a block are independent, func(first,last) is called for ranges of them
+template<typename F> static void for_lines(size_t n, F func)
+{
+    if(n<MQO_PARALLEL_LINES)
+    {
+        func(0,n);
+        return;
+    }
+    parallel::for_chunks(n, parallel::chunk_size(n, MQO_PARALLEL_LINES/4), func);
 }
 
 static void expand_material(double x,double c[4],double *ret)
@@ -68,7 +76,6 @@ static void expand_material(double x,double c[4],double *ret)
 int mqoImport::parse_w2r(int n,model_type *data)
 {
 	int i;
-    char *p;
     std::string name;
 	model_import_params_t par;
 
@@ -76,18 +83,16 @@ int mqoImport::parse_w2r(int n,model_type *data)
 	{
 		if(get_line())
 		{
-            if( (p=strstr(line,"\""))!=NULL )
+            if(sc->seek("\""))
 			{
-                if(1!=sscanf(++p,"%[^\"]s",temp))
+                if(!sc->until('"',temp))
 				{
 					return 0;
 				}
 				name=temp;
-                p+=strlen(temp);
-				p++;
-                if( (p=strstr(p,"\""))!=NULL )
+                if(sc->skip_to('"'))
 				{
-                    if(1!=sscanf(++p,"%[^\"]s",temp))
+                    if(!sc->until('"',temp))
 					{
 						return 0;
 					}
@@ -107,7 +112,6 @@ int mqoImport::parse_w2r(int n,model_type *data)
 int mqoImport::parse_material(int n,material_list *mate)
 {
 	int i;
-    char *p;
 	material_type m;
 	double dif,amb,emi,spc;
 
@@ -118,59 +122,59 @@ int mqoImport::parse_material(int n,material_list *mate)
 //"1" shader(3) col(1.000 1.000 1.000 1.000) dif(0.498) amb(1.000) emi(0.000) spc(0.000) power(5.00) tex("C:\Users\hideki\Desktop\Sofa-37\HST1-2.jpg")		
 			dif=amb=emi=spc=0.0;
 			reset_material(&m);
-            if( (p=strstr(line,"\""))!=NULL )
+            if(sc->seek("\""))
 			{
-                if(1!=sscanf(++p,"%[^\"]s",temp))
+                if(!sc->until('"',temp))
 				{
 					return 0;
 				}
 				m.name=temp;
 			}
-            if( (p=strstr(line,"col("))!=NULL )
+            if(sc->seek("col("))
 			{
-                if(4!=sscanf(p,"col(%lf %lf %lf %lf",&m.col[0],&m.col[1],&m.col[2],&m.col[3]))
+                if(!(sc->real(m.col[0]) && sc->real(m.col[1]) && sc->real(m.col[2]) && sc->real(m.col[3])))
 				{
 					return 0;
 				}
 			}
-            if( (p=strstr(line,"dif("))!=NULL )
+            if(sc->seek("dif("))
 			{
-                if(1!=sscanf(p,"dif(%lf",&dif))
+                if(!sc->real(dif))
 				{
 					return 0;
 				}
 			}
-            if( (p=strstr(line,"amb("))!=NULL )
+            if(sc->seek("amb("))
 			{
-                if(1!=sscanf(p,"amb(%lf",&amb))
+                if(!sc->real(amb))
 				{
 					return 0;
 				}
 			}
-            if( (p=strstr(line,"emi("))!=NULL )
+            if(sc->seek("emi("))
 			{
-                if(1!=sscanf(p,"emi(%lf",&emi))
+                if(!sc->real(emi))
 				{
 					return 0;
 				}
 			}
-            if( (p=strstr(line,"spc("))!=NULL )
+            if(sc->seek("spc("))
 			{
-                if(1!=sscanf(p,"spc(%lf",&spc))
+                if(!sc->real(spc))
 				{
 					return 0;
 				}
 			}
-            if( (p=strstr(line,"power("))!=NULL )
+            if(sc->seek("power("))
 			{
-                if(1!=sscanf(p,"power(%lf",&m.pwr))
+                if(!sc->real(m.pwr))
 				{
 					return 0;
 				}
 			}
-            if( (p=strstr(line,"tex("))!=NULL )
+            if(sc->seek("tex("))
 			{
-                if(1!=sscanf(p,"tex(\"%[^\"]s",temp))
+                if(!(sc->next_is('"') && sc->until('"',temp)))
 				{
 					return 0;
 				}
@@ -188,33 +192,38 @@ int mqoImport::parse_material(int n,material_list *mate)
 
 int mqoImport::parse_vertex(int n,vertex_list *vertex)
 {
-	int i,k;
-	double x,y,z;
-	vertex_type v;
-	k=0;
-	for(i=0;i<n;i++)
-	{
-		if(!get_line()) return 0;
-        if(3!=sscanf(line,"%lf %lf %lf",&x,&y,&z))
-		{
-			return 0;
-		}
-		//mqo to opengl
-        //v.x=z;
-        //v.y=x;
-        //v.z=y;
-		v.x=vertex_mat[0]*x+vertex_mat[1]*y+vertex_mat[2]*z+vertex_mat[3];
-		v.y=vertex_mat[4]*x+vertex_mat[5]*y+vertex_mat[6]*z+vertex_mat[7];
-		v.z=vertex_mat[8]*x+vertex_mat[9]*y+vertex_mat[10]*z+vertex_mat[11];
-		vertex->push_back(v);
-		k++;
-	}
+    std::vector<const char*> tops;
+    if(n<0 || !sc->lines((size_t)n,tops)) return 0;
+
+    size_t top=vertex->size();
+    vertex->resize(top+n);
+    std::atomic<int> ok(1);
+    for_lines((size_t)n, [&](quint64 first, quint64 last)
+    {
+        for(quint64 i=first;i<last;i++)
+        {
+            text_scanner s(tops[i],tops[i+1]);
+            double x,y,z;
+            if(!(s.next_line() && s.real(x) && s.real(y) && s.real(z)))
+            {
+                ok=0;
+                return;
+            }
+            //mqo to opengl
+            //v.x=z;
+            //v.y=x;
+            //v.z=y;
+            vertex_type &v=(*vertex)[top+i];
+            v.x=vertex_mat[0]*x+vertex_mat[1]*y+vertex_mat[2]*z+vertex_mat[3];
+            v.y=vertex_mat[4]*x+vertex_mat[5]*y+vertex_mat[6]*z+vertex_mat[7];
+            v.z=vertex_mat[8]*x+vertex_mat[9]*y+vertex_mat[10]*z+vertex_mat[11];
+        }
+    });
+    if(!ok) return 0;
+
 	if(get_line())
 	{
-        if( strstr(line,"}")!=NULL )
-		{
-			return n==k;
-		}
+        return sc->seek("}");
 	}
 	return 0;
 }
@@ -253,71 +262,69 @@ static void reverse_face_mqo_to_opengl(face_type *x)
 	}
 }
 
+static int parse_face_line(text_scanner &s,face_type &f)
+{
+	int k,vn;
+	reset_face(&f);
+    if(!(s.next_line() && s.integer(vn))) return 0;
+    if(vn!=3 && vn!=4) return 0;
+    f.n=vn;
+
+    if(s.seek("V("))
+    {
+        for(k=0;k<vn;k++)
+        {
+            if(!s.integer(f.v[k])) return 0;
+        }
+    }
+    if(s.seek("M("))
+    {
+        if(!s.integer(f.m)) return 0;
+    }
+    if(s.seek("UV("))
+    {
+        for(k=0;k<vn*2;k++)
+        {
+            if(!s.real(f.uv[k])) return 0;
+        }
+        f.uv[1]=1.0-f.uv[1];
+        f.uv[3]=1.0-f.uv[3];
+        f.uv[5]=1.0-f.uv[5];
+        f.uv[7]=1.0-f.uv[7];
+    }
+    if(s.seek("COL("))
+    {
+        if(!s.integer(f.col)) return 0;
+    }
+    reverse_face_mqo_to_opengl(&f);
+    return 1;
+}
+
 int mqoImport::parse_face(int n,face_list *face)
 {
-	int i,k,vn;
-    char *p;
-	face_type f;
+    std::vector<const char*> tops;
+    if(n<0 || !sc->lines((size_t)n,tops)) return 0;
+
+    size_t top=face->size();
+    face->resize(top+n);
+    std::atomic<int> ok(1);
+    for_lines((size_t)n, [&](quint64 first, quint64 last)
+    {
+        for(quint64 i=first;i<last;i++)
+        {
+            text_scanner s(tops[i],tops[i+1]);
+            if(!parse_face_line(s,(*face)[top+i]))
+            {
+                ok=0;
+                return;
+            }
+        }
+    });
+    if(!ok) return 0;
 
-	k=0;
-	for(i=0;i<n;i++)
-	{
-		if(!get_line()) return 0;
-		reset_face(&f);
-        if(1==sscanf(line,"%d",&vn))
-		{
-			if(vn==3 || vn==4)
-			{
-				f.n=vn;
-			
-                if( (p=strstr(line,"V("))!=NULL )
-				{
-                    if(vn!=sscanf(p,"V(%d %d %d %d",&f.v[0],&f.v[1],&f.v[2],&f.v[3]))
-					{
-						return 0;
-					}
-				}
-                if( (p=strstr(line,"M("))!=NULL )
-				{
-                    if(1!=sscanf(p,"M(%d",&f.m))
-					{
-						return 0;
-					}
-				}
-                if( (p=strstr(line,"UV("))!=NULL )
-				{
-                    if((vn*2)!=sscanf(p,"UV(%lf %lf %lf %lf %lf %lf %lf %lf",&f.uv[0],&f.uv[1],&f.uv[2],&f.uv[3],&f.uv[4],&f.uv[5],&f.uv[6],&f.uv[7]))
-					{
-						return 0;
-					}
-					f.uv[1]=1.0-f.uv[1];
-					f.uv[3]=1.0-f.uv[3];
-					f.uv[5]=1.0-f.uv[5];
-					f.uv[7]=1.0-f.uv[7];
-				}
-                if( (p=strstr(line,"COL("))!=NULL )
-				{
-                    if(1!=sscanf(p,"COL(%lu",&f.col))
-					{
-						return 0;
-					}
-				}
-				reverse_face_mqo_to_opengl(&f);
-				face->push_back(f);
-				k++;
-			}
-			else
-			{
-				return 0;
-			}
-		}
-	}
 	if(get_line())
 	{
-        if( strstr(line,"}")!=NULL )
-		{
-			return n==k;
-		}
+        return sc->seek("}");
 	}
 	return 0;
 }
@@ -343,11 +350,10 @@ static void conv_mirror(object_type &o,int mirror_axis)
     o.name+="(mirror)";
 }
 
-int mqoImport::parse_object(char *name, object_list *obj)
+int mqoImport::parse_object(const std::string &name, object_list *obj)
 {
 	int n;
 	int mirror,mirror_axis;
-    char *p;
 	object_type o;
 
 	reset_object(&o);
@@ -357,80 +363,80 @@ int mqoImport::parse_object(char *name, object_list *obj)
 	for(;;)
 	{
 		if(!get_line()) return 0;
-        if( (p=strstr(line,"visible "))!=NULL )
+        if(sc->seek("visible "))
 		{
-            if(1!=sscanf(p,"visible %d",&o.visible))
+            if(!sc->integer(o.visible))
 			{
 				return 0;
 			}
 		}
-        if( (p=strstr(line,"shading "))!=NULL )
+        if(sc->seek("shading "))
 		{
-            if(1!=sscanf(p,"shading %d",&o.shading))
+            if(!sc->integer(o.shading))
 			{
 				return 0;
 			}
 		}
-        if( (p=strstr(line,"mirror "))!=NULL )
+        if(sc->seek("mirror "))
 		{
-            if(1!=sscanf(p,"mirror %d",&mirror))
+            if(!sc->integer(mirror))
 			{
 				return 0;
 			}
 		}
-        if( (p=strstr(line,"mirror_axis "))!=NULL )
+        if(sc->seek("mirror_axis "))
 		{
-            if(1!=sscanf(p,"mirror_axis %d",&mirror_axis))
+            if(!sc->integer(mirror_axis))
 			{
 				return 0;
 			}
 		}
 
-        if( (p=strstr(line,"scale "))!=NULL )
+        if(sc->seek("scale "))
 		{
-            if(3!=sscanf(p,"scale %lf %lf %lf",&o.scale[0],&o.scale[1],&o.scale[2]))
+            if(!(sc->real(o.scale[0]) && sc->real(o.scale[1]) && sc->real(o.scale[2])))
 			{
 				return 0;
 			}
 		}
-        if( (p=strstr(line,"rotation "))!=NULL )
+        if(sc->seek("rotation "))
 		{
-            if(3!=sscanf(p,"rotation %lf %lf %lf",&o.rot[0],&o.rot[1],&o.rot[2]))
+            if(!(sc->real(o.rot[0]) && sc->real(o.rot[1]) && sc->real(o.rot[2])))
 			{
 				return 0;
 			}
 		}
-        if( (p=strstr(line,"translation "))!=NULL )
+        if(sc->seek("translation "))
 		{
-            if(3!=sscanf(p,"translation %lf %lf %lf",&o.trans[0],&o.trans[1],&o.trans[2]))
+            if(!(sc->real(o.trans[0]) && sc->real(o.trans[1]) && sc->real(o.trans[2])))
 			{
 				return 0;
 			}
 		}
-        if( (p=strstr(line,"facet "))!=NULL )
+        if(sc->seek("facet "))
 		{
-            if(1!=sscanf(p,"facet %lf",&o.facet))
+            if(!sc->real(o.facet))
 			{
 				return 0;
 			}
 		}
-        if( (p=strstr(line,"vertex "))!=NULL )
+        if(sc->seek("vertex "))
 		{
-            if(1==sscanf(p,"vertex %d",&n))
+            if(sc->integer(n))
 			{
 				if(parse_vertex(n,&o.v)) continue;
 				return 0;
 			}
 		}
-        if( (p=strstr(line,"face "))!=NULL )
+        if(sc->seek("face "))
 		{
-            if(1==sscanf(p,"face %d",&n))
+            if(sc->integer(n))
 			{
 				if(parse_face(n,&o.f)) continue;
 				return 0;
 			}
 		}
-        if( strstr(line,"}")!=NULL )
+        if(sc->seek("}"))
 		{
 			if(o.visible || (!o.visible && !discard_hidden))
 			{
@@ -511,37 +517,38 @@ int mqoImport::load(const char *fname,model_type *data,model_import_params_t *pa
 	int ret=0;
 	reset_model(data);
 	parse_param(para);
-    fp=fopen(fname,"rt");
-    if(fp!=NULL)
+    text_file file;
+    if(file.open(fname))
 	{
+        text_scanner s(file.begin(),file.end());
+        sc=&s;
 		int n;
-        char *p;
 		ret=1;
 		while(get_line())
 		{
-            if(1==sscanf(line,"Material %d",&n))
+            if(sc->keyword("Material") && sc->integer(n))
 			{
 				if(parse_material(n,&data->mate)) continue;
 				ret=0;
 				break;
 			}
-            else if( (p=strstr(line,"Object "))==line )
+            else if(sc->keyword("Object"))
 			{
-                if(1==sscanf(line,"Object \"%[^\"]s",temp))
+                if(sc->seek("\"") && sc->until('"',temp))
 				{
 					if(parse_object(temp,&data->obj)) continue;
 					ret=0;
 					break;
 				}
 			}
-            else if(1==sscanf(line,"W2R %d",&n))
+            else if(sc->keyword("W2R") && sc->integer(n))
 			{
                 if(parse_w2r(n,data)) continue;
 				ret=0;
 				break;
 			}
 		}
-		fclose(fp);
+        sc=NULL;
 	}
 	if(ret)
 	{
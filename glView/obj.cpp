@@ -9,6 +9,8 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 */
 
 #include "model.h"
+#include "text_scanner.h"
+#include "parallel.h"
 
 #if __GNUC__==7
 #include <experimental/filesystem>
@@ -23,46 +25,53 @@ namespace fs = std::filesystem;
 #include <string>
 #include <map>
 
-typedef std::map<std::string,int> mtl_map;
+#define OBJ_CHUNK_BYTES (4<<20)     //minimum bytes of a chunk parsed by a thread
 
-class objImport
-{
-#define LINE_BUF_SIZE 1024
-    std::string line_;
-    std::string temp_;
-    char *line;
-    char *temp;
-    FILE *fp;
+#define OBJ_V_LOCAL 0x001           //<<corner, negative index, counted from the top of the chunk
+#define OBJ_T_LOCAL 0x010
+#define OBJ_T_NONE  0x100           //<<corner, no texture coord
 
-	int get_line(void);
-
-    int parse_material(const char *name, material_list *mate, mtl_map *map);
-	int parse_face(object_type &o,int cur_mtl,vertex_list &vt);
+#define OBJ_EVENT_GROUP  0
+#define OBJ_EVENT_USEMTL 1
+#define OBJ_EVENT_MTLLIB 2
 
-public:
-    objImport();
-    ~objImport();
-    int load(const char *x,model_type *data);
-};
+typedef std::map<std::string,int> mtl_map;
 
+typedef struct
+{
+    int n;
+    int v[4];           //0 based in the file, or in the chunk by OBJ_V_LOCAL
+    int t[4];
+    unsigned flags;
+} obj_face_t;
 
-objImport::objImport()
+typedef struct
 {
-    line_.resize(LINE_BUF_SIZE);
-    temp_.resize(LINE_BUF_SIZE);
-    line = &line_[0];
-    temp = &temp_[0];
-    fp=NULL;
-}
+    int type;
+    size_t face;        //faces of the chunk before the event
+    std::string name;
+} obj_event_t;
 
-objImport::~objImport()
+// result of a range of lines, chunks are merged in the order of the file
+typedef struct
 {
-}
+    vertex_list v;
+    vertex_list vt;
+    std::vector<obj_face_t> f;
+    std::vector<obj_event_t> e;
+} obj_chunk_t;
 
-int objImport::get_line(void)
+class objImport
 {
-    return fgets(&line[0],LINE_BUF_SIZE,fp)!=NULL;
-}
+    int parse_material(const char *name, material_list *mate, mtl_map *map);
+
+    static void parse_chunk(const char *begin, const char *end, obj_chunk_t &c);
+    static void parse_face(text_scanner &s, obj_chunk_t &c);
+    static void add_face(object_type &o, const obj_face_t &x, int cur_mtl, size_t v_offset, size_t t_offset, size_t nv, const vertex_list &vt);
+
+public:
+    int load(const char *x,model_type *data);
+};
 
 #if 0
 newmtl texture
@@ -81,37 +90,47 @@ int objImport::parse_material(const char *fname,material_list *mate,mtl_map *map
 	int idx=1;	//start from 1
 
 	double alpha;
-    fp=fopen(fname,"rt");
-    if(fp!=NULL)
+    text_file file;
+    if(file.open(fname))
 	{
-        char *p;
-		while(get_line())
+        text_scanner s(file.begin(),file.end());
+        std::string temp;
+		while(s.next_line())
 		{
-            if(1==sscanf(line,"Ns %lf",&m.pwr))/* wavefront shininess is from [0, 1000], so scale for OpenGL */
+            if(s.keyword("Ns"))
 			{
-				m.pwr/=1000.0;
-				m.pwr*=128.0;
+                if(s.real(m.pwr))   /* wavefront shininess is from [0, 1000], so scale for OpenGL */
+                {
+                    m.pwr/=1000.0;
+                    m.pwr*=128.0;
+                }
 			}
-            else if(1==sscanf(line,"d %lf",&alpha))
+            else if(s.keyword("d"))
 			{
-				m.amb[3]=alpha;
-				m.dif[3]=alpha;
-				m.emi[3]=alpha;
-				m.spc[3]=alpha;
-				m.col[3]=alpha;
+                if(s.real(alpha))
+                {
+                    m.amb[3]=alpha;
+                    m.dif[3]=alpha;
+                    m.emi[3]=alpha;
+                    m.spc[3]=alpha;
+                    m.col[3]=alpha;
+                }
 			}
-            else if(3==sscanf(line,"Ka %lf %lf %lf",&m.amb[0],&m.amb[1],&m.amb[2]))
+            else if(s.keyword("Ka"))
 			{
+                s.real(m.amb[0]) && s.real(m.amb[1]) && s.real(m.amb[2]);
 			}
-            else if(3==sscanf(line,"Kd %lf %lf %lf",&m.dif[0],&m.dif[1],&m.dif[2]))
+            else if(s.keyword("Kd"))
 			{
+                s.real(m.dif[0]) && s.real(m.dif[1]) && s.real(m.dif[2]);
 			}
-            else if(3==sscanf(line,"Ks %lf %lf %lf",&m.spc[0],&m.spc[1],&m.spc[2]))
+            else if(s.keyword("Ks"))
 			{
+                s.real(m.spc[0]) && s.real(m.spc[1]) && s.real(m.spc[2]);
 			}
-            else if( (p=strstr(line,"newmtl "))==line )
+            else if(s.keyword("newmtl"))
 			{
-                if(1==sscanf(line,"newmtl %s",temp))
+                if(s.word(temp))
 				{
                     if(m.name!="")
 					{
@@ -122,9 +141,9 @@ int objImport::parse_material(const char *fname,material_list *mate,mtl_map *map
 					m.name=temp;
 				}
 			}
-            else if( (p=strstr(line,"map_Kd "))==line )
+            else if(s.keyword("map_Kd"))
 			{
-                if(1==sscanf(line,"map_Kd %s",temp))
+                if(s.word(temp))
 				{
 					m.tex=temp;
 				}
@@ -135,84 +154,158 @@ int objImport::parse_material(const char *fname,material_list *mate,mtl_map *map
 			mate->push_back(m);
 			(*map)[m.name]=idx;
 		}
-		fclose(fp);
 	}
 	return 1;
 }
 
-static int face(char *token,int *v,int *vt,int *vn)
+// "v", "v/t", "v//n" or "v/t/n" for every corner, normals are not used
+void objImport::parse_face(text_scanner &s, obj_chunk_t &c)
 {
-	*v=-1;
-	*vn=-1;
-	*vt=-1;
-    if( sscanf(token,"%d/%d/%d",v,vt,vn)==3 ) return 1;
-    if( sscanf(token,"%d/%d",v,vt)==2 ) return 1;
-    if( sscanf(token,"%d//%d",v,vn)==2 ) return 1;
-	return 0;
+    obj_face_t f;
+    memset(&f,0,sizeof(f));
+
+    int v,t,vn;
+    while(f.n<4 && s.integer(v))
+    {
+        int k=f.n;
+        bool tex=false;
+        if(s.next_is('/'))
+        {
+            if(s.next_is('/'))
+            {
+                if(!s.integer(vn)) break;
+            }
+            else
+            {
+                if(!s.integer(t)) break;
+                tex=true;
+                if(s.next_is('/') && !s.integer(vn)) break;
+            }
+        }
+
+        if(v>0)
+        {
+            f.v[k]=v-1;
+        }
+        else if(v<0)
+        {
+            f.v[k]=(int)c.v.size()+v;
+            f.flags|=OBJ_V_LOCAL<<k;
+        }
+        else
+        {
+            break;
+        }
+
+        if(tex && t>0)
+        {
+            f.t[k]=t-1;
+        }
+        else if(tex && t<0)
+        {
+            f.t[k]=(int)c.vt.size()+t;
+            f.flags|=OBJ_T_LOCAL<<k;
+        }
+        else
+        {
+            f.flags|=OBJ_T_NONE<<k;
+        }
+        f.n++;
+    }
+
+    if(f.n==3 || f.n==4)
+    {
+        c.f.push_back(f);
+    }
 }
 
-int objImport::parse_face(object_type &o,int cur_mtl,vertex_list &vt)
+void objImport::parse_chunk(const char *begin, const char *end, obj_chunk_t &c)
 {
-	int ret=0;
-	face_type f;
-    char *p,*q;
-	int t[4],vn[4],n;
+    text_scanner s(begin,end);
+    vertex_type a;
+    obj_event_t e;
+    while(s.next_line())
+    {
+        if(s.keyword("v"))
+        {
+            if(s.real(a.x) && s.real(a.y) && s.real(a.z))
+            {
+                c.v.push_back(a);
+            }
+        }
+        else if(s.keyword("vt"))
+        {
+            a.z=0.0;
+            if(s.real(a.x) && s.real(a.y))
+            {
+                a.y=1.0-a.y;
+                c.vt.push_back(a);
+            }
+        }
+        else if(s.keyword("f"))
+        {
+            parse_face(s,c);
+        }
+        else if(s.keyword("g"))
+        {
+            if(s.word(e.name))
+            {
+                e.type=OBJ_EVENT_GROUP;
+                e.face=c.f.size();
+                c.e.push_back(e);
+            }
+        }
+        else if(s.keyword("usemtl"))
+        {
+            if(s.word(e.name))
+            {
+                e.type=OBJ_EVENT_USEMTL;
+                e.face=c.f.size();
+                c.e.push_back(e);
+            }
+        }
+        else if(s.keyword("mtllib"))
+        {
+            if(s.word(e.name))
+            {
+                e.type=OBJ_EVENT_MTLLIB;
+                e.face=c.f.size();
+                c.e.push_back(e);
+            }
+        }
+    }
+}
 
+void objImport::add_face(object_type &o, const obj_face_t &x, int cur_mtl, size_t v_offset, size_t t_offset, size_t nv, const vertex_list &vt)
+{
+	face_type f;
 	reset_face(&f);
 	f.m=cur_mtl;
-	n=0;
-
-    p=&line[2];	//skip "f "
-	q=p;
-
-    while( (p=strstr(q," "))!=NULL )
+	f.n=x.n;
+	for(int i=0;i<x.n;i++)
 	{
-		*p=0;
-		if( face(q,&f.v[n],&t[n],&vn[n]) )
-		{
-			f.v[n]--;
-			n++;
-			if(n>=4) break;
-		}
-		else
-		{
-			break;
-		}
-		q=p+1;
+        int64_t v=x.v[i];
+        if(x.flags & (OBJ_V_LOCAL<<i)) v+=(int64_t)v_offset;
+        if(v<0 || v>=(int64_t)nv) return;
+        f.v[i]=(int)v;
+
+        if(x.flags & (OBJ_T_NONE<<i)) continue;
+        int64_t t=x.t[i];
+        if(x.flags & (OBJ_T_LOCAL<<i)) t+=(int64_t)t_offset;
+        if(t>=0 && t<(int64_t)vt.size())
+        {
+            f.uv[i*2+0]=vt[ t ].x;
+            f.uv[i*2+1]=vt[ t ].y;
+        }
 	}
-
-	if(q!=NULL && n<4)
-	{
-		if( face(q,&f.v[n],&t[n],&vn[n]) )
-		{
-			f.v[n]--;
-			n++;
-		}
-	}
-	if(n==3||n==4)
-	{
-		int i;
-		f.n=n;
-		for(i=0;i<n;i++)
-		{
-			if(t[i]>0)
-			{
-				t[i]--;
-				f.uv[i*2+0]=vt[ t[i] ].x;
-				f.uv[i*2+1]=vt[ t[i] ].y;
-			}
-		}
-		o.f.push_back(f);		
-	}
-
-	return ret;
+	o.f.push_back(f);
 }
 
+// lines are split into chunks parsed by threads, then merged in order of the file
+// groups and materials are applied while merging, faces are given as indices until then.
 int objImport::load(const char *fname, model_type *data)
 {
 	int ret=1;
-	vertex_type a;
-	vertex_list v,vt,vn;
 	object_type o;
 	mtl_map map;
 	int cur_mat=-1;
@@ -220,87 +313,119 @@ int objImport::load(const char *fname, model_type *data)
 	reset_object(&o);
 	reset_model(data);
 
-    fp=fopen(fname,"rt");
-    if(fp!=NULL)
+    text_file file;
+    if(file.open(fname))
 	{
-		int n;
-        char *p;
-		while(get_line())
-		{
-            if(line[0]=='v')
-			{
-                if(line[1]==' ')
-				{
-                    if(3==sscanf(line,"v %lf %lf %lf",&a.x,&a.y,&a.z))
-					{
-						v.push_back(a);
-					}
-				}
-                else if(line[1]=='t')
-				{
-                    if(2==sscanf(line,"vt %lf %lf",&a.x,&a.y))
-					{
-						a.y=1.0-a.y;
-						vt.push_back(a);
-					}
-				}
-                else if(line[1]=='n')
-				{
-                    if(3==std::sscanf(line,"vn %lf %lf %lf",&a.x,&a.y,&a.z))
-					{
-						vn.push_back(a);
-					}
-				}
-			}
-            else if(line[0]=='g')
-			{
-                if(1==sscanf(line,"g %s",temp))
-				{
-                    if(o.name!="") data->obj.push_back(o);
-					reset_object(&o);
-					o.name=temp;
-				}
-			}
-            else if(line[0]=='f')
-			{
-				parse_face(o,cur_mat,vt);
-			}
-            else if( (p=strstr(line,"usemtl "))==line )
-			{
-                if(1==sscanf(line,"usemtl %s",temp))
-				{
-                    std::string ma=temp;
-					cur_mat=map[ma];
-					cur_mat--;	//start from 0
-				}
-			}
-            else if( (p=strstr(line,"mtllib "))==line )
-			{
-                if(1==sscanf(line,"mtllib %s",temp))
-				{
-					FILE *fp_save;
+        const char *begin=file.begin();
+        const char *end=file.end();
+
+        std::vector<const char*> tops(1,begin);
+        size_t chunk=(size_t)parallel::chunk_size(file.size(), OBJ_CHUNK_BYTES, 1);
+        for(size_t k=chunk;k<file.size();k+=chunk)
+        {
+            const char *p=text_scanner::next_line_top(begin+k-1,end);
+            if(p>tops.back() && p<end) tops.push_back(p);
+        }
+        tops.push_back(end);
+
+        std::vector<obj_chunk_t> c(tops.size()-1);
+        if(c.size()==1)
+        {
+            parse_chunk(tops[0],tops[1],c[0]);
+        }
+        else
+        {
+            parallel::for_chunks(c.size(), 1, [&](quint64 first, quint64 last)
+            {
+                for(quint64 i=first;i<last;i++) parse_chunk(tops[i],tops[i+1],c[i]);
+            });
+        }
+        file.close();
+
+        //vertices and texture coords of the file
+        std::vector<size_t> v_offset(c.size()),t_offset(c.size());
+        size_t nv=0,nt=0;
+        for(size_t i=0;i<c.size();i++)
+        {
+            v_offset[i]=nv;
+            t_offset[i]=nt;
+            nv+=c[i].v.size();
+            nt+=c[i].vt.size();
+        }
+        vertex_list vt;
+        data->vtx.reserve(nv);
+        vt.reserve(nt);
+        for(auto &x:c)
+        {
+            data->vtx.insert(data->vtx.end(),x.v.begin(),x.v.end());
+            vt.insert(vt.end(),x.vt.begin(),x.vt.end());
+            vertex_list().swap(x.v);
+            vertex_list().swap(x.vt);
+        }
+
+        //faces of every group
+        std::vector<size_t> group_faces(1,0);
+        for(const auto &x:c)
+        {
+            size_t k=0;
+            for(const auto &e:x.e)
+            {
+                if(e.type!=OBJ_EVENT_GROUP) continue;
+                group_faces.back()+=e.face-k;
+                group_faces.push_back(0);
+                k=e.face;
+            }
+            group_faces.back()+=x.f.size()-k;
+        }
+
+        size_t g=0;
+        o.f.reserve(group_faces[g]);
+        for(size_t i=0;i<c.size() && ret;i++)
+        {
+            obj_chunk_t &x=c[i];
+            size_t k=0;
+            for(size_t j=0;j<=x.e.size();j++)
+            {
+                size_t last= j<x.e.size() ? x.e[j].face : x.f.size();
+                for(;k<last;k++)
+                {
+                    add_face(o,x.f[k],cur_mat,v_offset[i],t_offset[i],nv,vt);
+                }
+                if(j==x.e.size()) break;
+
+                const obj_event_t &e=x.e[j];
+                if(e.type==OBJ_EVENT_GROUP)
+                {
+                    if(o.name!="") data->obj.push_back(std::move(o));
+                    reset_object(&o);
+                    o.name=e.name;
+                    o.f.reserve(group_faces[++g]);
+                }
+                else if(e.type==OBJ_EVENT_USEMTL)
+                {
+                    cur_mat=map[e.name];
+                    cur_mat--;	//start from 0
+                }
+                else if(e.type==OBJ_EVENT_MTLLIB)
+                {
                     fs::path ps(fname);
-                    std::string matFileName=ps.replace_filename(temp).string();
-					fp_save=fp;
-                    n=parse_material(matFileName.c_str(),&data->mate,&map);
-					fp=fp_save;
-					if(n) continue;
-					ret=0;
-					break;
-				}
-			}
-		}
-        if(o.name!="") data->obj.push_back(o);
-		fclose(fp);
+                    std::string matFileName=ps.replace_filename(e.name).string();
+                    if(!parse_material(matFileName.c_str(),&data->mate,&map))
+                    {
+                        ret=0;
+                        break;
+                    }
+                }
+            }
+            std::vector<obj_face_t>().swap(x.f);
+        }
+        if(ret && o.name!="") data->obj.push_back(std::move(o));
 	}
 	if(ret)
 	{
-		data->vtx=v;
 		data->path=fname;
 	}
 	return ret;
-
-
 }
 
 
@@ -0,0 +1,59 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <QtConcurrent>
+#include <QThreadPool>
+#include <QVector>
+#include <QPair>
+
+namespace parallel
+{
+
+typedef QPair<quint64,quint64> range_t;     //[first, second)
+
+// split [0,n) into ranges of at most 'chunk' items
+inline QVector<range_t> ranges(quint64 n, quint64 chunk)
+{
+    QVector<range_t> ret;
+    if(chunk==0) chunk=1;
+    ret.reserve((int)((n+chunk-1)/chunk));
+    for(quint64 i=0;i<n;i+=chunk)
+    {
+        ret.append(range_t(i, qMin(n, i+chunk)));
+    }
+    return ret;
+}
+
+// chunk size which gives a few tasks per worker thread, but not smaller than 'minimum'
+inline quint64 chunk_size(quint64 n, quint64 minimum, quint64 tasksPerThread=4)
+{
+    quint64 tasks=(quint64)qMax(1, QThreadPool::globalInstance()->maxThreadCount())*qMax<quint64>(1,tasksPerThread);
+    quint64 chunk=(n+tasks-1)/tasks;
+    return qMax(chunk, minimum);
+}
+
+// run func(first,last) for every range on the global thread pool and wait
+template<typename F> void for_ranges(const QVector<range_t> &r, F func)
+{
+    QVector<range_t> x=r;
+    QtConcurrent::blockingMap(x, [&func](const range_t &i){ func(i.first, i.second); });
+}
+
+template<typename F> void for_chunks(quint64 n, quint64 chunk, F func)
+{
+    for_ranges(ranges(n, chunk), func);
+}
+
+} // namespace parallel
+
+#endif // PARALLEL_H
@@ -0,0 +1,131 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "pc_stats.h"
+
+#include <cfloat>
+
+#define RADIX_SIZE (1u<<PC_STATS_RADIX_BITS)
+
+// lower edge of a histogram bin as float
+static float radix_edge(uint32_t bin)
+{
+    uint64_t k=(uint64_t)bin<<(32-PC_STATS_RADIX_BITS);
+    if(k>0xffffffffu) return FLT_MAX;
+    uint32_t u=(uint32_t)k;
+    u= (u & 0x80000000u) ? (u ^ 0x80000000u) : ~u;
+    float x;
+    memcpy(&x,&u,sizeof(x));
+    if(x!=x) return (u & 0x80000000u) ? -FLT_MAX : FLT_MAX;   //beyond infinity
+    return x;
+}
+
+pc_stats_accumulator::pc_stats_accumulator(bool amp, bool rng)
+{
+    _count=0;
+    for(int k=0;k<3;k++)
+    {
+        _bmin[k]=FLT_MAX;
+        _bmax[k]=-FLT_MAX;
+        _sum[k]=0.0;
+    }
+    _valid[PC_STATS_HGT]=1;
+    _valid[PC_STATS_AMP]=amp;
+    _valid[PC_STATS_RNG]=rng;
+    for(int k=0;k<PC_STATS_ATTR;k++)
+    {
+        _min[k]=FLT_MAX;
+        _max[k]=-FLT_MAX;
+        if(_valid[k]) _radix[k].assign(RADIX_SIZE,0);
+    }
+}
+
+void pc_stats_accumulator::merge(const pc_stats_accumulator &x)
+{
+    _count+=x._count;
+    for(int k=0;k<3;k++)
+    {
+        _bmin[k]=std::min(_bmin[k],x._bmin[k]);
+        _bmax[k]=std::max(_bmax[k],x._bmax[k]);
+        _sum[k]+=x._sum[k];
+    }
+    for(int k=0;k<PC_STATS_ATTR;k++)
+    {
+        if(!_valid[k] || !x._valid[k]) continue;
+        _min[k]=std::min(_min[k],x._min[k]);
+        _max[k]=std::max(_max[k],x._max[k]);
+        for(uint32_t i=0;i<RADIX_SIZE;i++)
+        {
+            _radix[k][i]+=x._radix[k][i];
+        }
+    }
+}
+
+// value below which p of the points are found, interpolated inside the bin
+float pc_stats_accumulator::percentile(int attr, double p) const
+{
+    double target=p*_count;
+    double cum=0.0;
+    const auto &h=_radix[attr];
+    for(uint32_t i=0;i<RADIX_SIZE;i++)
+    {
+        if(!h[i]) continue;
+        if(cum+h[i]>=target)
+        {
+            float lo=std::max(radix_edge(i),_min[attr]);
+            float hi=std::min(radix_edge(i+1),_max[attr]);
+            double f=(target-cum)/h[i];
+            return (float)(lo+(hi-lo)*f);
+        }
+        cum+=h[i];
+    }
+    return _max[attr];
+}
+
+void pc_stats_accumulator::result(pc_stats_t &s, float lowPercent, float highPercent) const
+{
+    memset(&s,0,sizeof(s));
+    s.count=_count;
+    if(!_count) return;
+
+    for(int k=0;k<3;k++)
+    {
+        s.bmin[k]=_bmin[k];
+        s.bmax[k]=_bmax[k];
+        s.centroid[k]=(float)(_sum[k]/_count);
+    }
+
+    for(int k=0;k<PC_STATS_ATTR;k++)
+    {
+        pc_attr_stats_t &a=s.attr[k];
+        a.valid=_valid[k];
+        if(!a.valid) continue;
+
+        a.min=_min[k];
+        a.max=_max[k];
+        a.lo=percentile(k,lowPercent/100.0);
+        a.hi=percentile(k,highPercent/100.0);
+
+        // fixed bins between min and max, filled from the float bit histogram
+        float w=a.max-a.min;
+        const auto &h=_radix[k];
+        for(uint32_t i=0;i<RADIX_SIZE;i++)
+        {
+            if(!h[i]) continue;
+            float lo=std::max(radix_edge(i),a.min);
+            float hi=std::min(radix_edge(i+1),a.max);
+            float x=(lo+hi)/2;
+            int b= w>0.0f ? (int)((x-a.min)/w*PC_STATS_BINS) : 0;
+            b=std::min(std::max(b,0),PC_STATS_BINS-1);
+            a.hist[b]+=h[i];
+        }
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef PC_STATS_H
+#define PC_STATS_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#define PC_STATS_HGT 0
+#define PC_STATS_AMP 1
+#define PC_STATS_RNG 2
+#define PC_STATS_ATTR 3
+
+#define PC_STATS_BINS 256           //fixed-bin histogram between min and max
+#define PC_STATS_RADIX_BITS 16      //histogram by upper bits of float while decoding
+
+typedef struct
+{
+    int valid;
+    float min;
+    float max;
+    float lo;                       //lower percentile
+    float hi;                       //upper percentile
+    uint32_t hist[PC_STATS_BINS];
+} pc_attr_stats_t;
+
+typedef struct
+{
+    uint64_t count;
+    float bmin[3];
+    float bmax[3];
+    float centroid[3];
+    pc_attr_stats_t attr[PC_STATS_ATTR];
+} pc_stats_t;
+
+// statistics of a part of the cloud, accumulated while the points are decoded
+// histogram bins are ordered float bits, they don't need the range in advance.
+class pc_stats_accumulator
+{
+public:
+    pc_stats_accumulator(bool amp, bool rng);
+
+    inline void add(const float *xyz, float amp, float rng)
+    {
+        for(int k=0;k<3;k++)
+        {
+            _bmin[k]=std::min(_bmin[k],xyz[k]);
+            _bmax[k]=std::max(_bmax[k],xyz[k]);
+            _sum[k]+=xyz[k];
+        }
+        _count++;
+        bin(PC_STATS_HGT,xyz[2]);
+        if(_valid[PC_STATS_AMP]) bin(PC_STATS_AMP,amp);
+        if(_valid[PC_STATS_RNG]) bin(PC_STATS_RNG,rng);
+    }
+
+    void merge(const pc_stats_accumulator &x);
+    void result(pc_stats_t &s, float lowPercent, float highPercent) const;
+
+private:
+    inline void bin(int attr, float x)
+    {
+        uint32_t u;
+        memcpy(&u,&x,sizeof(u));
+        u^= (u & 0x80000000u) ? 0xffffffffu : 0x80000000u;   //monotonic order
+        _radix[attr][u>>(32-PC_STATS_RADIX_BITS)]++;
+        _min[attr]=std::min(_min[attr],x);
+        _max[attr]=std::max(_max[attr],x);
+    }
+
+    float percentile(int attr, double p) const;
+
+private:
+    uint64_t _count;
+    float _bmin[3];
+    float _bmax[3];
+    double _sum[3];
+    int _valid[PC_STATS_ATTR];
+    float _min[PC_STATS_ATTR];
+    float _max[PC_STATS_ATTR];
+    std::vector<uint32_t> _radix[PC_STATS_ATTR];
+};
+
+#endif // PC_STATS_H
@@ -9,6 +9,14 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 */
 
 #include "qt_opengl_unproj.h"
+#include "gl_programs.h"
+
+#include <QOpenGLShaderProgram>
+#include <QVector2D>
+
+#ifndef GL_RGBA32F
+#define GL_RGBA32F 0x8814
+#endif
 
 #include <QDebug>
 
@@ -108,7 +116,296 @@ qt_opengl_depth::~qt_opengl_depth()
     //doneCurrent()
 }
 
+//--------------------------------------------------------------------------------
+// Asynchronous depth readback
+//--------------------------------------------------------------------------------
+
+depthReadback::depthReadback()
+{
+    for(int i=0;i<DEPTH_PBO_RING;i++)
+    {
+        depth_snapshot_t &s=_snapshot[i];
+        s.pbo=QOpenGLBuffer(QOpenGLBuffer::PixelPackBuffer);
+        s.coarse=QOpenGLBuffer(QOpenGLBuffer::PixelPackBuffer);
+        s.width=0;
+        s.height=0;
+        s.valid=0;
+        s.serial=0;
+        memset(s.viewport,0,sizeof(s.viewport));
+    }
+    _latest=0;
+    _available=false;
+    _serial=0;
+    _pyramidSerial=0;
+
+    _prg=nullptr;
+    _uSrc=_uSrcSize=_uBlock=-1;
+    _quad=QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+    _depthTex=0;
+    _texWidth=0;
+    _texHeight=0;
+}
 
+depthReadback::~depthReadback()
+{
+    for(int i=0;i<DEPTH_PBO_RING;i++)
+    {
+        if(_snapshot[i].pbo.isCreated()) _snapshot[i].pbo.destroy();
+        if(_snapshot[i].coarse.isCreated()) _snapshot[i].coarse.destroy();
+    }
+    freeLevels();
+    if(_quad.isCreated()) _quad.destroy();
+    gl_programs::release(_prg);
+    _prg=nullptr;
+}
+
+bool depthReadback::initialize(void)
+{
+    initializeOpenGLFunctions();
+
+    QOpenGLContext *ctx=QOpenGLContext::currentContext();
+    if(!ctx->hasExtension("GL_ARB_texture_float"))
+    {
+        qDebug()<<"depth pyramid is not available";
+        _available=false;
+        return false;
+    }
+
+    _available=true;
+    for(int i=0;i<DEPTH_PBO_RING;i++)
+    {
+        if(!_snapshot[i].pbo.create() || !_snapshot[i].coarse.create())
+        {
+            qDebug()<<"PBO is not supported";
+            _available=false;
+            return false;
+        }
+        _snapshot[i].pbo.setUsagePattern(QOpenGLBuffer::StreamRead);
+        _snapshot[i].coarse.setUsagePattern(QOpenGLBuffer::StreamRead);
+    }
+
+    _prg=gl_programs::acquire(":/gl/gl_depth_pyramid.vert", ":/gl/gl_depth_pyramid.frag", QStringList()<<"vertex");
+    if(_prg==nullptr || !_quad.create())
+    {
+        _available=false;
+        return false;
+    }
+    _uSrc=_prg->uniformLocation("src");
+    _uSrcSize=_prg->uniformLocation("srcSize");
+    _uBlock=_prg->uniformLocation("block");
+
+    const GLfloat quad[8]={-1.0f,-1.0f, 1.0f,-1.0f, -1.0f,1.0f, 1.0f,1.0f};
+    _quad.bind();
+    _quad.allocate(quad,sizeof(quad));
+    _quad.release();
+    return _available;
+}
+
+void depthReadback::freeLevels(void)
+{
+    qDeleteAll(_level);
+    _level.clear();
+    if(_depthTex)
+    {
+        glDeleteTextures(1,&_depthTex);
+        _depthTex=0;
+    }
+    _texWidth=0;
+    _texHeight=0;
+}
+
+// depth texture and level targets for the frame size, texture binding of unit 0 is changed
+bool depthReadback::allocate(int w, int h)
+{
+    if(_texWidth==w && _texHeight==h) return !_level.isEmpty();
+    freeLevels();
+
+    glGenTextures(1,&_depthTex);
+    glBindTexture(GL_TEXTURE_2D,_depthTex);
+    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_S,GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_WRAP_T,GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D,0,GL_DEPTH_COMPONENT,w,h,0,GL_DEPTH_COMPONENT,GL_FLOAT,nullptr);
+
+    int lw,lh;
+    depth_pyramid::level_size(w,h,DEPTH_PYRAMID_BASE,lw,lh);
+    while(true)
+    {
+        QOpenGLFramebufferObject *f=new QOpenGLFramebufferObject(lw,lh,QOpenGLFramebufferObject::NoAttachment,GL_TEXTURE_2D,GL_RGBA32F);
+        _level.append(f);
+        if(!f->isValid())
+        {
+            qDebug()<<"depth pyramid FBO is not valid";
+            freeLevels();
+            return false;
+        }
+        glBindTexture(GL_TEXTURE_2D,f->texture());
+        glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MIN_FILTER,GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D,GL_TEXTURE_MAG_FILTER,GL_NEAREST);
+        if(lw<=1 && lh<=1) break;
+        lw=(lw+1)/2;
+        lh=(lh+1)/2;
+    }
+    _texWidth=w;
+    _texHeight=h;
+    return true;
+}
+
+// bound depth buffer is reduced level by level, the levels are copied into the coarse PBO of the snapshot
+bool depthReadback::reduce(depth_snapshot_t &s)
+{
+    GLint fbo=0, tex=0, viewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING,&fbo);
+    glGetIntegerv(GL_VIEWPORT,viewport);
+    glActiveTexture(GL_TEXTURE0);
+    glGetIntegerv(GL_TEXTURE_BINDING_2D,&tex);
+    GLboolean depthTest=glIsEnabled(GL_DEPTH_TEST);
+
+    bool ok=allocate(s.width,s.height);
+    if(ok)
+    {
+        glBindTexture(GL_TEXTURE_2D,_depthTex);
+        glCopyTexSubImage2D(GL_TEXTURE_2D,0,0,0,0,0,s.width,s.height);
+
+        glDisable(GL_DEPTH_TEST);
+        _prg->bind();
+        _prg->setUniformValue(_uSrc,0);
+        _quad.bind();
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0,2,GL_FLOAT,GL_FALSE,0,nullptr);
+
+        int sw=s.width, sh=s.height, block=1<<DEPTH_PYRAMID_BASE;
+        GLuint src=_depthTex;
+        foreach(auto f,_level)
+        {
+            f->bind();
+            glViewport(0,0,f->width(),f->height());
+            glBindTexture(GL_TEXTURE_2D,src);
+            _prg->setUniformValue(_uSrcSize,QVector2D(sw,sh));
+            _prg->setUniformValue(_uBlock,block);
+            glDrawArrays(GL_TRIANGLE_STRIP,0,4);
+            src=f->texture();
+            sw=f->width();
+            sh=f->height();
+            block=2;
+        }
+
+        glDisableVertexAttribArray(0);
+        _quad.release();
+        _prg->release();
+
+        // coarse levels are copied without waiting GPU as the depth buffer is
+        int bytes=(int)(depth_pyramid::floats(s.width,s.height,DEPTH_PYRAMID_BASE)*sizeof(GLfloat));
+        s.coarse.bind();
+        if(s.coarse.size()!=bytes) s.coarse.allocate(bytes);
+        quintptr offset=0;
+        foreach(auto f,_level)
+        {
+            f->bind();
+            glReadPixels(0,0,f->width(),f->height(),GL_RED,GL_FLOAT,reinterpret_cast<void*>(offset));
+            offset+=(quintptr)f->width()*f->height()*sizeof(GLfloat);
+        }
+        s.coarse.release();
+    }
+
+    GLenum error=glGetError();
+    glBindFramebuffer(GL_FRAMEBUFFER,fbo);
+    glViewport(viewport[0],viewport[1],viewport[2],viewport[3]);
+    glBindTexture(GL_TEXTURE_2D,tex);
+    if(depthTest) glEnable(GL_DEPTH_TEST);
+
+    if(error)
+    {
+        qDebug() << "DEPTH PYRAMID : " <<error;
+        return false;
+    }
+    return ok;
+}
+
+int depthReadback::capture(int w, int h, const QMatrix4x4 &pvm)
+{
+    if(!_available) return 0;
+
+    int next=(_latest+1)%DEPTH_PBO_RING;
+    depth_snapshot_t &s=_snapshot[next];
+
+    s.pbo.bind();
+    if(s.width!=w || s.height!=h)
+    {
+        s.pbo.allocate(w*h*(int)sizeof(GLfloat));
+        s.width=w;
+        s.height=h;
+    }
+    glReadPixels(0,0,w,h,GL_DEPTH_COMPONENT,GL_FLOAT,nullptr);     //returns without waiting GPU
+    GLenum error=glGetError();
+    s.pbo.release();
+
+    if(error)
+    {
+        if(error==0x502) qDebug() << "DEPTH PBO : glReadPixels = GL_INVALID_OPERATION";
+        else             qDebug() << "DEPTH PBO : glReadPixels = " <<error;
+        s.valid=0;
+        return 0;
+    }
+
+    if(!reduce(s))
+    {
+        s.valid=0;
+        return 0;
+    }
+
+    s.valid=1;
+    s.pvm=pvm;
+    glGetIntegerv(GL_VIEWPORT, s.viewport);
+    s.issued.start();
+    s.serial=++_serial;
+    _latest=next;
+    return 1;
+}
+
+int depthReadback::nearest(int x, int y, int r, int &px, int &py, GLfloat &z, QMatrix4x4 &pvm, int *viewport)
+{
+    if(!_available) return 0;
+
+    int k=_latest;
+    if(!_snapshot[k].valid) return 0;
+    if(_snapshot[k].issued.elapsed()<DEPTH_PBO_LATENCY_MS)
+    {   //don't stall for the frame just issued if the previous one is there
+        int prev=(k+DEPTH_PBO_RING-1)%DEPTH_PBO_RING;
+        if(_snapshot[prev].valid) k=prev;
+    }
+    depth_snapshot_t &s=_snapshot[k];
+
+    if(_pyramidSerial!=s.serial)
+    {   //coarse levels reduced by GPU, read back once for the snapshot
+        _buf.resize((int)depth_pyramid::floats(s.width,s.height,DEPTH_PYRAMID_BASE));
+        s.coarse.bind();
+        bool ok=s.coarse.read(0, _buf.data(), _buf.size()*(int)sizeof(GLfloat));
+        s.coarse.release();
+        if(!ok) return 0;
+
+        _pyramid.assign(s.width, s.height, DEPTH_PYRAMID_BASE, _buf.constData());
+        _pyramidSerial=s.serial;
+    }
+
+    // pixels under the base nodes which are reached, a few rows of 8 pixels
+    const int width=s.width;
+    s.pbo.bind();
+    int ret=_pyramid.nearest(x, y, r, px, py, z, [&s,width](int bx, int by, int bw, int bh, float *dst)
+    {
+        for(int j=0;j<bh;j++)
+        {
+            if(!s.pbo.read(((by+j)*width+bx)*(int)sizeof(GLfloat), dst+j*bw, bw*(int)sizeof(GLfloat))) return false;
+        }
+        return true;
+    });
+    s.pbo.release();
+
+    pvm=s.pvm;
+    memcpy(viewport,s.viewport,sizeof(s.viewport));
+    return ret;
+}
 
 int qt_opengl_unproj(const QVector3D &window, const QMatrix4x4 &proj_modelview, const int *viewport, QVector3D &object)
 {
@@ -19,6 +19,16 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include <QVector3D>
 #include <QVector4D>
 #include <QMatrix4x4>
+#include <QElapsedTimer>
+#include <QVector>
+
+#include "depth_pyramid.h"
+
+#define DEPTH_PBO_RING 3            //number of frames in flight
+#define DEPTH_PBO_LATENCY_MS 50     //younger snapshot may still be copied by GPU
+#define DEPTH_PYRAMID_BASE 3        //finest level reduced by GPU, 8x8 pixels are read from the snapshot under it
+
+QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
 
 class depthContext
 {
@@ -26,11 +36,14 @@ class depthContext
     uint32_t *_depthi;
     int _width,_height;
     int _which_buf;
+    depth_pyramid _pyramid;
+    bool _pyramidValid;
 
 public:
     depthContext(int w, int h)
     {
         _which_buf=0;
+        _pyramidValid=false;
         _width=w;
         _height=h;
         _depth=new GLfloat[w*h];
@@ -63,7 +76,23 @@ public:
 
     int width() { return _width;}
     int height() { return _height;}
-    void setWhich(int x) {_which_buf=x;}
+    bool isValid() { return _which_buf!=0;}
+    void setWhich(int x) {_which_buf=x; _pyramidValid=false;}
+
+    const depth_pyramid *pyramid()
+    {
+        if(!_which_buf) return nullptr;
+        if(!_pyramidValid)
+        {
+            if(_which_buf==2)
+            {
+                for(int i=0;i<_width*_height;i++) _depth[i]=(GLfloat)(_depthi[i]/(double)(0x00ffffff));
+            }
+            _pyramid.build(_depth,_width,_height);
+            _pyramidValid=true;
+        }
+        return &_pyramid;
+    }
     uint32_t *depthi() {return _depthi;}
     GLfloat *depth() {return _depth;}
 };
@@ -82,6 +111,57 @@ public:
 
 };
 
+typedef struct
+{
+    QOpenGLBuffer pbo;
+    QOpenGLBuffer coarse;       //levels of the pyramid from DEPTH_PYRAMID_BASE to 1x1
+    int width,height;
+    int valid;
+    QMatrix4x4 pvm;             //proj * camera * world of the frame
+    int viewport[4];
+    QElapsedTimer issued;
+    quint64 serial;
+} depth_snapshot_t;
+
+// depth buffer is copied into a ring of pixel buffer objects without waiting for GPU,
+// GPU reduces it to the coarse levels of a min-depth pyramid which are copied with the snapshot.
+// only the coarse levels are read back, once for every snapshot. nearest() descends them
+// and reads the 8x8 pixels under the base nodes it reaches from the snapshot.
+// every snapshot keeps the matrices of its frame, older one can be used while camera is moving.
+class depthReadback : protected QOpenGLFunctions
+{
+    depth_snapshot_t _snapshot[DEPTH_PBO_RING];
+    int _latest;
+    bool _available;
+    quint64 _serial;
+    quint64 _pyramidSerial;     //snapshot of _pyramid
+    depth_pyramid _pyramid;
+    QVector<GLfloat> _buf;
+
+    QOpenGLShaderProgram *_prg;                 //min reduction, shared by gl_programs
+    int _uSrc, _uSrcSize, _uBlock;
+    QOpenGLBuffer _quad;
+    GLuint _depthTex;                           //copy of the depth buffer
+    int _texWidth, _texHeight;
+    QVector<QOpenGLFramebufferObject*> _level;  //levels from DEPTH_PYRAMID_BASE to 1x1
+
+    bool allocate(int w, int h);
+    void freeLevels(void);
+    bool reduce(depth_snapshot_t &s);
+
+public:
+    depthReadback();
+    ~depthReadback();                   //context required
+
+    bool initialize(void);              //context required
+    bool isAvailable(void) {return _available;}
+
+    int capture(int w, int h, const QMatrix4x4 &pvm);  //context required, start to copy bound depth buffer
+
+    // nearest valid sample to (x,y) within radius r in the newest snapshot which is ready,
+    // with the matrices of the snapshot. context required
+    int nearest(int x, int y, int r, int &px, int &py, GLfloat &z, QMatrix4x4 &pvm, int *viewport);
+};
 
 extern int qt_opengl_unproj(const QVector3D &window, const QMatrix4x4 &proj_modelview, const int *viewport, QVector3D &object);
 
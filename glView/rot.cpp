@@ -212,4 +212,70 @@ void dcm4x4(QMatrix4x4 &R, const QMatrix3x3 & dcm)
             R(row,col) = dcm(row,col);
 }
 
+// Taylor terms of sin(x)/x and cos(x), under 1e-7 on [-pi/2, pi/2]
+#define PI_F        3.14159265f
+#define SINC_C1     (-1.0f / 6.0f)
+#define SINC_C2     (1.0f / 120.0f)
+#define SINC_C3     (-1.0f / 5040.0f)
+#define SINC_C4     (1.0f / 362880.0f)
+#define SINC_C5     (-1.0f / 39916800.0f)
+#define COS_C1      (-1.0f / 2.0f)
+#define COS_C2      (1.0f / 24.0f)
+#define COS_C3      (-1.0f / 720.0f)
+#define COS_C4      (1.0f / 40320.0f)
+#define COS_C5      (-1.0f / 3628800.0f)
+#define COS_C6      (1.0f / 479001600.0f)
+
+void quat_from_rodrigues(float * __restrict q0, float * __restrict q1, float * __restrict q2, float * __restrict q3,
+                         const float * __restrict rx, const float * __restrict ry, const float * __restrict rz, size_t n)
+{
+#pragma omp simd
+    for(size_t i=0;i<n;i++)
+    {
+        float theta = std::sqrt(rx[i]*rx[i] + ry[i]*ry[i] + rz[i]*rz[i]);
+        float h = 0.5f * theta;
+
+        // h - turns*pi is in [-pi/2, pi/2], it flips the sign of all four terms which is the same rotation
+        int turns = (int)(h * (1.0f / PI_F) + 0.5f);
+        float x = h - (float)turns * PI_F;
+        float x2 = x * x;
+        float sinc = 1.0f + x2*(SINC_C1 + x2*(SINC_C2 + x2*(SINC_C3 + x2*(SINC_C4 + x2*SINC_C5))));
+        float c = 1.0f + x2*(COS_C1 + x2*(COS_C2 + x2*(COS_C3 + x2*(COS_C4 + x2*(COS_C5 + x2*COS_C6)))));
+        float k = x * sinc / (theta + FLT_MIN);     //sin(theta/2)/theta, 0 instead of 0/0 at theta = 0
+
+        q0[i] = c;
+        q1[i] = k * rx[i];
+        q2[i] = k * ry[i];
+        q3[i] = k * rz[i];
+    }
+}
+
+void matrix_from_quat(float * __restrict m, const float * __restrict q0, const float * __restrict q1, const float * __restrict q2, const float * __restrict q3,
+                      const float * __restrict px, const float * __restrict py, const float * __restrict pz, float scale, size_t n)
+{
+#pragma omp simd
+    for(size_t i=0;i<n;i++)
+    {
+        float a = q0[i], b = q1[i], c = q2[i], d = q3[i];
+        float *r = m + 16*i;
+
+        r[0]  = scale * (a*a + b*b - c*c - d*d);    //dcm(0,0), column 0
+        r[1]  = scale * 2.0f * (b * c + a * d);     //dcm(1,0)
+        r[2]  = scale * 2.0f * (b * d - a * c);     //dcm(2,0)
+        r[3]  = 0.0f;
+        r[4]  = scale * 2.0f * (b * c - a * d);     //dcm(0,1), column 1
+        r[5]  = scale * (a*a - b*b + c*c - d*d);    //dcm(1,1)
+        r[6]  = scale * 2.0f * (c * d + a * b);     //dcm(2,1)
+        r[7]  = 0.0f;
+        r[8]  = scale * 2.0f * (b * d + a * c);     //dcm(0,2), column 2
+        r[9]  = scale * 2.0f * (c * d - a * b);     //dcm(1,2)
+        r[10] = scale * (a*a - b*b - c*c + d*d);    //dcm(2,2)
+        r[11] = 0.0f;
+        r[12] = px[i];                              //translation, column 3
+        r[13] = py[i];
+        r[14] = pz[i];
+        r[15] = 1.0f;
+    }
+}
+
 } // namespace rot
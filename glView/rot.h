@@ -16,6 +16,7 @@ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLI
 #include <QMatrix3x3>
 #include <QMatrix4x4>
 #include <cmath>
+#include <cstddef>
 
 namespace rot
 {
@@ -43,6 +44,16 @@ int dcm_to_euler(QVector3D euler, const QMatrix3x3 dcm);
 
 void dcm4x4(QMatrix4x4 &R, const QMatrix3x3 & dcm);
 
+// batches of n poses as structure of arrays, the arrays must not overlap
+// the loops are #pragma omp simd with a polynomial sin/cos, vectorized with -fopenmp-simd -fno-math-errno
+// same rotation as dcm_from_rodrigues() then dcm_to_quat(), the sign of the quaternion may differ
+void quat_from_rodrigues(float * __restrict q0, float * __restrict q1, float * __restrict q2, float * __restrict q3,
+                         const float * __restrict rx, const float * __restrict ry, const float * __restrict rz, size_t n);
+
+// translate(p) * dcm_from_quat(q) * scale, column major 4x4 (16 floats) of every pose
+void matrix_from_quat(float * __restrict m, const float * __restrict q0, const float * __restrict q1, const float * __restrict q2, const float * __restrict q3,
+                      const float * __restrict px, const float * __restrict py, const float * __restrict pz, float scale, size_t n);
+
 }
 
 #endif // ROT_H
@@ -0,0 +1,382 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "text_scanner.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define READ_BLOCK_SIZE (1<<20)     //file is read by this size when it can't be mapped
+
+text_file::text_file()
+{
+    _data=nullptr;
+    _size=0;
+    _view=nullptr;
+#ifdef _WIN32
+    _file=nullptr;
+    _mapping=nullptr;
+#endif
+}
+
+text_file::~text_file()
+{
+    close();
+}
+
+bool text_file::open(const char *fname)
+{
+    close();
+#ifdef _WIN32
+    HANDLE f=CreateFileA(fname,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL|FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+    if(f!=INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER size;
+        if(GetFileSizeEx(f,&size) && size.QuadPart>0)
+        {
+            HANDLE m=CreateFileMappingA(f,NULL,PAGE_READONLY,0,0,NULL);
+            if(m!=NULL)
+            {
+                void *v=MapViewOfFile(m,FILE_MAP_READ,0,0,0);
+                if(v!=NULL)
+                {
+                    _file=f;
+                    _mapping=m;
+                    _view=v;
+                    _data=(const char*)v;
+                    _size=(size_t)size.QuadPart;
+                    return true;
+                }
+                CloseHandle(m);
+            }
+        }
+        CloseHandle(f);
+    }
+#else
+    int fd=::open(fname,O_RDONLY);
+    if(fd>=0)
+    {
+        struct stat st;
+        if(fstat(fd,&st)==0 && st.st_size>0)
+        {
+            void *v=mmap(NULL,(size_t)st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+            if(v!=MAP_FAILED)
+            {
+                madvise(v,(size_t)st.st_size,MADV_WILLNEED);
+                ::close(fd);
+                _view=v;
+                _data=(const char*)v;
+                _size=(size_t)st.st_size;
+                return true;
+            }
+        }
+        ::close(fd);
+    }
+#endif
+
+    //empty file, or the file system doesn't support mapping
+    FILE *fp=fopen(fname,"rb");
+    if(fp==NULL) return false;
+    size_t n;
+    do
+    {
+        size_t top=_buffer.size();
+        _buffer.resize(top+READ_BLOCK_SIZE);
+        n=fread(&_buffer[top],1,READ_BLOCK_SIZE,fp);
+        _buffer.resize(top+n);
+    }
+    while(n==READ_BLOCK_SIZE);
+    fclose(fp);
+    _data=_buffer.data();
+    _size=_buffer.size();
+    return true;
+}
+
+void text_file::close(void)
+{
+    if(_view!=nullptr)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(_view);
+        CloseHandle((HANDLE)_mapping);
+        CloseHandle((HANDLE)_file);
+        _mapping=nullptr;
+        _file=nullptr;
+#else
+        munmap(_view,_size);
+#endif
+        _view=nullptr;
+    }
+    _buffer.clear();
+    _buffer.shrink_to_fit();
+    _data=nullptr;
+    _size=0;
+}
+
+//------------------------------------------------------------------
+
+static const double pow10_table[]=
+{
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool is_digit(char c)
+{
+    return (unsigned)(c-'0')<10u;
+}
+
+text_scanner::text_scanner(const char *begin, const char *end)
+{
+    _end=end;
+    _line=_eol=_p=_next=begin;
+}
+
+const char *text_scanner::next_line_top(const char *p, const char *end)
+{
+    if(p>=end) return end;
+    const char *n=(const char*)memchr(p,'\n',(size_t)(end-p));
+    return n!=NULL ? n+1 : end;
+}
+
+bool text_scanner::next_line(void)
+{
+    if(_next>=_end) return false;
+    _line=_next;
+    const char *n=(const char*)memchr(_line,'\n',(size_t)(_end-_line));
+    _eol = n!=NULL ? n : _end;
+    _next= n!=NULL ? n+1 : _end;
+    if(_eol>_line && _eol[-1]=='\r') _eol--;
+    _p=_line;
+    return true;
+}
+
+bool text_scanner::lines(size_t n, std::vector<const char*> &tops)
+{
+    tops.clear();
+    tops.reserve(n+1);
+    const char *p=_next;
+    for(size_t i=0;i<n;i++)
+    {
+        if(p>=_end) return false;
+        tops.push_back(p);
+        p=next_line_top(p,_end);
+    }
+    tops.push_back(p);
+
+    //the lines are consumed, current line is empty
+    _line=_eol=_p=_next=p;
+    return true;
+}
+
+void text_scanner::skip_space(void)
+{
+    while(_p<_eol && (*_p==' ' || *_p=='\t')) _p++;
+}
+
+bool text_scanner::keyword(const char *k)
+{
+    _p=_line;
+    skip_space();
+    size_t n=strlen(k);
+    if((size_t)(_eol-_p)<n || memcmp(_p,k,n)!=0) return false;
+    const char *q=_p+n;
+    if(q<_eol && *q!=' ' && *q!='\t') return false;
+    _p=q;
+    return true;
+}
+
+bool text_scanner::seek(const char *s)
+{
+    size_t n=strlen(s);
+    if(n==0) return true;
+    const char *q=_line;
+    while(q+n<=_eol)
+    {
+        q=(const char*)memchr(q,s[0],(size_t)(_eol-q));
+        if(q==NULL || q+n>_eol) return false;
+        if(memcmp(q,s,n)==0)
+        {
+            _p=q+n;
+            return true;
+        }
+        q++;
+    }
+    return false;
+}
+
+bool text_scanner::next_is(char c)
+{
+    if(_p<_eol && *_p==c)
+    {
+        _p++;
+        return true;
+    }
+    return false;
+}
+
+bool text_scanner::skip_to(char c)
+{
+    const char *q=(const char*)memchr(_p,c,(size_t)(_eol-_p));
+    if(q==NULL) return false;
+    _p=q+1;
+    return true;
+}
+
+bool text_scanner::digits(unsigned long long &x)
+{
+    if(_p>=_eol || !is_digit(*_p)) return false;
+    unsigned long long v=0;
+    for(;_p<_eol && is_digit(*_p);_p++)
+    {
+        unsigned long long w=v*10+(unsigned)(*_p-'0');
+        v= w>=v ? w : ~0ull;        //saturated
+    }
+    x=v;
+    return true;
+}
+
+bool text_scanner::integer(int &x)
+{
+    skip_space();
+    const char *p=_p;
+    bool neg=false;
+    if(_p<_eol && (*_p=='-' || *_p=='+')) neg=(*_p++=='-');
+    unsigned long long v;
+    if(!digits(v))
+    {
+        _p=p;
+        return false;
+    }
+    x= neg ? -(int)v : (int)v;
+    return true;
+}
+
+bool text_scanner::integer(unsigned long &x)
+{
+    skip_space();
+    const char *p=_p;
+    if(_p<_eol && *_p=='+') _p++;
+    unsigned long long v;
+    if(!digits(v))
+    {
+        _p=p;
+        return false;
+    }
+    x=(unsigned long)v;
+    return true;
+}
+
+// exact for up to 15 significant digits and exponent within 22, which covers the model files
+// longer numbers are given to strtod()
+bool text_scanner::real(double &x)
+{
+    skip_space();
+    const char *p=_p;
+    bool neg=false;
+    if(p<_eol && (*p=='-' || *p=='+')) neg=(*p++=='-');
+
+    uint64_t m=0;
+    int significant=0;
+    int exp=0;
+    bool any=false;
+    for(;p<_eol && is_digit(*p);p++)
+    {
+        any=true;
+        if(significant<19)
+        {
+            m=m*10+(unsigned)(*p-'0');
+            if(m) significant++;
+        }
+        else
+        {
+            exp++;
+        }
+    }
+    if(p<_eol && *p=='.')
+    {
+        p++;
+        for(;p<_eol && is_digit(*p);p++)
+        {
+            any=true;
+            if(significant<19)
+            {
+                m=m*10+(unsigned)(*p-'0');
+                if(m) significant++;
+                exp--;
+            }
+        }
+    }
+    if(!any) return false;
+
+    if(p<_eol && (*p=='e' || *p=='E'))
+    {
+        const char *q=p+1;
+        bool eneg=false;
+        if(q<_eol && (*q=='-' || *q=='+')) eneg=(*q++=='-');
+        if(q<_eol && is_digit(*q))
+        {
+            int e=0;
+            for(;q<_eol && is_digit(*q);q++)
+            {
+                if(e<10000) e=e*10+(*q-'0');
+            }
+            exp+= eneg ? -e : e;
+            p=q;
+        }
+    }
+
+    if(m<(1ull<<53) && exp>=-22 && exp<=22)
+    {
+        double v= exp<0 ? (double)m/pow10_table[-exp] : (double)m*pow10_table[exp];
+        x= neg ? -v : v;
+    }
+    else
+    {
+        std::string s(_p,p);
+        x=strtod(s.c_str(),NULL);
+    }
+    _p=p;
+    return true;
+}
+
+bool text_scanner::word(std::string &x)
+{
+    skip_space();
+    const char *q=_p;
+    while(q<_eol && *q!=' ' && *q!='\t') q++;
+    if(q==_p) return false;
+    x.assign(_p,q);
+    _p=q;
+    return true;
+}
+
+bool text_scanner::until(char c, std::string &x)
+{
+    const char *q=(const char*)memchr(_p,c,(size_t)(_eol-_p));
+    if(q==NULL || q==_p) return false;
+    x.assign(_p,q);
+    _p=q+1;
+    return true;
+}
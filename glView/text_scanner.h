@@ -0,0 +1,83 @@
+#ifndef TEXT_SCANNER_H
+#define TEXT_SCANNER_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// whole file in memory, mapped when the platform allows, read into a buffer otherwise
+class text_file
+{
+public:
+    text_file();
+    ~text_file();
+
+    bool open(const char *fname);
+    void close(void);
+
+    const char *begin(void) const {return _data;}
+    const char *end(void) const {return _data+_size;}
+    size_t size(void) const {return _size;}
+
+private:
+    text_file(const text_file &) = delete;
+    text_file &operator=(const text_file &) = delete;
+
+    const char *_data;
+    size_t _size;
+    void *_view;                //mapped view, nullptr when the file is in _buffer
+#ifdef _WIN32
+    void *_file;
+    void *_mapping;
+#endif
+    std::vector<char> _buffer;
+};
+
+// line oriented tokenizer with its own number parser, a replacement of fgets() and sscanf()
+// every read skips spaces and tabs first and never goes beyond the current line.
+class text_scanner
+{
+public:
+    text_scanner(const char *begin, const char *end);
+
+    bool next_line(void);                       //false at the end of the text
+    const char *position(void) const {return _next;}    //top of the next line
+
+    // tops of the next n lines and the end of the last one (n+1 entries), false when fewer lines are left
+    bool lines(size_t n, std::vector<const char*> &tops);
+
+    bool keyword(const char *k);                //k at the top of the line followed by a space or the end of line
+    bool seek(const char *s);                   //s anywhere in the line like strstr(), cursor moves after it
+    bool next_is(char c);                       //c at the cursor without skipping spaces, consumed
+    bool skip_to(char c);                       //c after the cursor, cursor moves after it
+    bool integer(int &x);
+    bool integer(unsigned long &x);
+    bool real(double &x);
+    bool word(std::string &x);                  //until a space like "%s"
+    bool until(char c, std::string &x);         //until c like "%[^c]", c is consumed
+
+    static const char *next_line_top(const char *p, const char *end);   //top of the line after the one p is in
+
+private:
+    void skip_space(void);
+    bool digits(unsigned long long &x);
+
+private:
+    const char *_end;
+    const char *_line;
+    const char *_eol;
+    const char *_p;
+    const char *_next;
+};
+
+#endif // TEXT_SCANNER_H
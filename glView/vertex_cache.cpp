@@ -0,0 +1,183 @@
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include "vertex_cache.h"
+
+#include <cmath>
+
+#define VALENCE_TABLE_SIZE 64
+
+// score of a vertex by its position in the cache and the number of triangles left
+class vertex_score
+{
+public:
+    vertex_score()
+    {
+        for(int i=0;i<VERTEX_CACHE_SIZE;i++)
+        {
+            // the last triangle's vertices get a fixed score, they are used without a cache miss anyway
+            _cache[i]= i<3 ? 0.75f : std::pow(1.0f-(float)(i-3)/(VERTEX_CACHE_SIZE-3),1.5f);
+        }
+        for(int i=0;i<VALENCE_TABLE_SIZE;i++)
+        {
+            _valence[i]= i>0 ? 2.0f*std::pow((float)i,-0.5f) : 0.0f;
+        }
+    }
+
+    float operator()(int pos, uint32_t valence) const
+    {
+        if(valence==0) return -1.0f;
+        float s= pos>=0 ? _cache[pos] : 0.0f;
+        s+= valence<VALENCE_TABLE_SIZE ? _valence[valence] : 2.0f*std::pow((float)valence,-0.5f);
+        return s;
+    }
+
+private:
+    float _cache[VERTEX_CACHE_SIZE];
+    float _valence[VALENCE_TABLE_SIZE];
+};
+
+void vertex_cache_optimize(uint32_t *index, size_t n_index, uint32_t n_vertex)
+{
+    static const vertex_score score;
+
+    size_t n_tri=n_index/3;
+    if(n_tri<2 || n_vertex==0) return;
+
+    //triangles of every vertex, the list of a vertex is kept compact as triangles are emitted
+    std::vector<uint32_t> valence(n_vertex,0);
+    for(size_t i=0;i<n_tri*3;i++) valence[index[i]]++;
+
+    std::vector<uint32_t> top(n_vertex+1,0);
+    for(uint32_t v=0;v<n_vertex;v++) top[v+1]=top[v]+valence[v];
+
+    std::vector<uint32_t> adj(n_tri*3);
+    {
+        std::vector<uint32_t> fill(top.begin(),top.end()-1);
+        for(size_t t=0;t<n_tri;t++)
+        {
+            for(int k=0;k<3;k++) adj[fill[index[t*3+k]]++]=(uint32_t)t;
+        }
+    }
+
+    std::vector<int> pos(n_vertex,-1);
+    std::vector<float> v_score(n_vertex);
+    for(uint32_t v=0;v<n_vertex;v++) v_score[v]=score(-1,valence[v]);
+
+    std::vector<float> t_score(n_tri);
+    std::vector<uint8_t> emitted(n_tri,0);
+    int64_t best=-1;
+    float best_score=-1.0f;
+    for(size_t t=0;t<n_tri;t++)
+    {
+        const uint32_t *x=&index[t*3];
+        t_score[t]=v_score[x[0]]+v_score[x[1]]+v_score[x[2]];
+        if(t_score[t]>best_score)
+        {
+            best_score=t_score[t];
+            best=(int64_t)t;
+        }
+    }
+
+    std::vector<uint32_t> out;
+    out.reserve(n_tri*3);
+
+    uint32_t cache[VERTEX_CACHE_SIZE+3];
+    uint32_t next[VERTEX_CACHE_SIZE+3];
+    int n_cache=0;
+    size_t cursor=0;
+
+    for(size_t n=0;n<n_tri;n++)
+    {
+        if(best<0)
+        {   //nothing in the cache has triangles left, continue from the next one in the original order
+            while(emitted[cursor]) cursor++;
+            best=(int64_t)cursor;
+        }
+
+        size_t t=(size_t)best;
+        emitted[t]=1;
+        const uint32_t *x=&index[t*3];
+        int n_next=0;
+        for(int k=0;k<3;k++)
+        {
+            uint32_t v=x[k];
+            out.push_back(v);
+
+            uint32_t *a=&adj[top[v]];
+            for(uint32_t j=0;j<valence[v];j++)
+            {
+                if(a[j]==t)
+                {
+                    a[j]=a[valence[v]-1];
+                    break;
+                }
+            }
+            valence[v]--;
+
+            if(pos[v]!=-2)
+            {
+                pos[v]=-2;      //marked to skip while the cache is rebuilt
+                next[n_next++]=v;
+            }
+        }
+
+        //vertices of the triangle go to the front, the others are pushed back
+        for(int i=0;i<n_cache;i++)
+        {
+            if(pos[cache[i]]!=-2) next[n_next++]=cache[i];
+        }
+
+        best=-1;
+        best_score=-1.0f;
+        for(int i=0;i<n_next;i++)
+        {
+            uint32_t v=next[i];
+            pos[v]= i<VERTEX_CACHE_SIZE ? i : -1;
+            v_score[v]=score(pos[v],valence[v]);
+        }
+        for(int i=0;i<n_next;i++)
+        {
+            uint32_t v=next[i];
+            const uint32_t *a=&adj[top[v]];
+            for(uint32_t j=0;j<valence[v];j++)
+            {
+                uint32_t u=a[j];
+                const uint32_t *y=&index[u*3];
+                t_score[u]=v_score[y[0]]+v_score[y[1]]+v_score[y[2]];
+                if(t_score[u]>best_score)
+                {
+                    best_score=t_score[u];
+                    best=u;
+                }
+            }
+        }
+
+        n_cache= n_next<VERTEX_CACHE_SIZE ? n_next : VERTEX_CACHE_SIZE;
+        for(int i=0;i<n_cache;i++) cache[i]=next[i];
+    }
+
+    for(size_t i=0;i<out.size();i++) index[i]=out[i];
+}
+
+void vertex_fetch_order(const uint32_t *index, size_t n_index, uint32_t n_vertex, std::vector<uint32_t> &remap)
+{
+    remap.assign(n_vertex,UINT32_MAX);
+    uint32_t n=0;
+    for(size_t i=0;i<n_index;i++)
+    {
+        if(remap[index[i]]==UINT32_MAX) remap[index[i]]=n++;
+    }
+    for(uint32_t v=0;v<n_vertex;v++)
+    {
+        if(remap[v]==UINT32_MAX) remap[v]=n++;
+    }
+}
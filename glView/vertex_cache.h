@@ -0,0 +1,27 @@
+#ifndef VERTEX_CACHE_H
+#define VERTEX_CACHE_H
+
+/*
+Copyright 2021 Wagon Wheel Robotics
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#define VERTEX_CACHE_SIZE 32        //modeled post-transform cache entries
+
+// reorders triangles of an indexed list for the post-transform vertex cache (Forsyth's linear-speed method)
+// indices have to be less than n_vertex.
+void vertex_cache_optimize(uint32_t *index, size_t n_index, uint32_t n_vertex);
+
+// vertex order by the first use in the index list, remap[old]=new, unused vertices are put at the end
+void vertex_fetch_order(const uint32_t *index, size_t n_index, uint32_t n_vertex, std::vector<uint32_t> &remap);
+
+#endif // VERTEX_CACHE_H
@@ -31,6 +31,9 @@ viewOptionsDialog::viewOptionsDialog(const QVariantMap &opts, QWidget *parent) :
     ui->dsbOrthNear->setValue(opts["dsbOrthNear"].toDouble());
     ui->dsbOrthFar->setValue(opts["dsbOrthFar"].toDouble()); 
     ui->cbPointAntiAlias->setChecked( opts["cbPointAntiAlias"].toInt()==1 );
+    ui->cbBatchSmallClouds->setChecked( opts["cbBatchSmallClouds"].toInt()==1 );
+    ui->sbGpuBudget->setValue(opts["sbGpuBudget"].toInt());
+    ui->sbCpuBudget->setValue(opts["sbCpuBudget"].toInt());
     updateUi();
 }
 
@@ -47,6 +50,9 @@ void viewOptionsDialog::on_buttonBox_accepted()
     _opts["dsbOrthNear"]=ui->dsbOrthNear->value();
     _opts["dsbOrthFar"]=ui->dsbOrthFar->value();
     _opts["cbPointAntiAlias"]=ui->cbPointAntiAlias->checkState()==Qt::Checked ? 1:0;
+    _opts["cbBatchSmallClouds"]=ui->cbBatchSmallClouds->checkState()==Qt::Checked ? 1:0;
+    _opts["sbGpuBudget"]=ui->sbGpuBudget->value();
+    _opts["sbCpuBudget"]=ui->sbCpuBudget->value();
 }
 
 QVariantMap viewOptionsDialog::load(void)
@@ -60,6 +66,9 @@ QVariantMap viewOptionsDialog::load(void)
     ret["dsbOrthNear"]=-50.0;
     ret["dsbOrthFar"]=5000.0;
     ret["cbPointAntiAlias"]=(int)0;
+    ret["cbBatchSmallClouds"]=(int)0;
+    ret["sbGpuBudget"]=(int)0;     //[MB], 0: unlimited
+    ret["sbCpuBudget"]=(int)0;
 
     QString config=QStandardPaths::writableLocation(QStandardPaths::ConfigLocation);
     QFile configFile(config+"/glWidget.ini");